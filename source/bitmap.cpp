@@ -1,48 +1,115 @@
 #include "bitmap.h"
+#include "ledfile.h"
 #include <cmath>
-
-bitmap_undo_op_t* create_undo_op(int x, int y, unsigned char r, unsigned char g, unsigned char b) {
-	bitmap_undo_op_t* undo_op = new bitmap_undo_op_t();
-	undo_op->x = x;
-	undo_op->y = y;
-	undo_op->r = r;
-	undo_op->g = g;
-	undo_op->b = b;
-	return undo_op;
-}
-
-void destroy_undo_op(bitmap_undo_op_t* undo_op) {
-	delete undo_op;
-}
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <bitset>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <climits>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BITMAP_SSE2
+#endif
 
 bitmap_undo_block_t* create_undo_block() {
 	bitmap_undo_block_t* undo_block = new bitmap_undo_block_t();
-	undo_block->undo_ops = {};
+	undo_block->id = 0;
+	undo_block->queued = false;
+	undo_block->spans = {};
+	undo_block->pixels = {};
+	undo_block->tiles = {};
+	undo_block->packed = {};
 	return undo_block;
 }
 
 void destroy_undo_block(bitmap_undo_block_t* undo_block) {
-	for (bitmap_undo_op_t* undo_op : undo_block->undo_ops)
-		destroy_undo_op(undo_op);
-	undo_block->undo_ops.clear();
-
 	delete undo_block;
 }
 
+// a shared tile counts for its share of the references
+size_t undo_block_memory(bitmap_undo_block_t* undo_block) {
+	size_t memory = sizeof(bitmap_undo_block_t) +
+	undo_block->spans.capacity() * sizeof(bitmap_span_t) +
+	undo_block->pixels.capacity() +
+	undo_block->tiles.capacity() * sizeof(bitmap_tile_t) +
+	undo_block->packed.capacity();
+	for (bitmap_tile_t& tile : undo_block->tiles) {
+		if (tile.pixels)
+			memory += tile.pixels->capacity() / tile.pixels.use_count();
+	}
+	return memory;
+}
+
+// every change to the image goes through here, so the generation counter
+// tells cached results derived from the image when they went stale. a cached
+// tile is only good until its tile is written
+static inline void bitmap_touch(bitmap_t* bitmap, int x, int y, int width, int height) {
+	bitmap->generation++;
+	bitmap_mark_dirty(bitmap, x, y, width, height);
+
+	if (bitmap->tiled_undo && width > 0 && height > 0) {
+		int tx2 = std::min((x + width - 1) / BITMAP_TILE_SIZE, bitmap->tiles_x - 1);
+		int ty2 = std::min((y + height - 1) / BITMAP_TILE_SIZE, bitmap->tiles_y - 1);
+		for (int ty = std::max(y, 0) / BITMAP_TILE_SIZE; ty <= ty2; ty++) {
+			for (int tx = std::max(x, 0) / BITMAP_TILE_SIZE; tx <= tx2; tx++)
+				bitmap->tile_cache[ty * bitmap->tiles_x + tx].reset();
+		}
+	}
+}
+
+static void reset_tiles(bitmap_t* bitmap) {
+	bitmap->tiles_x = (bitmap->w + BITMAP_TILE_SIZE - 1) / BITMAP_TILE_SIZE;
+	bitmap->tiles_y = (bitmap->h + BITMAP_TILE_SIZE - 1) / BITMAP_TILE_SIZE;
+	bitmap->tile_cache.clear();
+	if (bitmap->tiled_undo)
+		bitmap->tile_cache.resize((size_t)bitmap->tiles_x * bitmap->tiles_y);
+	bitmap->undo_touched.clear();
+}
+
+// the part of the image a tile covers; edge tiles come up short
+static void tile_rect(bitmap_t* bitmap, int index, int* x, int* y, int* width, int* height) {
+	*x = (index % bitmap->tiles_x) * BITMAP_TILE_SIZE;
+	*y = (index / bitmap->tiles_x) * BITMAP_TILE_SIZE;
+	*width = std::min(BITMAP_TILE_SIZE, bitmap->w - *x);
+	*height = std::min(BITMAP_TILE_SIZE, bitmap->h - *y);
+}
+
 bitmap_t* create_bitmap(int width, int height) {
 	bitmap_t* bitmap = new bitmap_t();
 	bitmap->w = width;
 	bitmap->h = height;
-	bitmap->image = new unsigned char[width * height * 3];
+	bitmap->image = new unsigned char[(size_t)width * height * 3];
 	bitmap->cur_undo_block = nullptr;
 	bitmap->undo_blocks = {};
+	bitmap->redo_blocks = {};
+	bitmap->undo_next_id = 0;
+	bitmap->undo_budget = 0;
+	bitmap->history = nullptr;
+	bitmap->undo_touched = {};
+	bitmap->tiled_undo = false;
+	reset_tiles(bitmap);
+	bitmap->generation = 0;
+	bitmap_clear_dirty(bitmap);
+	bitmap_mark_dirty(bitmap, 0, 0, width, height);
 	return bitmap;
 }
 
+static void destroy_history(bitmap_history_t* history);
+
 void destroy_bitmap(bitmap_t* bitmap) {
-	for (bitmap_undo_block_t* undo_block : bitmap->undo_blocks)
-		destroy_undo_block(undo_block);
-	bitmap->undo_blocks.clear();
+	if (bitmap->history) {
+		destroy_history(bitmap->history);
+		bitmap->history = nullptr;
+	}
+	bitmap_clear_undo_blocks(bitmap);
+	if (bitmap->cur_undo_block)
+		destroy_undo_block(bitmap->cur_undo_block);
 
 	delete[] bitmap->image;
 	delete bitmap;
@@ -50,10 +117,25 @@ void destroy_bitmap(bitmap_t* bitmap) {
 
 void bitmap_resize(bitmap_t* bitmap, int width, int height) {
 	delete[] bitmap->image;
-	bitmap->image = new unsigned char[width * height * 3];
+	bitmap->image = new unsigned char[(size_t)width * height * 3];
+	bitmap->w = width;
+	bitmap->h = height;
+
+	// history coordinates mean nothing on a canvas of a different size
+	if (bitmap->cur_undo_block) {
+		destroy_undo_block(bitmap->cur_undo_block);
+		bitmap->cur_undo_block = nullptr;
+	}
+	bitmap_clear_undo_blocks(bitmap);
+	reset_tiles(bitmap);
+
+	bitmap_clear_dirty(bitmap);
+	bitmap_touch(bitmap, 0, 0, width, height);
 }
 
 void bitmap_fill(bitmap_t* bitmap, unsigned char r, unsigned char g, unsigned char b) {
+	bitmap_touch(bitmap, 0, 0, bitmap->w, bitmap->h);
+
 	unsigned char* image = bitmap->image;
 	for (int i = 0; i < bitmap->w * bitmap->h; i++) {
 		int idx = i * 3;
@@ -73,79 +155,1150 @@ void bitmap_pixel(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char
 	bitmap->image[idx] = r;
 	bitmap->image[idx + 1] = g;
 	bitmap->image[idx + 2] = b;
+	bitmap_touch(bitmap, x, y, 1, 1);
+}
+
+// writes a run that lies inside the bitmap, after recording its pre-image.
+// the caller touches what it wrote
+static inline void write_span(bitmap_t* bitmap, int x, int y, int len, const unsigned char* rgb, bool undo) {
+	if (undo)
+		bitmap_push_undo_span(bitmap, x, y, len);
+
+	unsigned char* pixel = &bitmap->image[((size_t)y * bitmap->w + x) * 3];
+	for (int i = 0; i < len; i++, pixel += 3) {
+		pixel[0] = rgb[0];
+		pixel[1] = rgb[1];
+		pixel[2] = rgb[2];
+	}
+}
+
+static inline int64_t ceil_div(int64_t n, int64_t d) {
+	return n >= 0 ? (n + d - 1) / d : -(-n / d);
+}
+
+/* Clipped Line: a Bresenham line walked along its major axis a. step j
+   lands on minor step (2 * minor * j + major) / (2 * major), so the steps
+   inside a rectangle can be solved for directly */
+typedef struct line_steps_s {
+	bool steep;
+	int a1, b1;
+	int sa, sb;
+	int64_t major, minor;
+	int64_t jmin, jmax;
+} line_steps_t;
+
+static inline int64_t line_minor_step(const line_steps_t* line, int64_t j) {
+	return line->major ? (2 * line->minor * j + line->major) / (2 * line->major) : 0;
+}
+
+// the steps of the line from (x1, y1) to (x2, y2) that land inside the
+// rectangle, found without walking any of the others. false if none do
+static bool clip_line(int x1, int y1, int x2, int y2, int left, int top, int width, int height, line_steps_t* line) {
+	line->steep = abs(y2 - y1) > abs(x2 - x1);
+	line->a1 = line->steep ? y1 : x1;
+	line->b1 = line->steep ? x1 : y1;
+	int a2 = line->steep ? y2 : x2;
+	int b2 = line->steep ? x2 : y2;
+	int aLo = line->steep ? top : left;
+	int bLo = line->steep ? left : top;
+	int aHi = aLo + (line->steep ? height : width) - 1;
+	int bHi = bLo + (line->steep ? width : height) - 1;
+	line->sa = line->a1 < a2 ? 1 : -1;
+	line->sb = line->b1 < b2 ? 1 : -1;
+	line->major = abs(a2 - line->a1);
+	line->minor = abs(b2 - line->b1);
+
+	// steps on the major axis inside the rectangle, then minor steps inside it
+	int64_t jmin = line->sa > 0 ? (int64_t)aLo - line->a1 : (int64_t)line->a1 - aHi;
+	int64_t jmax = line->sa > 0 ? (int64_t)aHi - line->a1 : (int64_t)line->a1 - aLo;
+	int64_t kmin = std::max<int64_t>(line->sb > 0 ? (int64_t)bLo - line->b1 : (int64_t)line->b1 - bHi, 0);
+	int64_t kmax = std::min<int64_t>(line->sb > 0 ? (int64_t)bHi - line->b1 : (int64_t)line->b1 - bLo, line->minor);
+	if (kmin > kmax)
+		return false;
+	if (line->minor) {
+		jmin = std::max(jmin, ceil_div(2 * line->major * kmin - line->major, 2 * line->minor));
+		jmax = std::min(jmax, ceil_div(2 * line->major * kmax + line->major, 2 * line->minor) - 1);
+	}
+	line->jmin = std::max<int64_t>(jmin, 0);
+	line->jmax = std::min(jmax, line->major);
+	return line->jmin <= line->jmax;
 }
 
+// the same pixels Bresenham would plot from (x1, y1) to (x2, y2), but only
+// the steps that land on the bitmap are ever visited
 void bitmap_line(bitmap_t* bitmap, int x1, int y1, int x2, int y2, unsigned char r, unsigned char g, unsigned char b, bool undo) {
-	int dx = abs(x2 - x1);
-	int dy = -abs(y2 - y1);
-	int sx = x1 < x2 ? 1 : -1;
-	int sy = y1 < y2 ? 1 : -1;
-	int err1 = dx + dy;
-	int err2;
+	if (y1 == y2) {
+		bitmap_span(bitmap, std::min(x1, x2), y1, abs(x2 - x1) + 1, r, g, b, undo);
+		return;
+	}
+
+	line_steps_t line;
+	if (!clip_line(x1, y1, x2, y2, 0, 0, bitmap->w, bitmap->h, &line))
+		return;
+
+	unsigned char rgb[3] = {r, g, b};
+	int64_t major = line.major, minor = line.minor;
+	int64_t k = line_minor_step(&line, line.jmin);
+	int64_t kLast = line_minor_step(&line, line.jmax);
+	if (!line.steep) {
+		// one row run per minor step, its end solved the same way
+		for (int64_t j = line.jmin; k <= kLast; k++) {
+			int64_t end = std::min(line.jmax, ceil_div(2 * major * k + major, 2 * minor) - 1);
+			int xa = line.a1 + line.sa * (int)j, xb = line.a1 + line.sa * (int)end;
+			write_span(bitmap, std::min(xa, xb), line.b1 + line.sb * (int)k, abs(xb - xa) + 1, rgb, undo);
+			j = end + 1;
+		}
+	} else if (!minor) {
+		// a column walks the image by its stride
+		int x = line.b1;
+		int y = line.a1 + line.sa * (int)line.jmin;
+		ptrdiff_t stride = (ptrdiff_t)bitmap->w * 3 * line.sa;
+		unsigned char* pixel = &bitmap->image[((size_t)y * bitmap->w + x) * 3];
+		for (int64_t j = line.jmin; j <= line.jmax; j++, y += line.sa, pixel += stride) {
+			if (undo)
+				bitmap_push_undo_span(bitmap, x, y, 1);
+			pixel[0] = r;
+			pixel[1] = g;
+			pixel[2] = b;
+		}
+	} else {
+		// one pixel per row; the minor step carries a remainder instead of dividing
+		int64_t rem = (2 * minor * line.jmin + major) % (2 * major);
+		for (int64_t j = line.jmin; j <= line.jmax; j++) {
+			write_span(bitmap, line.b1 + line.sb * (int)k, line.a1 + line.sa * (int)j, 1, rgb, undo);
+			rem += 2 * minor;
+			if (rem >= 2 * major) {
+				rem -= 2 * major;
+				k++;
+			}
+		}
+	}
+
+	int xa = line.b1 + line.sb * (int)line_minor_step(&line, line.jmin), ya = line.a1 + line.sa * (int)line.jmin;
+	int xb = line.b1 + line.sb * (int)kLast, yb = line.a1 + line.sa * (int)line.jmax;
+	if (!line.steep) {
+		std::swap(xa, ya);
+		std::swap(xb, yb);
+	}
+	bitmap_touch(bitmap, std::min(xa, xb), std::min(ya, yb), abs(xb - xa) + 1, abs(yb - ya) + 1);
+}
+
+void bitmap_span(bitmap_t* bitmap, int x, int y, int len, unsigned char r, unsigned char g, unsigned char b, bool undo) {
+	if (y < 0 || y >= bitmap->h)
+		return;
+	if (x < 0) {
+		len += x;
+		x = 0;
+	}
+	if (x + len > bitmap->w)
+		len = bitmap->w - x;
+	if (len < 1)
+		return;
+
+	if (undo)
+		bitmap_push_undo_span(bitmap, x, y, len);
+	bitmap_touch(bitmap, x, y, len, 1);
+
+	unsigned char* pixel = &bitmap->image[(y * bitmap->w + x) * 3];
+	for (int i = 0; i < len; i++, pixel += 3) {
+		pixel[0] = r;
+		pixel[1] = g;
+		pixel[2] = b;
+	}
+}
+
+// clips a run from xa to xb (inclusive, either order) to the bitmap and
+// queues it for draw_spans
+static inline void emit_span(bitmap_t* bitmap, std::vector<bitmap_span_t>* spans, int xa, int xb, int y) {
+	if (xa > xb)
+		std::swap(xa, xb);
+	xa = std::max(xa, 0);
+	xb = std::min(xb, bitmap->w - 1);
+	if (y >= 0 && y < bitmap->h && xa <= xb)
+		spans->push_back({xa, y, xb - xa + 1});
+}
+
+// the shapes hand back clipped row runs; writing them is the same for all of
+// them, and the whole shape is touched once
+static void draw_spans(bitmap_t* bitmap, const std::vector<bitmap_span_t>& spans, unsigned char r, unsigned char g, unsigned char b, bool undo) {
+	if (spans.empty())
+		return;
+
+	unsigned char rgb[3] = {r, g, b};
+	int x1 = bitmap->w, y1 = bitmap->h, x2 = -1, y2 = -1;
+	for (const bitmap_span_t& span : spans) {
+		write_span(bitmap, span.x, span.y, span.len, rgb, undo);
+		x1 = std::min(x1, span.x);
+		y1 = std::min(y1, span.y);
+		x2 = std::max(x2, span.x + span.len - 1);
+		y2 = std::max(y2, span.y);
+	}
+	bitmap_touch(bitmap, x1, y1, x2 - x1 + 1, y2 - y1 + 1);
+}
+
+// the columns each row of a brush covers, relative to the pixel it's centered
+// on. round brushes keep the pixels within width / 2 - 1/4 of the brush's
+// middle, which keeps the small sizes from squaring off
+static void brush_rows(int width, int brush, std::vector<int>* left, std::vector<int>* right) {
+	int lo = -(width / 2), hi = (width - 1) / 2;
+	double middle = (lo + hi) / 2.0;
+	double radius = width / 2.0 - 0.25;
+	left->clear();
+	right->clear();
+	for (int dy = lo; dy <= hi; dy++) {
+		if (brush == BITMAP_BRUSH_SQUARE) {
+			left->push_back(lo);
+			right->push_back(hi);
+			continue;
+		}
+		double half = sqrt(std::max(radius * radius - (dy - middle) * (dy - middle), 0.0));
+		int l = (int)ceil(middle - half);
+		left->push_back(l);
+		right->push_back(lo + hi - l);
+	}
+}
+
+// a line stamped with a brush at every step. the stamps sweep out a convex
+// shape, so each row it crosses is one run, and only the row's ends are kept
+// while stepping along the line
+void bitmap_brush_line(bitmap_t* bitmap, int x1, int y1, int x2, int y2, int width, int brush, unsigned char r, unsigned char g, unsigned char b, bool undo) {
+	if (width <= 1) {
+		bitmap_line(bitmap, x1, y1, x2, y2, r, g, b, undo);
+		return;
+	}
+
+	// any step within reach of the bitmap can reach into it
+	int lo = -(width / 2), hi = (width - 1) / 2;
+	line_steps_t line;
+	if (!clip_line(x1, y1, x2, y2, -hi, -hi, bitmap->w + width - 1, bitmap->h + width - 1, &line))
+		return;
+
+	std::vector<int> left, right;
+	brush_rows(width, brush, &left, &right);
+
+	int ya = line.steep ? line.a1 + line.sa * (int)line.jmin : line.b1 + line.sb * (int)line_minor_step(&line, line.jmin);
+	int yb = line.steep ? line.a1 + line.sa * (int)line.jmax : line.b1 + line.sb * (int)line_minor_step(&line, line.jmax);
+	int top = std::max(std::min(ya, yb) + lo, 0);
+	int bottom = std::min(std::max(ya, yb) + hi, bitmap->h - 1);
+	std::vector<int> rowLeft(bottom - top + 1, INT_MAX);
+	std::vector<int> rowRight(bottom - top + 1, INT_MIN);
+
+	for (int64_t j = line.jmin; j <= line.jmax; j++) {
+		int a = line.a1 + line.sa * (int)j;
+		int m = line.b1 + line.sb * (int)line_minor_step(&line, j);
+		int cx = line.steep ? m : a;
+		int cy = line.steep ? a : m;
+		for (int dy = std::max(lo, top - cy); dy <= std::min(hi, bottom - cy); dy++) {
+			int row = cy + dy - top;
+			rowLeft[row] = std::min(rowLeft[row], cx + left[dy - lo]);
+			rowRight[row] = std::max(rowRight[row], cx + right[dy - lo]);
+		}
+	}
+
+	std::vector<bitmap_span_t> spans;
+	for (int row = 0; row <= bottom - top; row++) {
+		if (rowLeft[row] <= rowRight[row])
+			emit_span(bitmap, &spans, rowLeft[row], rowRight[row], top + row);
+	}
+	draw_spans(bitmap, spans, r, g, b, undo);
+}
+
+// corners are inclusive and can come in any order
+void bitmap_rect(bitmap_t* bitmap, int x1, int y1, int x2, int y2, bool filled, unsigned char r, unsigned char g, unsigned char b, bool undo) {
+	if (x1 > x2)
+		std::swap(x1, x2);
+	if (y1 > y2)
+		std::swap(y1, y2);
+
+	std::vector<bitmap_span_t> spans;
+	for (int y = std::max(y1, 0); y <= std::min(y2, bitmap->h - 1); y++) {
+		if (filled || y == y1 || y == y2) {
+			emit_span(bitmap, &spans, x1, x2, y);
+		} else {
+			emit_span(bitmap, &spans, x1, x1, y);
+			if (x2 != x1)
+				emit_span(bitmap, &spans, x2, x2, y);
+		}
+	}
+	draw_spans(bitmap, spans, r, g, b, undo);
+}
+
+// the ellipse that fills the box with corners (x1, y1) and (x2, y2). each row
+// is solved from its distance to the middle and mirrored, so the shape comes
+// out symmetric. the outline keeps the pixels of a row that its neighbours
+// above or below don't cover, which leaves it one pixel thick and gap free
+void bitmap_ellipse(bitmap_t* bitmap, int x1, int y1, int x2, int y2, bool filled, unsigned char r, unsigned char g, unsigned char b, bool undo) {
+	if (x1 > x2)
+		std::swap(x1, x2);
+	if (y1 > y2)
+		std::swap(y1, y2);
+
+	double cx = (x1 + x2) / 2.0, cy = (y1 + y2) / 2.0;
+	double rx = (x2 - x1 + 1) / 2.0, ry = (y2 - y1 + 1) / 2.0;
+	auto rowLeft = [&](int y) {
+		if (y < y1 || y > y2)
+			return INT_MAX;
+		// the middle row, or pair of rows, always spans the whole box
+		double t = fabs(y - cy) <= 0.5 ? 0.0 : (y - cy) / ry;
+		int l = (int)ceil(cx - rx * sqrt(std::max(1.0 - t * t, 0.0)));
+		// too narrow to cover a pixel center still leaves the middle
+		return l > x1 + x2 - l ? (int)floor(cx) : l;
+	};
+
+	std::vector<bitmap_span_t> spans;
+	for (int y = std::max(y1, 0); y <= std::min(y2, bitmap->h - 1); y++) {
+		int l = rowLeft(y), rt = x1 + x2 - l;
+		if (filled) {
+			emit_span(bitmap, &spans, l, rt, y);
+			continue;
+		}
+
+		int inner = std::max(rowLeft(y - 1), rowLeft(y + 1));
+		int leftEnd = inner == INT_MAX ? rt : std::min(std::max(l, inner - 1), rt);
+		int rightStart = std::max(x1 + x2 - leftEnd, leftEnd + 1);
+		emit_span(bitmap, &spans, l, leftEnd, y);
+		if (rightStart <= rt)
+			emit_span(bitmap, &spans, rightStart, rt, y);
+	}
+	draw_spans(bitmap, spans, r, g, b, undo);
+}
+
+// copies a rectangle between two bitmaps of the same size
+void bitmap_copy_rect(bitmap_t* dst, bitmap_t* src, int x, int y, int width, int height) {
+	int x2 = std::min(x + width, std::min(dst->w, src->w));
+	int y2 = std::min(y + height, std::min(dst->h, src->h));
+	x = std::max(x, 0);
+	y = std::max(y, 0);
+	if (x >= x2 || y >= y2 || dst->w != src->w)
+		return;
+
+	for (int row = y; row < y2; row++)
+		memcpy(&dst->image[((size_t)row * dst->w + x) * 3], &src->image[((size_t)row * src->w + x) * 3], (size_t)(x2 - x) * 3);
+	bitmap_touch(dst, x, y, x2 - x, y2 - y);
+}
+
+// grows the dirty rectangle to cover the given area; x2/y2 are exclusive and
+// an empty rectangle has x1 >= x2
+void bitmap_mark_dirty(bitmap_t* bitmap, int x, int y, int width, int height) {
+	int x2 = std::min(x + width, bitmap->w);
+	int y2 = std::min(y + height, bitmap->h);
+	x = std::max(x, 0);
+	y = std::max(y, 0);
+	if (x >= x2 || y >= y2)
+		return;
+
+	if (bitmap->dirty_x1 >= bitmap->dirty_x2) {
+		bitmap->dirty_x1 = x;
+		bitmap->dirty_y1 = y;
+		bitmap->dirty_x2 = x2;
+		bitmap->dirty_y2 = y2;
+		return;
+	}
+
+	bitmap->dirty_x1 = std::min(bitmap->dirty_x1, x);
+	bitmap->dirty_y1 = std::min(bitmap->dirty_y1, y);
+	bitmap->dirty_x2 = std::max(bitmap->dirty_x2, x2);
+	bitmap->dirty_y2 = std::max(bitmap->dirty_y2, y2);
+}
+
+bool bitmap_get_dirty(bitmap_t* bitmap, int* x, int* y, int* width, int* height) {
+	if (bitmap->dirty_x1 >= bitmap->dirty_x2)
+		return false;
+
+	*x = bitmap->dirty_x1;
+	*y = bitmap->dirty_y1;
+	*width = bitmap->dirty_x2 - bitmap->dirty_x1;
+	*height = bitmap->dirty_y2 - bitmap->dirty_y1;
+	return true;
+}
+
+void bitmap_clear_dirty(bitmap_t* bitmap) {
+	bitmap->dirty_x1 = bitmap->dirty_y1 = 0;
+	bitmap->dirty_x2 = bitmap->dirty_y2 = 0;
+}
+
+static inline bool flood_match(const unsigned char* pixel, const unsigned char* match, int tolerance) {
+	return abs((int)pixel[0] - (int)match[0]) <= tolerance &&
+	abs((int)pixel[1] - (int)match[1]) <= tolerance &&
+	abs((int)pixel[2] - (int)match[2]) <= tolerance;
+}
+
+bool bitmap_match_color(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char tolerance) {
+	if (x < 0 || x >= bitmap->w || y < 0 || y >= bitmap->h)
+		return false;
+
+	unsigned char color[3] = {r, g, b};
+	return flood_match(&bitmap->image[(y * bitmap->w + x) * 3], color, tolerance);
+}
+
+// match bits for 16 packed pixels: bit 3i + c is set when channel c of pixel
+// i is within tolerance. |a - b| is two saturating subtractions or'd together
+#ifdef BITMAP_SSE2
+static inline uint64_t match_bits16(const unsigned char* pixels, const __m128i* color, __m128i tolerance) {
+	uint64_t bits = 0;
+	for (int i = 0; i < 3; i++) {
+		__m128i p = _mm_loadu_si128((const __m128i*)(pixels + i * 16));
+		__m128i diff = _mm_or_si128(_mm_subs_epu8(p, color[i]), _mm_subs_epu8(color[i], p));
+		__m128i within = _mm_cmpeq_epi8(_mm_subs_epu8(diff, tolerance), _mm_setzero_si128());
+		bits |= (uint64_t)(unsigned int)_mm_movemask_epi8(within) << (i * 16);
+	}
+	return bits;
+}
+#endif
+
+// sets mask (w * h bytes) to 255 for every pixel whose channels are all within
+// tolerance of the color and 0 elsewhere, anywhere in the image; returns the
+// number of matches
+int bitmap_match_mask(bitmap_t* bitmap, unsigned char r, unsigned char g, unsigned char b, unsigned char tolerance, unsigned char* mask) {
+	const unsigned char* image = bitmap->image;
+	size_t count = (size_t)bitmap->w * bitmap->h;
+	unsigned char color[3] = {r, g, b};
+	size_t matches = 0;
+	size_t i = 0;
+
+#ifdef BITMAP_SSE2
+	// 16 pixels are 48 bytes, so the color repeats across three registers
+	// with the channel order rotated by one in each
+	unsigned char pattern[48];
+	for (int k = 0; k < 48; k++)
+		pattern[k] = color[k % 3];
+	__m128i colors[3];
+	for (int k = 0; k < 3; k++)
+		colors[k] = _mm_loadu_si128((const __m128i*)(pattern + k * 16));
+	__m128i tol = _mm_set1_epi8((char)tolerance);
+
+	// two pixels' worth of match bits (6 of them) to their two mask bytes
+	static const std::array<uint16_t, 64> pairs = [] {
+		std::array<uint16_t, 64> table;
+		for (int v = 0; v < 64; v++)
+			table[v] = ((v & 7) == 7 ? 0x00ff : 0) | ((v >> 3) == 7 ? 0xff00 : 0);
+		return table;
+	}();
+
+	for (; i + 16 <= count; i += 16) {
+		uint64_t bits = match_bits16(&image[i * 3], colors, tol);
+		for (int k = 0; k < 8; k++)
+			memcpy(&mask[i + k * 2], &pairs[(bits >> (k * 6)) & 63], 2);
+		uint64_t all = bits & (bits >> 1) & (bits >> 2);
+		matches += std::bitset<64>(all & 0x249249249249ull).count();
+	}
+#endif
+
+	for (; i < count; i++) {
+		bool match = flood_match(&image[i * 3], color, tolerance);
+		mask[i] = match ? 255 : 0;
+		matches += match;
+	}
+	return (int)matches;
+}
+
+// recolors every pixel in the image that matches the color at (x, y), whether
+// or not it's connected to it
+int bitmap_replace_color(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char tolerance, bool undo) {
+	if (x < 0 || x >= bitmap->w || y < 0 || y >= bitmap->h)
+		return 0;
+
+	// replacing a color with one it already matches changes nothing
+	if (bitmap_match_color(bitmap, x, y, r, g, b, tolerance))
+		return 0;
+
+	const unsigned char* seed = &bitmap->image[(y * bitmap->w + x) * 3];
+	std::vector<unsigned char> mask((size_t)bitmap->w * bitmap->h);
+	int count = bitmap_match_mask(bitmap, seed[0], seed[1], seed[2], tolerance, mask.data());
+	bitmap_fill_mask(bitmap, mask.data(), r, g, b, undo);
+	return count;
+}
+
+// scanline flood fill; finds every pixel 4-connected to (x, y) whose channels
+// are each within tolerance of the seed color, without touching the image.
+// mask (w * h bytes, may be null) is set to 255 for every pixel in the region,
+// and spans (may be null) receives the region as horizontal runs. once cancel
+// (may be null) is raised, gives up and returns -1 with a partial mask
+int bitmap_flood_region(bitmap_t* bitmap, int x, int y, unsigned char tolerance, unsigned char* mask, std::vector<bitmap_span_t>* spans, const std::atomic<bool>* cancel) {
+	int w = bitmap->w;
+	int h = bitmap->h;
+	if (x < 0 || x >= w || y < 0 || y >= h)
+		return 0;
+
+	std::vector<unsigned char> ownMask;
+	if (!mask) {
+		ownMask.resize((size_t)w * h);
+		mask = ownMask.data();
+	}
+	memset(mask, 0, (size_t)w * h);
+
+	const unsigned char* image = bitmap->image;
+	unsigned char match[3];
+	memcpy(match, &image[(y * w + x) * 3], 3);
+
+	int count = 0;
+	std::vector<int> stack = {x, y};
+	while (!stack.empty()) {
+		if (cancel && cancel->load(std::memory_order_relaxed))
+			return -1;
+
+		int sy = stack.back();
+		stack.pop_back();
+		int sx = stack.back();
+		stack.pop_back();
+
+		int row = sy * w;
+		if (mask[row + sx])
+			continue;
+
+		// grow the seed into the widest matching run on its row
+		int lx = sx;
+		int rx = sx;
+		while (lx > 0 && !mask[row + lx - 1] && flood_match(&image[(row + lx - 1) * 3], match, tolerance))
+			lx--;
+		while (rx < w - 1 && !mask[row + rx + 1] && flood_match(&image[(row + rx + 1) * 3], match, tolerance))
+			rx++;
+
+		memset(&mask[row + lx], 255, rx - lx + 1);
+		count += rx - lx + 1;
+		if (spans)
+			spans->push_back({lx, sy, rx - lx + 1});
+
+		// queue one seed per matching run directly above and below
+		for (int ny = sy - 1; ny <= sy + 1; ny += 2) {
+			if (ny < 0 || ny >= h)
+				continue;
+
+			int nrow = ny * w;
+			bool inRun = false;
+			for (int nx = lx; nx <= rx; nx++) {
+				bool test = !mask[nrow + nx] && flood_match(&image[(nrow + nx) * 3], match, tolerance);
+				if (test && !inRun) {
+					stack.push_back(nx);
+					stack.push_back(ny);
+				}
+				inRun = test;
+			}
+		}
+	}
+
+	return count;
+}
+
+int bitmap_flood_fill(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char tolerance, bool undo) {
+	if (x < 0 || x >= bitmap->w || y < 0 || y >= bitmap->h)
+		return 0;
+
+	// filling with a color the region already matches changes nothing
+	if (bitmap_match_color(bitmap, x, y, r, g, b, tolerance))
+		return 0;
+
+	std::vector<bitmap_span_t> spans;
+	int count = bitmap_flood_region(bitmap, x, y, tolerance, nullptr, &spans);
+	for (bitmap_span_t& span : spans)
+		bitmap_span(bitmap, span.x, span.y, span.len, r, g, b, undo);
+
+	return count;
+}
 
-	bitmap_pixel(bitmap, x1, y1, r, g, b, undo);
-	while (x1 != x2 || y1 != y2) {
-		err2 = 2 * err1;
-		if (err2 >= dy) {
-			err1 += dy;
-			x1 += sx;
+void bitmap_fill_mask(bitmap_t* bitmap, const unsigned char* mask, unsigned char r, unsigned char g, unsigned char b, bool undo) {
+	for (int y = 0; y < bitmap->h; y++) {
+		const unsigned char* row = &mask[y * bitmap->w];
+		int x = 0;
+		while (x < bitmap->w) {
+			if (!row[x]) {
+				x++;
+				continue;
+			}
+
+			int start = x;
+			while (x < bitmap->w && row[x])
+				x++;
+			bitmap_span(bitmap, start, y, x - start, r, g, b, undo);
 		}
-		if (err2 <= dx) {
-			err1 += dx;
-			y1 += sy;
+	}
+}
+
+bool bitmap_fillmask_matches(bitmap_fillmask_t* fillmask, bitmap_t* bitmap, int x, int y, unsigned char tolerance, unsigned char r, unsigned char g, unsigned char b) {
+	return fillmask->valid && fillmask->generation == bitmap->generation &&
+	fillmask->x == x && fillmask->y == y && fillmask->tolerance == tolerance &&
+	fillmask->r == r && fillmask->g == g && fillmask->b == b &&
+	fillmask->mask.size() == (size_t)bitmap->w * bitmap->h;
+}
+
+struct flood_worker_s {
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::atomic<bool> cancel;
+	bool quit;
+	bool busy;
+
+	// copy of the image the jobs run on, retaken only when the generation moves
+	std::shared_ptr<bitmap_t> snapshot;
+
+	bool pending;
+	bitmap_fillmask_t request;
+	std::shared_ptr<bitmap_t> requestSnapshot;
+
+	bool finished;
+	bitmap_fillmask_t result;
+	std::function<void()> finishedFunc;
+};
+
+static void flood_worker_run(flood_worker_t* worker) {
+	std::unique_lock<std::mutex> lock(worker->mutex);
+	while (1) {
+		worker->wake.wait(lock, [worker] { return worker->quit || worker->pending; });
+		if (worker->quit)
+			break;
+
+		bitmap_fillmask_t job = worker->request;
+		std::shared_ptr<bitmap_t> snapshot = worker->requestSnapshot;
+		worker->pending = false;
+		worker->busy = true;
+		worker->cancel = false;
+		lock.unlock();
+
+		job.mask.resize((size_t)snapshot->w * snapshot->h);
+		if (bitmap_match_color(snapshot.get(), job.x, job.y, job.r, job.g, job.b, job.tolerance)) {
+			memset(job.mask.data(), 0, job.mask.size());
+			job.count = 0;
+		} else {
+			job.count = bitmap_flood_region(snapshot.get(), job.x, job.y, job.tolerance, job.mask.data(), nullptr, &worker->cancel);
+		}
+		snapshot.reset();
+
+		lock.lock();
+		worker->busy = false;
+		if (job.count >= 0) {
+			job.valid = true;
+			worker->result = std::move(job);
+			worker->finished = true;
+			if (worker->finishedFunc) {
+				lock.unlock();
+				worker->finishedFunc();
+				lock.lock();
+			}
 		}
-		bitmap_pixel(bitmap, x1, y1, r, g, b, undo);
 	}
 }
 
+// finishedFunc (may be null) is called on the worker thread whenever a new
+// mask is ready to poll
+flood_worker_t* create_flood_worker(std::function<void()> finishedFunc) {
+	flood_worker_t* worker = new flood_worker_t();
+	worker->finishedFunc = finishedFunc;
+	worker->cancel = false;
+	worker->quit = false;
+	worker->busy = false;
+	worker->pending = false;
+	worker->finished = false;
+	worker->request.valid = false;
+	worker->result.valid = false;
+	worker->thread = std::thread(flood_worker_run, worker);
+	return worker;
+}
+
+void destroy_flood_worker(flood_worker_t* worker) {
+	{
+		std::lock_guard<std::mutex> lock(worker->mutex);
+		worker->quit = true;
+		worker->cancel = true;
+	}
+	worker->wake.notify_one();
+	worker->thread.join();
+	delete worker;
+}
+
+// queues a region computation for the given key, superseding and cancelling
+// whatever is queued or running; repeating the latest request is free
+void flood_worker_request(flood_worker_t* worker, bitmap_t* bitmap, int x, int y, unsigned char tolerance, unsigned char r, unsigned char g, unsigned char b) {
+	if (x < 0 || x >= bitmap->w || y < 0 || y >= bitmap->h)
+		return;
+
+	// only this thread writes the request and the snapshot, so both can be
+	// checked and the snapshot retaken before taking the lock
+	bitmap_fillmask_t& request = worker->request;
+	if (request.valid && request.generation == bitmap->generation &&
+	request.x == x && request.y == y && request.tolerance == tolerance &&
+	request.r == r && request.g == g && request.b == b)
+		return;
+
+	bitmap_t* snapshot = worker->snapshot.get();
+	if (!snapshot || snapshot->generation != bitmap->generation || snapshot->w != bitmap->w || snapshot->h != bitmap->h) {
+		snapshot = create_bitmap(bitmap->w, bitmap->h);
+		memcpy(snapshot->image, bitmap->image, (size_t)bitmap->w * bitmap->h * 3);
+		snapshot->generation = bitmap->generation;
+		worker->snapshot = std::shared_ptr<bitmap_t>(snapshot, destroy_bitmap);
+	}
+
+	std::lock_guard<std::mutex> lock(worker->mutex);
+	request.x = x;
+	request.y = y;
+	request.tolerance = tolerance;
+	request.r = r;
+	request.g = g;
+	request.b = b;
+	request.generation = bitmap->generation;
+	request.valid = true;
+	worker->requestSnapshot = worker->snapshot;
+	worker->pending = true;
+	if (worker->busy)
+		worker->cancel = true;
+	worker->wake.notify_one();
+}
+
+// hands over the newest finished mask, if one arrived since the last poll
+bool flood_worker_poll(flood_worker_t* worker, bitmap_fillmask_t* fillmask) {
+	std::lock_guard<std::mutex> lock(worker->mutex);
+	if (!worker->finished)
+		return false;
+
+	std::swap(*fillmask, worker->result);
+	worker->finished = false;
+	return true;
+}
+
+static void enforce_budget(bitmap_t* bitmap);
+
 void bitmap_start_undo_block(bitmap_t* bitmap) {
+	if (bitmap->cur_undo_block)
+		bitmap_end_undo_block(bitmap);
+
+	// one bit per pixel (or tile), set once its pre-image is in the block;
+	// all bits are cleared again when the block ends
+	size_t touchedSize = bitmap->tiled_undo ? ((size_t)bitmap->tiles_x * bitmap->tiles_y + 7) / 8 : ((size_t)bitmap->w * bitmap->h + 7) / 8;
+	if (bitmap->undo_touched.size() != touchedSize)
+		bitmap->undo_touched.assign(touchedSize, 0);
+
 	bitmap->cur_undo_block = create_undo_block();
 }
 
 void bitmap_end_undo_block(bitmap_t* bitmap) {
-	bitmap->undo_blocks.push_back(bitmap->cur_undo_block);
+	bitmap_undo_block_t* undo_block = bitmap->cur_undo_block;
+	if (!undo_block)
+		return;
 	bitmap->cur_undo_block = nullptr;
+
+	for (bitmap_span_t& span : undo_block->spans) {
+		size_t idx = (size_t)span.y * bitmap->w + span.x;
+		for (int i = 0; i < span.len; i++, idx++)
+			bitmap->undo_touched[idx >> 3] &= ~(1 << (idx & 7));
+	}
+	for (bitmap_tile_t& tile : undo_block->tiles)
+		bitmap->undo_touched[tile.index >> 3] &= ~(1 << (tile.index & 7));
+
+	if (undo_block->spans.empty() && undo_block->tiles.empty()) {
+		destroy_undo_block(undo_block);
+		return;
+	}
+
+	undo_block->spans.shrink_to_fit();
+	undo_block->pixels.shrink_to_fit();
+	undo_block->tiles.shrink_to_fit();
+	undo_block->id = ++bitmap->undo_next_id;
+	bitmap->undo_blocks.push_back(undo_block);
+
+	// a new change branches the history, and what was undone can't come back
+	for (bitmap_undo_block_t* redo_block : bitmap->redo_blocks)
+		destroy_undo_block(redo_block);
+	bitmap->redo_blocks.clear();
+	enforce_budget(bitmap);
+}
+
+// tiled undo keeps a tile's pre-image the first time the block writes to it.
+// a tile nothing has written since it was last restored or taken is still
+// in the cache, and gets shared instead of copied
+static void undo_record_tile(bitmap_t* bitmap, int index) {
+	unsigned char bit = 1 << (index & 7);
+	if (bitmap->undo_touched[index >> 3] & bit)
+		return;
+	bitmap->undo_touched[index >> 3] |= bit;
+
+	std::shared_ptr<std::vector<unsigned char>>& cached = bitmap->tile_cache[index];
+	if (!cached) {
+		int x, y, width, height;
+		tile_rect(bitmap, index, &x, &y, &width, &height);
+		cached = std::make_shared<std::vector<unsigned char>>((size_t)width * height * 3);
+		for (int row = 0; row < height; row++)
+			memcpy(&(*cached)[(size_t)row * width * 3], &bitmap->image[((size_t)(y + row) * bitmap->w + x) * 3], (size_t)width * 3);
+	}
+	bitmap->cur_undo_block->tiles.push_back({index, cached});
+}
+
+// records the pre-image of one pixel, unless the open block already holds it;
+// extends the last span when the pixel continues it on the same row
+static void undo_record(bitmap_t* bitmap, int x, int y, const unsigned char* rgb) {
+	if (bitmap->tiled_undo) {
+		undo_record_tile(bitmap, (y / BITMAP_TILE_SIZE) * bitmap->tiles_x + x / BITMAP_TILE_SIZE);
+		return;
+	}
+
+	bitmap_undo_block_t* undo_block = bitmap->cur_undo_block;
+	size_t idx = (size_t)y * bitmap->w + x;
+	unsigned char bit = 1 << (idx & 7);
+	if (bitmap->undo_touched[idx >> 3] & bit)
+		return;
+	bitmap->undo_touched[idx >> 3] |= bit;
+
+	std::vector<bitmap_span_t>& spans = undo_block->spans;
+	if (!spans.empty() && spans.back().y == y && spans.back().x + spans.back().len == x)
+		spans.back().len++;
+	else
+		spans.push_back({x, y, 1});
+	undo_block->pixels.insert(undo_block->pixels.end(), rgb, rgb + 3);
 }
 
 void bitmap_push_undo_op(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b) {
-	bitmap->cur_undo_block->undo_ops.push_back(create_undo_op(x, y, r, g, b));
+	if (!bitmap->cur_undo_block || x < 0 || x >= bitmap->w || y < 0 || y >= bitmap->h)
+		return;
+
+	unsigned char rgb[3] = {r, g, b};
+	undo_record(bitmap, x, y, rgb);
 }
 
-void bitmap_pop_undo_block(bitmap_t* bitmap) {
-	size_t blocksize = bitmap->undo_blocks.size();
-	if (blocksize < 1)
+void bitmap_push_undo_span(bitmap_t* bitmap, int x, int y, int len) {
+	if (!bitmap->cur_undo_block || y < 0 || y >= bitmap->h)
 		return;
-		
-	bitmap_undo_block_t* undo_block = bitmap->undo_blocks[blocksize - 1];
 
-	size_t opsize = undo_block->undo_ops.size();
-	for (int i = 0; i < opsize; i++) {
-		bitmap_pop_undo_op(bitmap);
+	int end = std::min(x + len, bitmap->w);
+	x = std::max(x, 0);
+	if (bitmap->tiled_undo) {
+		// a span only costs one check per tile it crosses
+		int row = (y / BITMAP_TILE_SIZE) * bitmap->tiles_x;
+		for (int tx = x / BITMAP_TILE_SIZE; tx * BITMAP_TILE_SIZE < end; tx++)
+			undo_record_tile(bitmap, row + tx);
+		return;
 	}
+	for (; x < end; x++)
+		undo_record(bitmap, x, y, &bitmap->image[(y * bitmap->w + x) * 3]);
+}
 
-	destroy_undo_block(undo_block);
-	bitmap->undo_blocks.pop_back();
+// brings a compressed block's pixels back, in the order they were packed
+static void unpack_undo_block(bitmap_t* bitmap, bitmap_undo_block_t* undo_block) {
+	if (undo_block->packed.empty())
+		return;
+
+	size_t count = 0;
+	for (bitmap_span_t& span : undo_block->spans)
+		count += span.len;
+	for (bitmap_tile_t& tile : undo_block->tiles) {
+		int x, y, width, height;
+		tile_rect(bitmap, tile.index, &x, &y, &width, &height);
+		count += (size_t)width * height;
+	}
+
+	std::vector<unsigned char> pixels(count * 3);
+	ledfile_rle_decode(undo_block->packed.data(), undo_block->packed.size(), pixels.data(), count);
+	undo_block->packed.clear();
+	undo_block->packed.shrink_to_fit();
+
+	if (undo_block->tiles.empty()) {
+		undo_block->pixels = std::move(pixels);
+		return;
+	}
+	const unsigned char* src = pixels.data();
+	for (bitmap_tile_t& tile : undo_block->tiles) {
+		int x, y, width, height;
+		tile_rect(bitmap, tile.index, &x, &y, &width, &height);
+		size_t size = (size_t)width * height * 3;
+		tile.pixels = std::make_shared<std::vector<unsigned char>>(src, src + size);
+		src += size;
+	}
 }
 
-void bitmap_pop_undo_op(bitmap_t* bitmap) {
-	size_t blocksize = bitmap->undo_blocks.size();
-	if (blocksize < 1)
+// writes a block's pixels back into the image and returns the block that
+// takes them back out again, covering the same spans or tiles
+static bitmap_undo_block_t* apply_undo_block(bitmap_t* bitmap, bitmap_undo_block_t* undo_block) {
+	unpack_undo_block(bitmap, undo_block);
+	bitmap_undo_block_t* inverse = create_undo_block();
+
+	// a block holds at most one pre-image per pixel, so spans can be restored in any order
+	const unsigned char* pixels = undo_block->pixels.data();
+	for (bitmap_span_t& span : undo_block->spans) {
+		if (span.y < bitmap->h && span.x + span.len <= bitmap->w) {
+			unsigned char* image = &bitmap->image[(span.y * bitmap->w + span.x) * 3];
+			inverse->spans.push_back(span);
+			inverse->pixels.insert(inverse->pixels.end(), image, image + span.len * 3);
+			memcpy(image, pixels, span.len * 3);
+			bitmap_touch(bitmap, span.x, span.y, span.len, 1);
+		}
+		pixels += span.len * 3;
+	}
+
+	// a restored tile matches its pre-image again, so the next block to write
+	// there can share it. the tile it replaces is shared the same way
+	for (bitmap_tile_t& tile : undo_block->tiles) {
+		int x, y, width, height;
+		tile_rect(bitmap, tile.index, &x, &y, &width, &height);
+		std::shared_ptr<std::vector<unsigned char>> current = bitmap->tile_cache[tile.index];
+		if (!current) {
+			current = std::make_shared<std::vector<unsigned char>>((size_t)width * height * 3);
+			for (int row = 0; row < height; row++)
+				memcpy(&(*current)[(size_t)row * width * 3], &bitmap->image[((size_t)(y + row) * bitmap->w + x) * 3], (size_t)width * 3);
+		}
+		inverse->tiles.push_back({tile.index, current});
+
+		for (int row = 0; row < height; row++)
+			memcpy(&bitmap->image[((size_t)(y + row) * bitmap->w + x) * 3], &(*tile.pixels)[(size_t)row * width * 3], (size_t)width * 3);
+		bitmap_touch(bitmap, x, y, width, height);
+		bitmap->tile_cache[tile.index] = tile.pixels;
+	}
+
+	inverse->id = ++bitmap->undo_next_id;
+	return inverse;
+}
+
+void bitmap_pop_undo_block(bitmap_t* bitmap) {
+	if (bitmap->undo_blocks.empty())
 		return;
 
-	bitmap_undo_block_t* undo_block = bitmap->undo_blocks[blocksize - 1];
+	bitmap_undo_block_t* undo_block = bitmap->undo_blocks.back();
+	bitmap->undo_blocks.pop_back();
+	bitmap->redo_blocks.push_back(apply_undo_block(bitmap, undo_block));
+	destroy_undo_block(undo_block);
+	enforce_budget(bitmap);
+}
 
-	size_t opsize = undo_block->undo_ops.size();
-	if (opsize < 1)
+void bitmap_pop_redo_block(bitmap_t* bitmap) {
+	if (bitmap->redo_blocks.empty())
 		return;
 
-	bitmap_undo_op_t* undo_op = undo_block->undo_ops[opsize - 1];
-	bitmap_pixel(bitmap, undo_op->x, undo_op->y, undo_op->r, undo_op->g, undo_op->b);
-	destroy_undo_op(undo_op);
-	undo_block->undo_ops.pop_back();
+	bitmap_undo_block_t* redo_block = bitmap->redo_blocks.back();
+	bitmap->redo_blocks.pop_back();
+	bitmap->undo_blocks.push_back(apply_undo_block(bitmap, redo_block));
+	destroy_undo_block(redo_block);
+	enforce_budget(bitmap);
 }
 
+static void history_cancel(bitmap_history_t* history);
+
 void bitmap_clear_undo_blocks(bitmap_t* bitmap) {
 	for (bitmap_undo_block_t* undo_block : bitmap->undo_blocks)
 		destroy_undo_block(undo_block);
 	bitmap->undo_blocks.clear();
+	for (bitmap_undo_block_t* redo_block : bitmap->redo_blocks)
+		destroy_undo_block(redo_block);
+	bitmap->redo_blocks.clear();
+	if (bitmap->history)
+		history_cancel(bitmap->history);
+}
+
+// switching drops the history, which is kept one way or the other
+void bitmap_set_tiled_undo(bitmap_t* bitmap, bool tiled) {
+	if (bitmap->tiled_undo == tiled)
+		return;
+
+	if (bitmap->cur_undo_block) {
+		destroy_undo_block(bitmap->cur_undo_block);
+		bitmap->cur_undo_block = nullptr;
+	}
+	bitmap_clear_undo_blocks(bitmap);
+	bitmap->tiled_undo = tiled;
+	reset_tiles(bitmap);
+}
+
+// every pixel a block covers as spans, whichever way it was recorded
+void bitmap_undo_block_spans(bitmap_t* bitmap, bitmap_undo_block_t* undo_block, std::vector<bitmap_span_t>* spans) {
+	spans->assign(undo_block->spans.begin(), undo_block->spans.end());
+	for (bitmap_tile_t& tile : undo_block->tiles) {
+		int x, y, width, height;
+		tile_rect(bitmap, tile.index, &x, &y, &width, &height);
+		for (int row = 0; row < height; row++)
+			spans->push_back({x, y + row, width});
+	}
+}
+
+// the whole history footprint, both stacks and the open block
+size_t bitmap_undo_memory(bitmap_t* bitmap) {
+	size_t memory = bitmap->undo_touched.capacity() +
+	bitmap->undo_blocks.capacity() * sizeof(bitmap_undo_block_t*) +
+	bitmap->redo_blocks.capacity() * sizeof(bitmap_undo_block_t*) +
+	bitmap->tile_cache.capacity() * sizeof(bitmap->tile_cache[0]);
+	if (bitmap->cur_undo_block)
+		memory += undo_block_memory(bitmap->cur_undo_block);
+	for (bitmap_undo_block_t* undo_block : bitmap->undo_blocks)
+		memory += undo_block_memory(undo_block);
+	for (bitmap_undo_block_t* redo_block : bitmap->redo_blocks)
+		memory += undo_block_memory(redo_block);
+	return memory;
+}
+
+/* Compression Job: a copy of a block's pixels, or references to its
+   immutable tiles, so the block can go away while the job runs */
+typedef struct history_job_s {
+	unsigned int id;
+	size_t count;
+	std::vector<unsigned char> pixels;
+	std::vector<std::shared_ptr<std::vector<unsigned char>>> tiles;
+	std::vector<unsigned char> packed;
+} history_job_t;
+
+struct bitmap_history_s {
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool quit;
+
+	std::deque<history_job_t> jobs;
+	std::vector<history_job_t> results;
+	// jobs queued, running or waiting to be polled
+	int pending;
+	std::function<void()> finishedFunc;
+};
+
+static void history_run(bitmap_history_t* history) {
+	std::unique_lock<std::mutex> lock(history->mutex);
+	while (1) {
+		history->wake.wait(lock, [history] { return history->quit || !history->jobs.empty(); });
+		if (history->quit)
+			break;
+
+		history_job_t job = std::move(history->jobs.front());
+		history->jobs.pop_front();
+		lock.unlock();
+
+		if (!job.tiles.empty()) {
+			for (std::shared_ptr<std::vector<unsigned char>>& tile : job.tiles)
+				job.pixels.insert(job.pixels.end(), tile->begin(), tile->end());
+			job.tiles.clear();
+		}
+		ledfile_rle_encode(job.pixels.data(), job.count, job.packed);
+		job.packed.shrink_to_fit();
+		job.pixels.clear();
+		job.pixels.shrink_to_fit();
+
+		lock.lock();
+		history->results.push_back(std::move(job));
+		if (history->finishedFunc) {
+			lock.unlock();
+			history->finishedFunc();
+			lock.lock();
+		}
+	}
+}
+
+static void destroy_history(bitmap_history_t* history) {
+	{
+		std::lock_guard<std::mutex> lock(history->mutex);
+		history->quit = true;
+	}
+	history->wake.notify_one();
+	history->thread.join();
+	delete history;
+}
+
+// drops queued jobs; whatever is running finishes and is thrown away by the poll
+static void history_cancel(bitmap_history_t* history) {
+	std::lock_guard<std::mutex> lock(history->mutex);
+	history->pending -= (int)history->jobs.size();
+	history->jobs.clear();
+}
+
+static void history_queue(bitmap_t* bitmap, bitmap_undo_block_t* undo_block) {
+	if (undo_block->queued || !undo_block->packed.empty())
+		return;
+	undo_block->queued = true;
+
+	history_job_t job;
+	job.id = undo_block->id;
+	job.count = undo_block->pixels.size() / 3;
+	job.pixels = undo_block->pixels;
+	for (bitmap_tile_t& tile : undo_block->tiles) {
+		job.count += tile.pixels->size() / 3;
+		job.tiles.push_back(tile.pixels);
+	}
+
+	bitmap_history_t* history = bitmap->history;
+	std::lock_guard<std::mutex> lock(history->mutex);
+	history->jobs.push_back(std::move(job));
+	history->pending++;
+	history->wake.notify_one();
+}
+
+// past the budget, everything but the newest blocks on each stack gets
+// compressed first. only once nothing is left in flight and it still doesn't
+// fit are blocks dropped: the oldest undo steps, then the farthest redo steps.
+// the newest undo step always survives
+static void enforce_budget(bitmap_t* bitmap) {
+	if (!bitmap->history || bitmap_undo_memory(bitmap) <= bitmap->undo_budget)
+		return;
+
+	std::vector<bitmap_undo_block_t*>& undo_blocks = bitmap->undo_blocks;
+	std::vector<bitmap_undo_block_t*>& redo_blocks = bitmap->redo_blocks;
+	for (size_t i = 0; i + BITMAP_UNDO_RAW_BLOCKS < undo_blocks.size(); i++)
+		history_queue(bitmap, undo_blocks[i]);
+	for (size_t i = 0; i + BITMAP_UNDO_RAW_BLOCKS < redo_blocks.size(); i++)
+		history_queue(bitmap, redo_blocks[i]);
+
+	{
+		std::lock_guard<std::mutex> lock(bitmap->history->mutex);
+		if (bitmap->history->pending > 0)
+			return;
+	}
+
+	size_t memory = bitmap_undo_memory(bitmap);
+	size_t dropUndo = 0, dropRedo = 0;
+	while (memory > bitmap->undo_budget && dropUndo + 1 < undo_blocks.size())
+		memory -= undo_block_memory(undo_blocks[dropUndo++]);
+	while (memory > bitmap->undo_budget && dropRedo < redo_blocks.size())
+		memory -= undo_block_memory(redo_blocks[dropRedo++]);
+
+	for (size_t i = 0; i < dropUndo; i++)
+		destroy_undo_block(undo_blocks[i]);
+	undo_blocks.erase(undo_blocks.begin(), undo_blocks.begin() + dropUndo);
+	for (size_t i = 0; i < dropRedo; i++)
+		destroy_undo_block(redo_blocks[i]);
+	redo_blocks.erase(redo_blocks.begin(), redo_blocks.begin() + dropRedo);
+}
+
+// a budget of 0 leaves the history unbounded. finishedFunc (may be null) is
+// called on the compressor thread whenever a compressed block is ready to poll
+void bitmap_set_undo_budget(bitmap_t* bitmap, size_t budget, std::function<void()> finishedFunc) {
+	bitmap->undo_budget = budget;
+	if (budget && !bitmap->history) {
+		bitmap_history_t* history = new bitmap_history_t();
+		history->quit = false;
+		history->pending = 0;
+		history->finishedFunc = finishedFunc;
+		history->thread = std::thread(history_run, history);
+		bitmap->history = history;
+	} else if (!budget && bitmap->history) {
+		destroy_history(bitmap->history);
+		bitmap->history = nullptr;
+	}
+	enforce_budget(bitmap);
+}
+
+// swaps compressed blocks in for the ones they were made from, when those are
+// still around and it actually saves memory. returns true if anything changed
+bool bitmap_history_poll(bitmap_t* bitmap) {
+	if (!bitmap->history)
+		return false;
+
+	std::vector<history_job_t> results;
+	{
+		std::lock_guard<std::mutex> lock(bitmap->history->mutex);
+		std::swap(results, bitmap->history->results);
+		bitmap->history->pending -= (int)results.size();
+	}
+	if (results.empty())
+		return false;
+
+	for (history_job_t& job : results) {
+		bitmap_undo_block_t* found = nullptr;
+		for (std::vector<bitmap_undo_block_t*>* stack : {&bitmap->undo_blocks, &bitmap->redo_blocks}) {
+			for (bitmap_undo_block_t* undo_block : *stack) {
+				if (undo_block->id == job.id)
+					found = undo_block;
+			}
+		}
+		if (!found || job.packed.size() >= job.count * 3)
+			continue;
+
+		found->packed = std::move(job.packed);
+		found->pixels.clear();
+		found->pixels.shrink_to_fit();
+		for (bitmap_tile_t& tile : found->tiles)
+			tile.pixels.reset();
+	}
+
+	enforce_budget(bitmap);
+	return true;
 }
\ No newline at end of file
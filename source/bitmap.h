@@ -1,26 +1,69 @@
 #pragma once
 #include <vector>
+#include <cstddef>
+#include <atomic>
+#include <functional>
+#include <memory>
 
-typedef struct bitmap_undo_op_s {
+#define BITMAP_TILE_SIZE 32
+// canvases at least this many pixels keep their undo history as tiles
+#define BITMAP_TILED_UNDO_PIXELS (256 * 256)
+// the newest blocks on either stack stay uncompressed so stepping through them is instant
+#define BITMAP_UNDO_RAW_BLOCKS 8
+
+enum bitmap_brush_e {
+	BITMAP_BRUSH_ROUND,
+	BITMAP_BRUSH_SQUARE
+};
+
+/* Horizontal Pixel Run */
+typedef struct bitmap_span_s {
 	int x, y;
-	int r, g, b;
-} bitmap_undo_op_t;
+	int len;
+} bitmap_span_t;
 
-bitmap_undo_op_t* create_undo_op(int x, int y, unsigned char r, unsigned char g, unsigned char b);
-void destroy_undo_op(bitmap_undo_op_t* undo_op);
+/* Undo Tile: a tile's pre-image, immutable once taken, so blocks and the
+   bitmap's tile cache can share it */
+typedef struct bitmap_tile_s {
+	int index;
+	std::shared_ptr<std::vector<unsigned char>> pixels;
+} bitmap_tile_t;
 
+/* Undo Block: coalesced spans, with their pre-images packed back to back in one arena,
+   or whole tiles when the bitmap keeps tiled undo. once compressed, the pixels (or the
+   tiles' pixels) are freed and packed holds them RLE encoded in the same order */
 typedef struct bitmap_undo_block_s {
-	std::vector<bitmap_undo_op_t*> undo_ops;
+	unsigned int id;
+	bool queued;
+	std::vector<bitmap_span_t> spans;
+	std::vector<unsigned char> pixels;
+	std::vector<bitmap_tile_t> tiles;
+	std::vector<unsigned char> packed;
 } bitmap_undo_block_t;
 
 bitmap_undo_block_t* create_undo_block();
 void destroy_undo_block(bitmap_undo_block_t* undo_block);
+size_t undo_block_memory(bitmap_undo_block_t* undo_block);
+
+/* Background Undo History Compressor */
+typedef struct bitmap_history_s bitmap_history_t;
 
 typedef struct bitmap_s {
 	int w, h;
 	unsigned char* image;
 	bitmap_undo_block_t* cur_undo_block;
 	std::vector<bitmap_undo_block_t*> undo_blocks;
+	std::vector<bitmap_undo_block_t*> redo_blocks;
+	unsigned int undo_next_id;
+	size_t undo_budget;
+	bitmap_history_t* history;
+	std::vector<unsigned char> undo_touched;
+	bool tiled_undo;
+	int tiles_x, tiles_y;
+	std::vector<std::shared_ptr<std::vector<unsigned char>>> tile_cache;
+	int dirty_x1, dirty_y1;
+	int dirty_x2, dirty_y2;
+	unsigned int generation;
 } bitmap_t;
 
 bitmap_t* create_bitmap(int width, int height);
@@ -29,10 +72,53 @@ void bitmap_resize(bitmap_t* bitmap, int width, int height);
 void bitmap_fill(bitmap_t* bitmap, unsigned char r, unsigned char g, unsigned char b);
 void bitmap_pixel(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b, bool undo = false);
 void bitmap_line(bitmap_t* bitmap, int x1, int y1, int x2, int y2, unsigned char r, unsigned char g, unsigned char b, bool undo = false);
+void bitmap_span(bitmap_t* bitmap, int x, int y, int len, unsigned char r, unsigned char g, unsigned char b, bool undo = false);
+void bitmap_brush_line(bitmap_t* bitmap, int x1, int y1, int x2, int y2, int width, int brush, unsigned char r, unsigned char g, unsigned char b, bool undo = false);
+void bitmap_rect(bitmap_t* bitmap, int x1, int y1, int x2, int y2, bool filled, unsigned char r, unsigned char g, unsigned char b, bool undo = false);
+void bitmap_ellipse(bitmap_t* bitmap, int x1, int y1, int x2, int y2, bool filled, unsigned char r, unsigned char g, unsigned char b, bool undo = false);
+void bitmap_copy_rect(bitmap_t* dst, bitmap_t* src, int x, int y, int width, int height);
+
+void bitmap_mark_dirty(bitmap_t* bitmap, int x, int y, int width, int height);
+bool bitmap_get_dirty(bitmap_t* bitmap, int* x, int* y, int* width, int* height);
+void bitmap_clear_dirty(bitmap_t* bitmap);
+
+bool bitmap_match_color(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char tolerance);
+int bitmap_match_mask(bitmap_t* bitmap, unsigned char r, unsigned char g, unsigned char b, unsigned char tolerance, unsigned char* mask);
+int bitmap_replace_color(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char tolerance, bool undo = false);
+int bitmap_flood_region(bitmap_t* bitmap, int x, int y, unsigned char tolerance, unsigned char* mask, std::vector<bitmap_span_t>* spans, const std::atomic<bool>* cancel = nullptr);
+int bitmap_flood_fill(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char tolerance, bool undo = false);
+void bitmap_fill_mask(bitmap_t* bitmap, const unsigned char* mask, unsigned char r, unsigned char g, unsigned char b, bool undo = false);
+
+/* Flood Fill Coverage Mask, valid for the key it was computed with */
+typedef struct bitmap_fillmask_s {
+	int x, y;
+	unsigned char tolerance;
+	unsigned char r, g, b;
+	unsigned int generation;
+	bool valid;
+	int count;
+	std::vector<unsigned char> mask;
+} bitmap_fillmask_t;
+
+bool bitmap_fillmask_matches(bitmap_fillmask_t* fillmask, bitmap_t* bitmap, int x, int y, unsigned char tolerance, unsigned char r, unsigned char g, unsigned char b);
+
+/* Background Flood Fill Worker */
+typedef struct flood_worker_s flood_worker_t;
+
+flood_worker_t* create_flood_worker(std::function<void()> finishedFunc = nullptr);
+void destroy_flood_worker(flood_worker_t* worker);
+void flood_worker_request(flood_worker_t* worker, bitmap_t* bitmap, int x, int y, unsigned char tolerance, unsigned char r, unsigned char g, unsigned char b);
+bool flood_worker_poll(flood_worker_t* worker, bitmap_fillmask_t* fillmask);
 
 void bitmap_start_undo_block(bitmap_t* bitmap);
 void bitmap_end_undo_block(bitmap_t* bitmap);
 void bitmap_push_undo_op(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b);
+void bitmap_push_undo_span(bitmap_t* bitmap, int x, int y, int len);
 void bitmap_pop_undo_block(bitmap_t* bitmap);
-void bitmap_pop_undo_op(bitmap_t* bitmap);
-void bitmap_clear_undo_blocks(bitmap_t* bitmap);
\ No newline at end of file
+void bitmap_pop_redo_block(bitmap_t* bitmap);
+void bitmap_clear_undo_blocks(bitmap_t* bitmap);
+void bitmap_set_tiled_undo(bitmap_t* bitmap, bool tiled);
+void bitmap_undo_block_spans(bitmap_t* bitmap, bitmap_undo_block_t* undo_block, std::vector<bitmap_span_t>* spans);
+size_t bitmap_undo_memory(bitmap_t* bitmap);
+void bitmap_set_undo_budget(bitmap_t* bitmap, size_t budget, std::function<void()> finishedFunc = nullptr);
+bool bitmap_history_poll(bitmap_t* bitmap);
\ No newline at end of file
@@ -0,0 +1,411 @@
+#include "bitmap.h"
+#include "ledfile.h"
+#include "exporter.h"
+#include "wiring.h"
+#include "colorout.h"
+#include "imagefile.h"
+#include "threadpool.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <fstream>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+enum cli_command_e {
+	COMMAND_VALIDATE,
+	COMMAND_CONVERT,
+	COMMAND_EXPORT,
+	COMMAND_IMPORT
+};
+
+// the array exports aren't exporter targets, so they get ids past the end
+#define TARGET_JAVA1D EXPORTER_TARGET_COUNT
+#define TARGET_JAVA2D (EXPORTER_TARGET_COUNT + 1)
+
+/* Job: one input file and what became of it */
+typedef struct cli_job_s {
+	fs::path input;
+	fs::path output;
+	bool ok;
+	std::string message;
+} cli_job_t;
+
+/* Options */
+typedef struct cli_options_s {
+	int command;
+	int threads;
+	fs::path outputDir;
+	int target;
+	int elementWidth;
+	int importWidth, importHeight;
+	wiring_layout_t layout;
+	colorout_t color;
+	std::vector<std::string> inputs;
+} cli_options_t;
+
+static std::mutex wiringMutex;
+static std::map<std::pair<int, int>, wiring_map_t*> wiringMaps;
+
+static void usage() {
+	fprintf(stderr,
+	"usage: leditor-cli <validate|convert|export|import> [options] <file or directory>...\n"
+	"\n"
+	"  validate               check that .led files load and their checksums match\n"
+	"  convert                re-save .led files in the current format\n"
+	"  export                 export .led files for a target\n"
+	"  import                 turn PNG, BMP and PPM images into .led files\n"
+	"\n"
+	"  -o <dir>               output directory (convert, export, import)\n"
+	"  -j <threads>           worker threads, default one per core\n"
+	"  --target <name>        java1d, java2d, c, hex, python or bin (default java1d)\n"
+	"  --width <bits>         8, 16 (RGB565) or 32 (default 8)\n"
+	"  --wiring <name>        row-snake, rows, column-snake or columns (default row-snake)\n"
+	"  --panels <x>x<y>       panel grid the image is split into\n"
+	"  --panel-snake          chain panels back and forth\n"
+	"  --rotate <degrees>     mount rotation clockwise: 0, 90, 180 or 270 (default 0)\n"
+	"  --order <rgb|grb|...>  output channel order\n"
+	"  --gamma <value>        output gamma\n"
+	"  --brightness <0-1>     output brightness cap\n"
+	"  --size <w>x<h>         size imported images are averaged down to (default 16x16)\n");
+}
+
+static bool parse_options(int argc, char** argv, cli_options_t* options) {
+	if (argc < 2)
+		return false;
+
+	if (!strcmp(argv[1], "validate"))
+		options->command = COMMAND_VALIDATE;
+	else if (!strcmp(argv[1], "convert"))
+		options->command = COMMAND_CONVERT;
+	else if (!strcmp(argv[1], "export"))
+		options->command = COMMAND_EXPORT;
+	else if (!strcmp(argv[1], "import"))
+		options->command = COMMAND_IMPORT;
+	else
+		return false;
+
+	options->threads = 0;
+	options->target = TARGET_JAVA1D;
+	options->elementWidth = EXPORTER_WIDTH_8;
+	options->importWidth = 16;
+	options->importHeight = 16;
+	options->layout = wiring_default_layout();
+
+	int order = COLOROUT_RGB;
+	float gamma = 1.0f;
+	float brightness = 1.0f;
+
+	for (int i = 2; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		bool takesValue = arg[0] == '-' && strcmp(arg, "--panel-snake");
+		if (takesValue && !value) {
+			fprintf(stderr, "%s needs a value\n", arg);
+			return false;
+		}
+
+		if (!strcmp(arg, "-o")) {
+			options->outputDir = value;
+		} else if (!strcmp(arg, "-j")) {
+			options->threads = atoi(value);
+		} else if (!strcmp(arg, "--target")) {
+			const char* names[] = {"c", "hex", "python", "bin", "java1d", "java2d"};
+			int targets[] = {EXPORTER_TARGET_C_PROGMEM, EXPORTER_TARGET_HEX, EXPORTER_TARGET_PYTHON, EXPORTER_TARGET_BINARY, TARGET_JAVA1D, TARGET_JAVA2D};
+			options->target = -1;
+			for (int t = 0; t < 6; t++) {
+				if (!strcmp(value, names[t]))
+					options->target = targets[t];
+			}
+			if (options->target < 0) {
+				fprintf(stderr, "unknown target %s\n", value);
+				return false;
+			}
+		} else if (!strcmp(arg, "--width")) {
+			const char* names[] = {"8", "16", "32"};
+			int widths[] = {EXPORTER_WIDTH_8, EXPORTER_WIDTH_16, EXPORTER_WIDTH_32};
+			options->elementWidth = -1;
+			for (int w = 0; w < 3; w++) {
+				if (!strcmp(value, names[w]))
+					options->elementWidth = widths[w];
+			}
+			if (options->elementWidth < 0) {
+				fprintf(stderr, "width should be 8, 16 or 32\n");
+				return false;
+			}
+		} else if (!strcmp(arg, "--wiring")) {
+			const char* names[] = {"row-snake", "rows", "column-snake", "columns"};
+			int preset = -1;
+			for (int p = 0; p < 4; p++) {
+				if (!strcmp(value, names[p]))
+					preset = p;
+			}
+			if (preset < 0) {
+				fprintf(stderr, "unknown wiring %s\n", value);
+				return false;
+			}
+			wiring_layout_t layout = wiring_preset(preset);
+			options->layout.order = layout.order;
+			options->layout.serpentine = layout.serpentine;
+			options->layout.startReversed = layout.startReversed;
+		} else if (!strcmp(arg, "--panels")) {
+			if (sscanf(value, "%dx%d", &options->layout.panelsX, &options->layout.panelsY) != 2 ||
+			options->layout.panelsX <= 0 || options->layout.panelsY <= 0) {
+				fprintf(stderr, "panels should look like 2x2\n");
+				return false;
+			}
+		} else if (!strcmp(arg, "--size")) {
+			if (sscanf(value, "%dx%d", &options->importWidth, &options->importHeight) != 2 ||
+			!ledfile_valid_dimensions(options->importWidth, options->importHeight)) {
+				fprintf(stderr, "size should look like 16x16\n");
+				return false;
+			}
+		} else if (!strcmp(arg, "--panel-snake")) {
+			options->layout.panelSerpentine = true;
+			continue;
+		} else if (!strcmp(arg, "--rotate")) {
+			const char* names[] = {"0", "90", "180", "270"};
+			options->layout.rotation = -1;
+			for (int r = 0; r < 4; r++) {
+				if (!strcmp(value, names[r]))
+					options->layout.rotation = r * 90;
+			}
+			if (options->layout.rotation < 0) {
+				fprintf(stderr, "rotation should be 0, 90, 180 or 270\n");
+				return false;
+			}
+		} else if (!strcmp(arg, "--order")) {
+			char name[8] = {0};
+			for (int c = 0; c < 7 && value[c]; c++)
+				name[c] = toupper(value[c]);
+			order = -1;
+			for (int o = 0; o < COLOROUT_ORDER_COUNT; o++) {
+				if (!strcmp(name, colorout_order_name(o)))
+					order = o;
+			}
+			if (order < 0) {
+				fprintf(stderr, "unknown channel order %s\n", value);
+				return false;
+			}
+		} else if (!strcmp(arg, "--gamma")) {
+			gamma = atof(value);
+		} else if (!strcmp(arg, "--brightness")) {
+			brightness = atof(value);
+		} else if (arg[0] == '-') {
+			fprintf(stderr, "unknown option %s\n", arg);
+			return false;
+		} else {
+			options->inputs.push_back(arg);
+			continue;
+		}
+		i++;
+	}
+
+	float gammas[3] = {gamma, gamma, gamma};
+	colorout_build(&options->color, order, gammas, brightness);
+
+	if (options->inputs.empty())
+		return false;
+	if (options->command != COMMAND_VALIDATE && options->outputDir.empty()) {
+		fprintf(stderr, "%s needs an output directory (-o)\n", argv[1]);
+		return false;
+	}
+	return true;
+}
+
+static const char* output_extension(const cli_options_t* options) {
+	if (options->command == COMMAND_CONVERT || options->command == COMMAND_IMPORT)
+		return ".led";
+
+	switch (options->target) {
+		case EXPORTER_TARGET_C_PROGMEM:
+			return ".h";
+		case EXPORTER_TARGET_HEX:
+			return ".hex";
+		case EXPORTER_TARGET_PYTHON:
+			return ".py";
+		case EXPORTER_TARGET_BINARY:
+			return ".bin";
+		default:
+			return ".java";
+	}
+}
+
+static bool wanted_input(const cli_options_t* options, const fs::path& path) {
+	std::string extension = path.extension().string();
+	for (char& c : extension)
+		c = tolower(c);
+	if (options->command != COMMAND_IMPORT)
+		return extension == ".led";
+	return extension == ".png" || extension == ".bmp" || extension == ".ppm" || extension == ".pgm" || extension == ".pbm";
+}
+
+// directories are searched recursively; outputs mirror their layout
+static void collect_jobs(const cli_options_t* options, std::vector<cli_job_t>* jobs) {
+	for (const std::string& input : options->inputs) {
+		fs::path root(input);
+		std::error_code error;
+		if (!fs::is_directory(root, error)) {
+			cli_job_t job = {root, options->outputDir / root.filename(), false, ""};
+			job.output.replace_extension(output_extension(options));
+			jobs->push_back(job);
+			continue;
+		}
+
+		for (const fs::directory_entry& entry : fs::recursive_directory_iterator(root, error)) {
+			if (!entry.is_regular_file() || !wanted_input(options, entry.path()))
+				continue;
+			cli_job_t job = {entry.path(), options->outputDir / fs::relative(entry.path(), root), false, ""};
+			job.output.replace_extension(output_extension(options));
+			jobs->push_back(job);
+		}
+	}
+}
+
+// files tend to share a handful of sizes, so each size's map is built once
+static const wiring_map_t* get_wiring_map(const wiring_layout_t* layout, int width, int height) {
+	std::lock_guard<std::mutex> lock(wiringMutex);
+	wiring_map_t*& map = wiringMaps[std::make_pair(width, height)];
+	if (!map)
+		map = wiring_compile(layout, width, height);
+	return map;
+}
+
+static bool write_file(const fs::path& path, const char* data, size_t size) {
+	std::error_code error;
+	fs::create_directories(path.parent_path(), error);
+	std::ofstream file(path, std::ios::binary);
+	file.write(data, size);
+	file.close();
+	return !file.fail();
+}
+
+// jobs already run one per core, so each resample stays on its own thread
+static void run_import(const cli_options_t* options, cli_job_t* job) {
+	imagefile_image_t image;
+	int error = imagefile_load(job->input.string().c_str(), &image);
+	if (error != IMAGEFILE_OK) {
+		job->message = imagefile_error_string(error);
+		return;
+	}
+
+	char info[64];
+	sprintf(info, "%dx%d -> %dx%d", image.width, image.height, options->importWidth, options->importHeight);
+	job->message = info;
+
+	bitmap_t* bitmap = create_bitmap(options->importWidth, options->importHeight);
+	imagefile_resample(image.pixels.data(), image.width, image.height, bitmap->image, bitmap->w, bitmap->h, 1);
+
+	std::error_code dirError;
+	fs::create_directories(job->output.parent_path(), dirError);
+	error = ledfile_save(job->output.string().c_str(), bitmap->w, bitmap->h, bitmap->image);
+	destroy_bitmap(bitmap);
+	if (error != LEDFILE_OK) {
+		job->message = ledfile_error_string(error);
+		return;
+	}
+	job->ok = true;
+}
+
+static void run_job(const cli_options_t* options, cli_job_t* job) {
+	if (options->command == COMMAND_IMPORT) {
+		run_import(options, job);
+		return;
+	}
+
+	ledfile_image_t image;
+	int error = ledfile_open(job->input.string().c_str(), &image);
+	if (error != LEDFILE_OK) {
+		job->message = ledfile_error_string(error);
+		return;
+	}
+
+	char info[64];
+	sprintf(info, "v%d %dx%d", image.version, image.width, image.height);
+	job->message = info;
+
+	if (options->command == COMMAND_CONVERT) {
+		bitmap_t* bitmap = create_bitmap(image.width, image.height);
+		memcpy(bitmap->image, image.pixels, (size_t)image.width * image.height * 3);
+		ledfile_close(&image);
+
+		std::error_code dirError;
+		fs::create_directories(job->output.parent_path(), dirError);
+		error = ledfile_save(job->output.string().c_str(), bitmap->w, bitmap->h, bitmap->image);
+		destroy_bitmap(bitmap);
+		if (error != LEDFILE_OK) {
+			job->message = ledfile_error_string(error);
+			return;
+		}
+	} else if (options->command == COMMAND_EXPORT) {
+		const wiring_map_t* map = get_wiring_map(&options->layout, image.width, image.height);
+		if (!map) {
+			ledfile_close(&image);
+			job->message = "wiring layout doesn't fit the image";
+			return;
+		}
+
+		std::vector<unsigned char> pixels(map->lut.size() * 3);
+		colorout_apply(&options->color, image.pixels, pixels.data(), map->lut.size());
+		ledfile_close(&image);
+
+		size_t size;
+		std::vector<char> text;
+		if (options->target == TARGET_JAVA1D) {
+			text.resize(exporter_array1d_size(map, pixels.data()) + EXPORTER_SLACK);
+			size = exporter_array1d_write(map, pixels.data(), text.data());
+		} else if (options->target == TARGET_JAVA2D) {
+			text.resize(exporter_array2d_size(map, pixels.data()) + EXPORTER_SLACK);
+			size = exporter_array2d_write(map, pixels.data(), text.data());
+		} else {
+			text.resize(exporter_target_size(options->target, options->elementWidth, map) + EXPORTER_SLACK);
+			size = exporter_target_write(options->target, options->elementWidth, map, pixels.data(), text.data());
+		}
+
+		if (!write_file(job->output, text.data(), size)) {
+			job->message = "can't write " + job->output.string();
+			return;
+		}
+	} else {
+		ledfile_close(&image);
+	}
+
+	job->ok = true;
+}
+
+int main(int argc, char** argv) {
+	cli_options_t options;
+	if (!parse_options(argc, argv, &options)) {
+		usage();
+		return 2;
+	}
+
+	std::vector<cli_job_t> jobs;
+	collect_jobs(&options, &jobs);
+
+	threadpool_t* pool = create_threadpool(options.threads);
+	for (cli_job_t& job : jobs)
+		threadpool_submit(pool, [&options, &job]() { run_job(&options, &job); });
+	threadpool_wait(pool);
+	destroy_threadpool(pool);
+
+	for (auto& entry : wiringMaps) {
+		if (entry.second)
+			destroy_wiring_map(entry.second);
+	}
+
+	int failed = 0;
+	for (cli_job_t& job : jobs) {
+		printf("%s %s: %s\n", job.ok ? "ok  " : "FAIL", job.input.string().c_str(), job.message.c_str());
+		failed += !job.ok;
+	}
+	printf("%d file(s), %d failed\n", (int)jobs.size(), failed);
+	return failed ? 1 : 0;
+}
\ No newline at end of file
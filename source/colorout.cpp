@@ -0,0 +1,167 @@
+#include "colorout.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COLOROUT_SSE2
+#endif
+
+// which input channel feeds each output slot, per order
+static const unsigned char orderSources[COLOROUT_ORDER_COUNT][3] = {
+	{0, 1, 2},
+	{0, 2, 1},
+	{1, 0, 2},
+	{1, 2, 0},
+	{2, 0, 1},
+	{2, 1, 0}
+};
+
+// gamma is per input channel (the red curve follows red wherever it ends up);
+// brightness scales after the curve, 0-1
+void colorout_build(colorout_t* transform, int order, const float gamma[3], float brightness) {
+	if (brightness < 0.0f)
+		brightness = 0.0f;
+	if (brightness > 1.0f)
+		brightness = 1.0f;
+
+	transform->order = order;
+	transform->brightness = brightness;
+	transform->identity = order == COLOROUT_RGB && brightness == 1.0f;
+	for (int c = 0; c < 3; c++) {
+		transform->gamma[c] = gamma[c];
+		transform->identity = transform->identity && gamma[c] == 1.0f;
+	}
+
+	for (int slot = 0; slot < 3; slot++) {
+		int source = orderSources[order][slot];
+		transform->source[slot] = source;
+		for (int v = 0; v < 256; v++) {
+			float value = powf(v / 255.0f, gamma[source]) * brightness;
+			transform->lut[slot][v] = (unsigned char)lroundf(value * 255.0f);
+		}
+	}
+
+	// with no gamma every table is the same rounded line. look for a 16 bit
+	// multiplier near the brightness and a bias that land on every entry; the
+	// odd brightness where float rounding at the ties rules that out keeps
+	// the tables
+	transform->linear = false;
+	if (gamma[0] != 1.0f || gamma[1] != 1.0f || gamma[2] != 1.0f)
+		return;
+	int nearest = std::min((int)lroundf(brightness * 65536.0f), 65535);
+	for (int scale = std::max(nearest - 16, 0); scale <= std::min(nearest + 16, 65535) && !transform->linear; scale++) {
+		int lo = 0, hi = 255;
+		for (int v = 0; v < 256; v++) {
+			int floored = (v * scale) >> 8;
+			lo = std::max(lo, transform->lut[0][v] * 256 - floored);
+			hi = std::min(hi, transform->lut[0][v] * 256 + 255 - floored);
+		}
+		if (lo <= hi) {
+			transform->linear = true;
+			transform->scale = scale;
+			transform->bias = lo;
+		}
+	}
+}
+
+void colorout_identity(colorout_t* transform) {
+	const float gamma[3] = {1.0f, 1.0f, 1.0f};
+	colorout_build(transform, COLOROUT_RGB, gamma, 1.0f);
+}
+
+#ifdef COLOROUT_SSE2
+template <int shift>
+static inline __m128i shift_bytes(__m128i v) {
+	return shift > 0 ? _mm_srli_si128(v, shift > 0 ? shift : 0) : _mm_slli_si128(v, shift < 0 ? -shift : 0);
+}
+
+// five pixels per register: each output slot takes its source byte from
+// source - slot bytes along, then the optional brightness scale. byte 15 is
+// the next pixel's first byte and is stored back untouched, so the last load
+// never reads past count and in place runs see their input unchanged
+template <int shift0, int shift1, int shift2>
+static size_t apply_linear(const colorout_t* transform, const unsigned char* src, unsigned char* dst, size_t count) {
+	const __m128i slot0 = _mm_setr_epi8(-1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, 0);
+	const __m128i slot1 = _mm_slli_si128(slot0, 1);
+	const __m128i slot2 = _mm_slli_si128(slot0, 2);
+	const __m128i next = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i scale = _mm_set1_epi16((short)transform->scale);
+	const __m128i bias = _mm_set1_epi16((short)transform->bias);
+	const bool scaled = transform->brightness != 1.0f;
+
+	size_t i = 0;
+	for (; i * 3 + 16 <= count * 3; i += 5) {
+		__m128i in = _mm_loadu_si128((const __m128i*)(src + i * 3));
+		__m128i out = _mm_or_si128(_mm_or_si128(_mm_and_si128(shift_bytes<shift0>(in), slot0), _mm_and_si128(shift_bytes<shift1>(in), slot1)), _mm_and_si128(shift_bytes<shift2>(in), slot2));
+		if (scaled) {
+			__m128i lo = _mm_slli_epi16(_mm_unpacklo_epi8(out, zero), 8);
+			__m128i hi = _mm_slli_epi16(_mm_unpackhi_epi8(out, zero), 8);
+			lo = _mm_srli_epi16(_mm_add_epi16(_mm_mulhi_epu16(lo, scale), bias), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(_mm_mulhi_epu16(hi, scale), bias), 8);
+			out = _mm_packus_epi16(lo, hi);
+		}
+		_mm_storeu_si128((__m128i*)(dst + i * 3), _mm_or_si128(out, _mm_and_si128(in, next)));
+	}
+	return i;
+}
+
+// orderSources as byte shifts, one kernel per order
+static size_t (*const linearKernels[COLOROUT_ORDER_COUNT])(const colorout_t*, const unsigned char*, unsigned char*, size_t) = {
+	apply_linear<0, 0, 0>,
+	apply_linear<0, 1, -1>,
+	apply_linear<1, -1, 0>,
+	apply_linear<1, 1, -2>,
+	apply_linear<2, -1, -1>,
+	apply_linear<2, 0, -2>
+};
+#endif
+
+// linear transforms reorder and scale 16 bytes at a time. gamma tables don't
+// map onto SSE without gathers, so those unroll four pixels per step with the
+// tables and sources hoisted into registers instead; src and dst may be the
+// same buffer
+void colorout_apply(const colorout_t* transform, const unsigned char* src, unsigned char* dst, size_t count) {
+	if (transform->identity) {
+		if (src != dst)
+			memcpy(dst, src, count * 3);
+		return;
+	}
+
+#ifdef COLOROUT_SSE2
+	if (transform->linear) {
+		size_t done = linearKernels[transform->order](transform, src, dst, count);
+		src += done * 3;
+		dst += done * 3;
+		count -= done;
+	}
+#endif
+
+	const unsigned char* lut0 = transform->lut[0];
+	const unsigned char* lut1 = transform->lut[1];
+	const unsigned char* lut2 = transform->lut[2];
+	const int s0 = transform->source[0];
+	const int s1 = transform->source[1];
+	const int s2 = transform->source[2];
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4, src += 12, dst += 12) {
+		unsigned char out[12];
+		for (int p = 0; p < 4; p++) {
+			out[p * 3] = lut0[src[p * 3 + s0]];
+			out[p * 3 + 1] = lut1[src[p * 3 + s1]];
+			out[p * 3 + 2] = lut2[src[p * 3 + s2]];
+		}
+		memcpy(dst, out, 12);
+	}
+	for (; i < count; i++, src += 3, dst += 3) {
+		unsigned char out[3] = {lut0[src[s0]], lut1[src[s1]], lut2[src[s2]]};
+		memcpy(dst, out, 3);
+	}
+}
+
+const char* colorout_order_name(int order) {
+	static const char* names[COLOROUT_ORDER_COUNT] = {"RGB", "RBG", "GRB", "GBR", "BRG", "BGR"};
+	return names[order];
+}
\ No newline at end of file
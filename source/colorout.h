@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+
+enum colorout_order_e {
+	COLOROUT_RGB,
+	COLOROUT_RBG,
+	COLOROUT_GRB,
+	COLOROUT_GBR,
+	COLOROUT_BRG,
+	COLOROUT_BGR,
+	COLOROUT_ORDER_COUNT
+};
+
+/* Output Transform: what pixels go through on their way to the hardware.
+   each output byte is lut[slot][value of its source channel], with gamma and
+   the brightness cap folded into the table. without gamma the tables are the
+   brightness scale alone, and linear is set when
+   (((v * scale) >> 8) + bias) >> 8 gives them exactly */
+typedef struct colorout_s {
+	int order;
+	float gamma[3];
+	float brightness;
+	bool identity;
+	bool linear;
+	unsigned short scale, bias;
+	unsigned char source[3];
+	unsigned char lut[3][256];
+} colorout_t;
+
+void colorout_build(colorout_t* transform, int order, const float gamma[3], float brightness);
+void colorout_identity(colorout_t* transform);
+void colorout_apply(const colorout_t* transform, const unsigned char* src, unsigned char* dst, size_t count);
+const char* colorout_order_name(int order);
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "display.h"
 #include "uiface.h"
 #include "text.h"
+#include "render.h"
 #include <cstdio>
 
 HDC ghDC;
@@ -37,20 +38,18 @@ void display_shutdown() {
 }
 
 void display_update() {
+	render_begin_frame();
+
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	// draw background
-	glBegin(GL_TRIANGLE_FAN);
-	glColor3ub(255, 0, 0);
-	glVertex2i(-1, 1);
-	glColor3ub(127, 0, 255);
-	glVertex2i(-1, -1);
-	glColor3ub(0, 0, 255);
-	glVertex2i(1, -1);
-	glColor3ub(255, 127, 0);
-	glVertex2i(1, 1);
-	glEnd();
+	unsigned char topLeft[4] = {255, 0, 0, 255};
+	unsigned char bottomLeft[4] = {127, 0, 255, 255};
+	unsigned char bottomRight[4] = {0, 0, 255, 255};
+	unsigned char topRight[4] = {255, 127, 0, 255};
+	render_state(GL_TRIANGLES);
+	render_quad_corners(0, 0, displayWidth, displayHeight, topLeft, bottomLeft, bottomRight, topRight);
 
 	// draw UI widgets
 	uiface_draw();
@@ -64,6 +63,7 @@ void display_update() {
 	int textWidth = get_text_width(label);
 	draw_text(label, displayWidth - textWidth - 4, 2);
 
+	render_end_frame();
 	SwapBuffers(ghDC);
 }
 
@@ -71,4 +71,5 @@ void display_resize(int w, int h) {
 	displayWidth = w;
 	displayHeight = h;
 	glViewport(0, 0, displayWidth, displayHeight);
+	render_resize(displayWidth, displayHeight);
 }
\ No newline at end of file
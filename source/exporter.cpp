@@ -0,0 +1,289 @@
+#include "exporter.h"
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+
+/* Decimal Table: each byte value as text with the ", " separator after it,
+   padded to 8 bytes so it can always be copied whole */
+typedef struct exporter_decimal_s {
+	char text[EXPORTER_SLACK];
+	size_t length;
+} exporter_decimal_t;
+
+typedef struct exporter_decimal_table_s {
+	exporter_decimal_t values[256];
+
+	exporter_decimal_table_s() : values() {
+		for (int i = 0; i < 256; i++) {
+			exporter_decimal_t& value = values[i];
+			size_t length = 0;
+			if (i >= 100)
+				value.text[length++] = '0' + i / 100;
+			if (i >= 10)
+				value.text[length++] = '0' + i / 10 % 10;
+			value.text[length++] = '0' + i % 10;
+			value.text[length++] = ',';
+			value.text[length++] = ' ';
+			value.length = length;
+		}
+	}
+} exporter_decimal_table_t;
+
+static const exporter_decimal_table_t decimalTable;
+
+static size_t digits_size(const wiring_map_t* map, const unsigned char* data) {
+	size_t size = 0;
+	size_t count = map->lut.size() * 3;
+	for (size_t i = 0; i < count; i++)
+		size += decimalTable.values[data[i]].length;
+	return size;
+}
+
+// calls func for every pixel in strip order, with its line and position in it
+template <typename Func>
+static void for_each_pixel(const wiring_map_t* map, const unsigned char* data, Func func) {
+	const unsigned int* lut = map->lut.data();
+	size_t count = map->lut.size();
+	int line = 0, pos = 0;
+	for (size_t i = 0; i < count; i++) {
+		func(&data[lut[i] * 3], line, pos);
+		if (++pos == map->lineLength) {
+			pos = 0;
+			line++;
+		}
+	}
+}
+
+static char* write_text(char* out, const char* text) {
+	size_t length = strlen(text);
+	memcpy(out, text, length);
+	return out + length;
+}
+
+static char* write_decimal(char* out, const unsigned char* pixel) {
+	for (int c = 0; c < 3; c++) {
+		const exporter_decimal_t& value = decimalTable.values[pixel[c]];
+		memcpy(out, value.text, EXPORTER_SLACK);
+		out += value.length;
+	}
+	return out;
+}
+
+// the sizes below mirror the writers byte for byte, including the separators
+// they back over at the end of lines and of the array
+size_t exporter_array1d_size(const wiring_map_t* map, const unsigned char* data) {
+	size_t lines = map->lut.size() / map->lineLength;
+	return (sizeof("int image[] = {\n") - 1) + lines * (sizeof("    \n") - 1) + digits_size(map, data) - 3 + (sizeof("\n};") - 1);
+}
+
+size_t exporter_array1d_write(const wiring_map_t* map, const unsigned char* data, char* out) {
+	char* start = out;
+	out = write_text(out, "int image[] = {\n");
+	for_each_pixel(map, data, [&](const unsigned char* pixel, int, int pos) {
+		if (pos == 0)
+			out = write_text(out, "    ");
+		out = write_decimal(out, pixel);
+		if (pos == map->lineLength - 1)
+			*out++ = '\n';
+	});
+
+	out -= 3;
+	out = write_text(out, "\n};");
+	return out - start;
+}
+
+size_t exporter_array2d_size(const wiring_map_t* map, const unsigned char* data) {
+	size_t lines = map->lut.size() / map->lineLength;
+	return (sizeof("int image[][] = {\n") - 1) + lines * ((sizeof("    { ") - 1) - 2 + (sizeof(" },\n") - 1)) + digits_size(map, data) - 2 + (sizeof("\n};") - 1);
+}
+
+size_t exporter_array2d_write(const wiring_map_t* map, const unsigned char* data, char* out) {
+	char* start = out;
+	out = write_text(out, "int image[][] = {\n");
+	for_each_pixel(map, data, [&](const unsigned char* pixel, int, int pos) {
+		if (pos == 0)
+			out = write_text(out, "    { ");
+		out = write_decimal(out, pixel);
+		if (pos == map->lineLength - 1) {
+			out -= 2;
+			out = write_text(out, " },\n");
+		}
+	});
+
+	out -= 2;
+	out = write_text(out, "\n};");
+	return out - start;
+}
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+/* Element Types: how a pixel turns into array elements */
+struct exporter_element8_s {
+	typedef uint8_t type;
+	static constexpr int perPixel = 3;
+	static constexpr const char* cType = "uint8_t";
+	static unsigned int value(const unsigned char* pixel, int i) { return pixel[i]; }
+};
+
+struct exporter_element16_s {
+	typedef uint16_t type;
+	static constexpr int perPixel = 1;
+	static constexpr const char* cType = "uint16_t";
+	static unsigned int value(const unsigned char* pixel, int) { return ((pixel[0] >> 3) << 11) | ((pixel[1] >> 2) << 5) | (pixel[2] >> 3); }
+};
+
+struct exporter_element32_s {
+	typedef uint32_t type;
+	static constexpr int perPixel = 1;
+	static constexpr const char* cType = "uint32_t";
+	static unsigned int value(const unsigned char* pixel, int) { return (pixel[0] << 16) | (pixel[1] << 8) | pixel[2]; }
+};
+
+/* Output Formats: every element has a fixed text size, so sizes are exact
+   without looking at the pixels */
+// one line per run of the strip, each ending in a comma since C allows a trailing one
+template <typename Element>
+struct exporter_c_progmem_s {
+	static constexpr size_t elementSize = (sizeof("0x, ") - 1) + sizeof(typename Element::type) * 2;
+
+	static size_t size(const wiring_map_t* map) {
+		char header[128];
+		size_t count = map->lut.size() * Element::perPixel;
+		size_t lines = map->lut.size() / map->lineLength;
+		return sprintf(header, "const %s image[%zu] PROGMEM = {\n", Element::cType, count) + lines * (sizeof("    ") - 1) + count * elementSize + (sizeof("};") - 1);
+	}
+
+	static size_t write(const wiring_map_t* map, const unsigned char* data, char* out) {
+		char* start = out;
+		size_t count = map->lut.size() * Element::perPixel;
+		out += sprintf(out, "const %s image[%zu] PROGMEM = {\n", Element::cType, count);
+		for_each_pixel(map, data, [&](const unsigned char* pixel, int, int pos) {
+			if (pos == 0)
+				out = write_text(out, "    ");
+			for (int i = 0; i < Element::perPixel; i++) {
+				unsigned int value = Element::value(pixel, i);
+				*out++ = '0';
+				*out++ = 'x';
+				for (int shift = sizeof(typename Element::type) * 8 - 4; shift >= 0; shift -= 4)
+					*out++ = hexDigits[(value >> shift) & 0xF];
+				*out++ = ',';
+				*out++ = ' ';
+			}
+			if (pos == map->lineLength - 1)
+				out[-1] = '\n';
+		});
+		return write_text(out, "};") - start;
+	}
+};
+
+template <typename Element>
+static char* write_bytes_hex(char* out, const unsigned char* pixel) {
+	for (int i = 0; i < Element::perPixel; i++) {
+		unsigned int value = Element::value(pixel, i);
+		for (size_t byte = 0; byte < sizeof(typename Element::type); byte++, value >>= 8) {
+			*out++ = hexDigits[(value >> 4) & 0xF];
+			*out++ = hexDigits[value & 0xF];
+		}
+	}
+	return out;
+}
+
+template <typename Element>
+struct exporter_hex_s {
+	static size_t size(const wiring_map_t* map) {
+		return map->lut.size() * Element::perPixel * sizeof(typename Element::type) * 2;
+	}
+
+	static size_t write(const wiring_map_t* map, const unsigned char* data, char* out) {
+		char* start = out;
+		for_each_pixel(map, data, [&](const unsigned char* pixel, int, int) {
+			out = write_bytes_hex<Element>(out, pixel);
+		});
+		return out - start;
+	}
+};
+
+// bytes.fromhex keeps it to two characters a byte, with a string per run of the strip
+template <typename Element>
+struct exporter_python_s {
+	static size_t size(const wiring_map_t* map) {
+		size_t lines = map->lut.size() / map->lineLength;
+		return (sizeof("image = bytes.fromhex(\n") - 1) + lines * (sizeof("    \"\"\n") - 1) + exporter_hex_s<Element>::size(map) + (sizeof(")") - 1);
+	}
+
+	static size_t write(const wiring_map_t* map, const unsigned char* data, char* out) {
+		char* start = out;
+		out = write_text(out, "image = bytes.fromhex(\n");
+		for_each_pixel(map, data, [&](const unsigned char* pixel, int, int pos) {
+			if (pos == 0)
+				out = write_text(out, "    \"");
+			out = write_bytes_hex<Element>(out, pixel);
+			if (pos == map->lineLength - 1)
+				out = write_text(out, "\"\n");
+		});
+		return write_text(out, ")") - start;
+	}
+};
+
+template <typename Element>
+struct exporter_binary_s {
+	static size_t size(const wiring_map_t* map) {
+		return map->lut.size() * Element::perPixel * sizeof(typename Element::type);
+	}
+
+	static size_t write(const wiring_map_t* map, const unsigned char* data, char* out) {
+		char* start = out;
+		for_each_pixel(map, data, [&](const unsigned char* pixel, int, int) {
+			for (int i = 0; i < Element::perPixel; i++) {
+				unsigned int value = Element::value(pixel, i);
+				for (size_t byte = 0; byte < sizeof(typename Element::type); byte++, value >>= 8)
+					*out++ = (char)(value & 0xFF);
+			}
+		});
+		return out - start;
+	}
+};
+
+/* Emitter: one instantiation per target and element width */
+typedef struct exporter_emitter_s {
+	size_t (*size)(const wiring_map_t* map);
+	size_t (*write)(const wiring_map_t* map, const unsigned char* data, char* out);
+} exporter_emitter_t;
+
+template <template <typename> class Format>
+struct exporter_emitters_s {
+	static constexpr exporter_emitter_t widths[EXPORTER_WIDTH_COUNT] = {
+		{Format<exporter_element8_s>::size, Format<exporter_element8_s>::write},
+		{Format<exporter_element16_s>::size, Format<exporter_element16_s>::write},
+		{Format<exporter_element32_s>::size, Format<exporter_element32_s>::write}
+	};
+};
+
+static const exporter_emitter_t* emitters[EXPORTER_TARGET_COUNT] = {
+	exporter_emitters_s<exporter_c_progmem_s>::widths,
+	exporter_emitters_s<exporter_hex_s>::widths,
+	exporter_emitters_s<exporter_python_s>::widths,
+	exporter_emitters_s<exporter_binary_s>::widths
+};
+
+size_t exporter_target_size(int target, int elementWidth, const wiring_map_t* map) {
+	return emitters[target][elementWidth].size(map);
+}
+
+size_t exporter_target_write(int target, int elementWidth, const wiring_map_t* map, const unsigned char* data, char* out) {
+	return emitters[target][elementWidth].write(map, data, out);
+}
+
+bool exporter_target_is_binary(int target) {
+	return target == EXPORTER_TARGET_BINARY;
+}
+
+const char* exporter_target_name(int target) {
+	static const char* names[EXPORTER_TARGET_COUNT] = {"C PROGMEM", "Hex String", "Python", "Binary"};
+	return names[target];
+}
+
+const char* exporter_width_name(int elementWidth) {
+	static const char* names[EXPORTER_WIDTH_COUNT] = {"8-bit", "RGB565", "32-bit"};
+	return names[elementWidth];
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+#include "wiring.h"
+#include <cstddef>
+
+// every exporter walks the pixels in strip order through a wiring map, with
+// one line of text per straight run of the strip
+
+// writers may store up to this many bytes past the end of the text, so
+// output buffers need this much room on top of the reported size
+#define EXPORTER_SLACK 8
+
+size_t exporter_array1d_size(const wiring_map_t* map, const unsigned char* data);
+size_t exporter_array1d_write(const wiring_map_t* map, const unsigned char* data, char* out);
+size_t exporter_array2d_size(const wiring_map_t* map, const unsigned char* data);
+size_t exporter_array2d_write(const wiring_map_t* map, const unsigned char* data, char* out);
+
+enum exporter_target_e {
+	EXPORTER_TARGET_C_PROGMEM,
+	EXPORTER_TARGET_HEX,
+	EXPORTER_TARGET_PYTHON,
+	EXPORTER_TARGET_BINARY,
+	EXPORTER_TARGET_COUNT
+};
+
+// 8 bits is one element per channel; 16 packs pixels as RGB565 and 32 as
+// 0x00RRGGBB. multi-byte elements are stored little endian in byte streams
+enum exporter_width_e {
+	EXPORTER_WIDTH_8,
+	EXPORTER_WIDTH_16,
+	EXPORTER_WIDTH_32,
+	EXPORTER_WIDTH_COUNT
+};
+
+size_t exporter_target_size(int target, int elementWidth, const wiring_map_t* map);
+size_t exporter_target_write(int target, int elementWidth, const wiring_map_t* map, const unsigned char* data, char* out);
+bool exporter_target_is_binary(int target);
+const char* exporter_target_name(int target);
+const char* exporter_width_name(int elementWidth);
\ No newline at end of file
@@ -0,0 +1,858 @@
+#include "imagefile.h"
+#include "mapfile.h"
+#include "ledfile.h"
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGEFILE_SSE2
+#endif
+
+static uint32_t read_be32(const unsigned char* data) {
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static uint32_t read_le32(const unsigned char* data) {
+	return data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint16_t read_le16(const unsigned char* data) {
+	return data[0] | (data[1] << 8);
+}
+
+static bool valid_dimensions(int64_t width, int64_t height) {
+	return width > 0 && height > 0 && width <= IMAGEFILE_MAX_DIMENSION && height <= IMAGEFILE_MAX_DIMENSION;
+}
+
+// inflate (RFC 1951). codes up to 9 bits resolve in one table lookup; longer
+// ones walk the canonical code a bit at a time
+#define INFLATE_FAST_BITS 9
+
+/* Huffman Table */
+typedef struct inflate_huffman_s {
+	uint16_t fast[1 << INFLATE_FAST_BITS];
+	uint16_t count[16];
+	uint16_t symbol[288];
+} inflate_huffman_t;
+
+/* Bit Reader: LSB first, refilled a byte at a time */
+typedef struct inflate_bits_s {
+	const unsigned char* data;
+	size_t size;
+	size_t pos;
+	uint32_t buffer;
+	int count;
+	bool error;
+} inflate_bits_t;
+
+static void bits_refill(inflate_bits_t* bits) {
+	while (bits->count <= 24 && bits->pos < bits->size) {
+		bits->buffer |= (uint32_t)bits->data[bits->pos++] << bits->count;
+		bits->count += 8;
+	}
+}
+
+static uint32_t bits_take(inflate_bits_t* bits, int count) {
+	if (!count)
+		return 0;
+	bits_refill(bits);
+	if (bits->count < count) {
+		bits->error = true;
+		return 0;
+	}
+	uint32_t value = bits->buffer & ((1u << count) - 1);
+	bits->buffer >>= count;
+	bits->count -= count;
+	return value;
+}
+
+static bool huffman_build(inflate_huffman_t* huffman, const unsigned char* lengths, int count) {
+	memset(huffman->count, 0, sizeof(huffman->count));
+	memset(huffman->fast, 0, sizeof(huffman->fast));
+	for (int i = 0; i < count; i++)
+		huffman->count[lengths[i]]++;
+	huffman->count[0] = 0;
+
+	// an over-subscribed set of lengths can't be a prefix code
+	int left = 1;
+	for (int len = 1; len < 16; len++) {
+		left = (left << 1) - huffman->count[len];
+		if (left < 0)
+			return false;
+	}
+
+	uint16_t offsets[16];
+	uint16_t codes[16];
+	offsets[1] = 0;
+	codes[1] = 0;
+	for (int len = 1; len < 15; len++) {
+		offsets[len + 1] = offsets[len] + huffman->count[len];
+		codes[len + 1] = (codes[len] + huffman->count[len]) << 1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		int len = lengths[i];
+		if (!len)
+			continue;
+		huffman->symbol[offsets[len]++] = i;
+
+		int code = codes[len]++;
+		if (len > INFLATE_FAST_BITS)
+			continue;
+		int reversed = 0;
+		for (int b = 0; b < len; b++)
+			reversed |= ((code >> b) & 1) << (len - 1 - b);
+		for (int slot = reversed; slot < (1 << INFLATE_FAST_BITS); slot += 1 << len)
+			huffman->fast[slot] = (i << 4) | len;
+	}
+	return true;
+}
+
+static int huffman_decode(inflate_bits_t* bits, const inflate_huffman_t* huffman) {
+	bits_refill(bits);
+	uint16_t entry = huffman->fast[bits->buffer & ((1 << INFLATE_FAST_BITS) - 1)];
+	int len = entry & 15;
+	if (len && len <= bits->count) {
+		bits->buffer >>= len;
+		bits->count -= len;
+		return entry >> 4;
+	}
+
+	int code = 0, first = 0, index = 0;
+	for (len = 1; len < 16 && len <= bits->count; len++) {
+		code |= (bits->buffer >> (len - 1)) & 1;
+		int count = huffman->count[len];
+		if (code - first < count) {
+			bits->buffer >>= len;
+			bits->count -= len;
+			return huffman->symbol[index + code - first];
+		}
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	bits->error = true;
+	return -1;
+}
+
+static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static bool inflate_codes(inflate_bits_t* bits, const inflate_huffman_t* lit, const inflate_huffman_t* dist, std::vector<unsigned char>& out, size_t limit) {
+	while (1) {
+		int symbol = huffman_decode(bits, lit);
+		if (symbol < 0)
+			return false;
+		if (symbol < 256) {
+			if (out.size() >= limit)
+				return false;
+			out.push_back(symbol);
+			continue;
+		}
+		if (symbol == 256)
+			return true;
+
+		symbol -= 257;
+		if (symbol >= 29)
+			return false;
+		size_t length = lengthBase[symbol] + bits_take(bits, lengthExtra[symbol]);
+		int distSymbol = huffman_decode(bits, dist);
+		if (distSymbol < 0 || distSymbol >= 30)
+			return false;
+		size_t distance = distBase[distSymbol] + bits_take(bits, distExtra[distSymbol]);
+		if (bits->error || distance > out.size() || out.size() + length > limit)
+			return false;
+
+		// copies can overlap their own output, so this goes a byte at a time
+		size_t from = out.size() - distance;
+		for (size_t i = 0; i < length; i++)
+			out.push_back(out[from + i]);
+	}
+}
+
+static bool inflate_dynamic(inflate_bits_t* bits, inflate_huffman_t* lit, inflate_huffman_t* dist) {
+	static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+	int litCount = bits_take(bits, 5) + 257;
+	int distCount = bits_take(bits, 5) + 1;
+	int codeCount = bits_take(bits, 4) + 4;
+	if (bits->error || litCount > 286 || distCount > 30)
+		return false;
+
+	unsigned char lengths[320] = {0};
+	for (int i = 0; i < codeCount; i++)
+		lengths[order[i]] = bits_take(bits, 3);
+	inflate_huffman_t codeLengths;
+	if (!huffman_build(&codeLengths, lengths, 19))
+		return false;
+
+	int index = 0;
+	while (index < litCount + distCount) {
+		int symbol = huffman_decode(bits, &codeLengths);
+		if (symbol < 0)
+			return false;
+		if (symbol < 16) {
+			lengths[index++] = symbol;
+			continue;
+		}
+
+		int len = 0, repeat;
+		if (symbol == 16) {
+			if (!index)
+				return false;
+			len = lengths[index - 1];
+			repeat = 3 + bits_take(bits, 2);
+		} else if (symbol == 17) {
+			repeat = 3 + bits_take(bits, 3);
+		} else {
+			repeat = 11 + bits_take(bits, 7);
+		}
+		if (bits->error || index + repeat > litCount + distCount)
+			return false;
+		while (repeat--)
+			lengths[index++] = len;
+	}
+
+	if (!lengths[256])
+		return false;
+	return huffman_build(lit, lengths, litCount) && huffman_build(dist, lengths + litCount, distCount);
+}
+
+// zlib stream (RFC 1950) into out, which may not grow past limit
+static bool zlib_inflate(const unsigned char* data, size_t size, std::vector<unsigned char>& out, size_t limit) {
+	if (size < 6 || (data[0] & 15) != 8 || ((data[0] << 8) | data[1]) % 31 || (data[1] & 32))
+		return false;
+
+	inflate_bits_t bits = {data + 2, size - 6, 0, 0, 0, false};
+	inflate_huffman_t lit, dist;
+	int last;
+	do {
+		last = bits_take(&bits, 1);
+		int type = bits_take(&bits, 2);
+		if (type == 0) {
+			// stored: whatever is left of the current byte gets skipped
+			bits_take(&bits, bits.count & 7);
+			size_t length = bits_take(&bits, 16);
+			size_t inverse = bits_take(&bits, 16);
+			if (bits.error || length != (~inverse & 0xffff) || out.size() + length > limit)
+				return false;
+			for (size_t i = 0; i < length && !bits.error; i++)
+				out.push_back(bits_take(&bits, 8));
+		} else if (type == 1) {
+			unsigned char lengths[320];
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 112);
+			memset(lengths + 256, 7, 24);
+			memset(lengths + 280, 8, 8);
+			memset(lengths + 288, 5, 30);
+			huffman_build(&lit, lengths, 288);
+			huffman_build(&dist, lengths + 288, 30);
+			if (!inflate_codes(&bits, &lit, &dist, out, limit))
+				return false;
+		} else if (type == 2) {
+			if (!inflate_dynamic(&bits, &lit, &dist) || !inflate_codes(&bits, &lit, &dist, out, limit))
+				return false;
+		} else {
+			return false;
+		}
+		if (bits.error)
+			return false;
+	} while (!last);
+
+	return ledfile_checksum(out.data(), out.size()) == read_be32(data + size - 4);
+}
+
+static unsigned char paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+// undoes the per-row filters of one (sub)image in place
+static bool png_unfilter(unsigned char* data, int rows, size_t stride, int pixelBytes) {
+	unsigned char* prior = nullptr;
+	for (int y = 0; y < rows; y++) {
+		unsigned char filter = data[0];
+		unsigned char* row = data + 1;
+		for (size_t i = 0; i < stride; i++) {
+			int a = i >= (size_t)pixelBytes ? row[i - pixelBytes] : 0;
+			int b = prior ? prior[i] : 0;
+			int c = prior && i >= (size_t)pixelBytes ? prior[i - pixelBytes] : 0;
+			switch (filter) {
+				case 0:
+					break;
+				case 1:
+					row[i] += a;
+					break;
+				case 2:
+					row[i] += b;
+					break;
+				case 3:
+					row[i] += (a + b) >> 1;
+					break;
+				case 4:
+					row[i] += paeth(a, b, c);
+					break;
+				default:
+					return false;
+			}
+		}
+		prior = row;
+		data += stride + 1;
+	}
+	return true;
+}
+
+/* PNG Header and the bits of PLTE/tRNS that matter for RGB output */
+typedef struct png_info_s {
+	int width, height;
+	int depth, colorType;
+	int channels;
+	bool interlaced;
+	int paletteSize;
+	unsigned char palette[256][4];
+	bool hasKey;
+	uint16_t key[3];
+} png_info_t;
+
+static uint16_t png_sample(const unsigned char* row, size_t index, int depth) {
+	if (depth == 8)
+		return row[index];
+	if (depth == 16)
+		return (row[index * 2] << 8) | row[index * 2 + 1];
+	size_t bit = index * depth;
+	return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1 << depth) - 1);
+}
+
+static unsigned char png_scale(uint16_t value, int depth) {
+	if (depth == 16)
+		return value >> 8;
+	return value * 255 / ((1 << depth) - 1);
+}
+
+static bool png_store_row(const png_info_t* info, const unsigned char* row, int count, unsigned char* out, int outStep) {
+	for (int x = 0; x < count; x++, out += outStep) {
+		uint16_t s[4];
+		for (int c = 0; c < info->channels; c++)
+			s[c] = png_sample(row, (size_t)x * info->channels + c, info->depth);
+
+		unsigned char r, g, b, a = 255;
+		switch (info->colorType) {
+			case 0:
+			case 4:
+				r = g = b = png_scale(s[0], info->depth);
+				if (info->colorType == 4)
+					a = png_scale(s[1], info->depth);
+				else if (info->hasKey && s[0] == info->key[0])
+					a = 0;
+				break;
+			case 3:
+				if (s[0] >= info->paletteSize)
+					return false;
+				r = info->palette[s[0]][0];
+				g = info->palette[s[0]][1];
+				b = info->palette[s[0]][2];
+				a = info->palette[s[0]][3];
+				break;
+			default:
+				r = png_scale(s[0], info->depth);
+				g = png_scale(s[1], info->depth);
+				b = png_scale(s[2], info->depth);
+				if (info->colorType == 6)
+					a = png_scale(s[3], info->depth);
+				else if (info->hasKey && s[0] == info->key[0] && s[1] == info->key[1] && s[2] == info->key[2])
+					a = 0;
+				break;
+		}
+
+		// LEDs can't be see-through, so transparency means off
+		out[0] = (r * a + 127) / 255;
+		out[1] = (g * a + 127) / 255;
+		out[2] = (b * a + 127) / 255;
+	}
+	return true;
+}
+
+static int png_decode(const unsigned char* data, size_t size, imagefile_image_t* image) {
+	png_info_t info;
+	memset(&info, 0, sizeof(info));
+	std::vector<unsigned char> compressed;
+	bool header = false;
+
+	size_t pos = 8;
+	while (1) {
+		if (size - pos < 12)
+			return IMAGEFILE_ERROR_CORRUPT;
+		uint32_t length = read_be32(data + pos);
+		const unsigned char* type = data + pos + 4;
+		const unsigned char* chunk = data + pos + 8;
+		if (length > size - pos - 12)
+			return IMAGEFILE_ERROR_CORRUPT;
+		pos += 12 + (size_t)length;
+
+		if (!memcmp(type, "IHDR", 4)) {
+			if (length < 13)
+				return IMAGEFILE_ERROR_CORRUPT;
+			uint32_t width = read_be32(chunk), height = read_be32(chunk + 4);
+			if (!valid_dimensions(width, height))
+				return IMAGEFILE_ERROR_DIMENSIONS;
+			info.width = width;
+			info.height = height;
+			info.depth = chunk[8];
+			info.colorType = chunk[9];
+			info.interlaced = chunk[12] == 1;
+			if (chunk[10] || chunk[11] || chunk[12] > 1)
+				return IMAGEFILE_ERROR_UNSUPPORTED;
+
+			static const int channels[7] = {1, 0, 3, 1, 2, 0, 4};
+			if (info.colorType > 6 || !channels[info.colorType])
+				return IMAGEFILE_ERROR_CORRUPT;
+			info.channels = channels[info.colorType];
+			bool lowDepth = info.depth == 1 || info.depth == 2 || info.depth == 4;
+			bool validDepth = info.depth == 8 || (info.depth == 16 && info.colorType != 3) ||
+			(lowDepth && (info.colorType == 0 || info.colorType == 3));
+			if (!validDepth)
+				return IMAGEFILE_ERROR_CORRUPT;
+			header = true;
+		} else if (!header) {
+			return IMAGEFILE_ERROR_CORRUPT;
+		} else if (!memcmp(type, "PLTE", 4)) {
+			info.paletteSize = std::min<int>(length / 3, 256);
+			for (int i = 0; i < info.paletteSize; i++) {
+				memcpy(info.palette[i], chunk + i * 3, 3);
+				info.palette[i][3] = 255;
+			}
+		} else if (!memcmp(type, "tRNS", 4)) {
+			if (info.colorType == 3) {
+				for (uint32_t i = 0; i < length && i < 256; i++)
+					info.palette[i][3] = chunk[i];
+			} else if (length >= (uint32_t)info.channels * 2) {
+				info.hasKey = true;
+				for (int c = 0; c < info.channels && c < 3; c++)
+					info.key[c] = (chunk[c * 2] << 8) | chunk[c * 2 + 1];
+			}
+		} else if (!memcmp(type, "IDAT", 4)) {
+			compressed.insert(compressed.end(), chunk, chunk + length);
+		} else if (!memcmp(type, "IEND", 4)) {
+			break;
+		}
+	}
+	if (!header || (info.colorType == 3 && !info.paletteSize))
+		return IMAGEFILE_ERROR_CORRUPT;
+
+	// interlaced images are seven subimages back to back, each filtered on its own
+	static const int passX[7] = {0, 4, 0, 2, 0, 1, 0}, passY[7] = {0, 0, 4, 0, 2, 0, 1};
+	static const int stepX[7] = {8, 8, 4, 4, 2, 2, 1}, stepY[7] = {8, 8, 8, 4, 4, 2, 2};
+	int passes = info.interlaced ? 7 : 1;
+	int bitsPerPixel = info.depth * info.channels;
+	size_t rawSize = 0;
+	for (int p = 0; p < passes; p++) {
+		int x0 = info.interlaced ? passX[p] : 0, dx = info.interlaced ? stepX[p] : 1;
+		int y0 = info.interlaced ? passY[p] : 0, dy = info.interlaced ? stepY[p] : 1;
+		size_t w = (info.width - x0 + dx - 1) / dx, h = (info.height - y0 + dy - 1) / dy;
+		if (w && h)
+			rawSize += h * (1 + (w * bitsPerPixel + 7) / 8);
+	}
+
+	std::vector<unsigned char> raw;
+	raw.reserve(rawSize);
+	if (!zlib_inflate(compressed.data(), compressed.size(), raw, rawSize) || raw.size() != rawSize)
+		return IMAGEFILE_ERROR_CORRUPT;
+
+	image->width = info.width;
+	image->height = info.height;
+	image->pixels.assign((size_t)info.width * info.height * 3, 0);
+	unsigned char* cursor = raw.data();
+	for (int p = 0; p < passes; p++) {
+		int x0 = info.interlaced ? passX[p] : 0, dx = info.interlaced ? stepX[p] : 1;
+		int y0 = info.interlaced ? passY[p] : 0, dy = info.interlaced ? stepY[p] : 1;
+		int w = (info.width - x0 + dx - 1) / dx, h = (info.height - y0 + dy - 1) / dy;
+		if (!w || !h)
+			continue;
+
+		size_t stride = ((size_t)w * bitsPerPixel + 7) / 8;
+		if (!png_unfilter(cursor, h, stride, std::max(1, bitsPerPixel / 8)))
+			return IMAGEFILE_ERROR_CORRUPT;
+		for (int y = 0; y < h; y++) {
+			unsigned char* out = &image->pixels[((size_t)(y0 + y * dy) * info.width + x0) * 3];
+			if (!png_store_row(&info, cursor + 1, w, out, dx * 3))
+				return IMAGEFILE_ERROR_CORRUPT;
+			cursor += stride + 1;
+		}
+	}
+	return IMAGEFILE_OK;
+}
+
+// a bitfield channel, widened to 8 bits
+static unsigned char bmp_channel(uint32_t value, uint32_t mask) {
+	if (!mask)
+		return 0;
+	int shift = 0;
+	while (!((mask >> shift) & 1))
+		shift++;
+	uint64_t max = mask >> shift;
+	return (unsigned char)((((value & mask) >> shift) * 255 + max / 2) / max);
+}
+
+static int bmp_decode(const unsigned char* data, size_t size, imagefile_image_t* image) {
+	if (size < 26)
+		return IMAGEFILE_ERROR_CORRUPT;
+	uint32_t offset = read_le32(data + 10);
+	uint32_t headerSize = read_le32(data + 14);
+	if (headerSize < 12 || headerSize > size - 14)
+		return IMAGEFILE_ERROR_CORRUPT;
+
+	int64_t width, height;
+	int bpp;
+	uint32_t compression = 0, colorsUsed = 0;
+	int paletteEntry = 4;
+	if (headerSize == 12) {
+		// OS/2 core header
+		width = read_le16(data + 18);
+		height = (int16_t)read_le16(data + 20);
+		bpp = read_le16(data + 24);
+		paletteEntry = 3;
+	} else {
+		if (headerSize < 40)
+			return IMAGEFILE_ERROR_CORRUPT;
+		width = (int32_t)read_le32(data + 18);
+		height = (int32_t)read_le32(data + 22);
+		bpp = read_le16(data + 28);
+		compression = read_le32(data + 30);
+		colorsUsed = read_le32(data + 46);
+	}
+
+	// rows are stored bottom up unless the height is negative
+	bool topDown = height < 0;
+	height = topDown ? -height : height;
+	if (!valid_dimensions(width, height))
+		return IMAGEFILE_ERROR_DIMENSIONS;
+
+	uint32_t masks[3] = {0x00ff0000, 0x0000ff00, 0x000000ff};
+	if (bpp == 16) {
+		masks[0] = 0x7c00;
+		masks[1] = 0x03e0;
+		masks[2] = 0x001f;
+	}
+	if (compression == 3 || compression == 6) {
+		// masks follow a plain info header, or sit inside the longer ones
+		if (size < 14 + 40 + 12)
+			return IMAGEFILE_ERROR_CORRUPT;
+		for (int c = 0; c < 3; c++)
+			masks[c] = read_le32(data + 54 + c * 4);
+	} else if (compression != 0) {
+		return IMAGEFILE_ERROR_UNSUPPORTED;
+	}
+	if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 16 && bpp != 24 && bpp != 32)
+		return IMAGEFILE_ERROR_UNSUPPORTED;
+
+	unsigned char palette[256][3];
+	int paletteSize = 0;
+	if (bpp <= 8) {
+		paletteSize = colorsUsed && colorsUsed <= (1u << bpp) ? colorsUsed : 1 << bpp;
+		size_t paletteStart = 14 + (size_t)headerSize + (compression == 3 && headerSize == 40 ? 12 : 0);
+		if (paletteStart + (size_t)paletteSize * paletteEntry > size)
+			return IMAGEFILE_ERROR_CORRUPT;
+		for (int i = 0; i < paletteSize; i++) {
+			const unsigned char* entry = data + paletteStart + i * paletteEntry;
+			palette[i][0] = entry[2];
+			palette[i][1] = entry[1];
+			palette[i][2] = entry[0];
+		}
+	}
+
+	size_t stride = (((size_t)width * bpp + 31) / 32) * 4;
+	if (offset > size || stride * height > size - offset)
+		return IMAGEFILE_ERROR_CORRUPT;
+
+	image->width = (int)width;
+	image->height = (int)height;
+	image->pixels.resize((size_t)width * height * 3);
+	for (int y = 0; y < height; y++) {
+		const unsigned char* row = data + offset + stride * (topDown ? y : height - 1 - y);
+		unsigned char* out = &image->pixels[(size_t)y * width * 3];
+		for (int x = 0; x < width; x++, out += 3) {
+			if (bpp <= 8) {
+				int index = png_sample(row, x, bpp);
+				if (index >= paletteSize)
+					return IMAGEFILE_ERROR_CORRUPT;
+				memcpy(out, palette[index], 3);
+			} else if (bpp == 24) {
+				out[0] = row[x * 3 + 2];
+				out[1] = row[x * 3 + 1];
+				out[2] = row[x * 3];
+			} else {
+				uint32_t value = bpp == 16 ? read_le16(row + x * 2) : read_le32(row + x * 4);
+				for (int c = 0; c < 3; c++)
+					out[c] = bmp_channel(value, masks[c]);
+			}
+		}
+	}
+	return IMAGEFILE_OK;
+}
+
+/* PNM Cursor: header fields and ASCII rasters are whitespace separated, with
+   # comments running to the end of the line */
+typedef struct pnm_cursor_s {
+	const unsigned char* data;
+	size_t size;
+	size_t pos;
+} pnm_cursor_t;
+
+static void pnm_skip(pnm_cursor_t* cursor) {
+	while (cursor->pos < cursor->size) {
+		unsigned char c = cursor->data[cursor->pos];
+		if (c == '#') {
+			while (cursor->pos < cursor->size && cursor->data[cursor->pos] != '\n')
+				cursor->pos++;
+		} else if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f') {
+			cursor->pos++;
+		} else {
+			break;
+		}
+	}
+}
+
+// plain bitmaps (P1) may run their digits together, hence the digit limit
+static bool pnm_number(pnm_cursor_t* cursor, int64_t* value, int maxDigits = 10) {
+	pnm_skip(cursor);
+	int digits = 0;
+	*value = 0;
+	while (cursor->pos < cursor->size && digits < maxDigits && cursor->data[cursor->pos] >= '0' && cursor->data[cursor->pos] <= '9') {
+		*value = *value * 10 + (cursor->data[cursor->pos++] - '0');
+		digits++;
+	}
+	return digits > 0;
+}
+
+static int pnm_decode(const unsigned char* data, size_t size, imagefile_image_t* image) {
+	int kind = data[1] - '0';
+	bool bitmap = kind == 1 || kind == 4;
+	bool gray = kind == 2 || kind == 5;
+	bool binary = kind >= 4;
+
+	pnm_cursor_t cursor = {data, size, 2};
+	int64_t width, height, maxValue = 1;
+	if (!pnm_number(&cursor, &width) || !pnm_number(&cursor, &height))
+		return IMAGEFILE_ERROR_CORRUPT;
+	if (!bitmap && (!pnm_number(&cursor, &maxValue) || maxValue < 1 || maxValue > 65535))
+		return IMAGEFILE_ERROR_CORRUPT;
+	if (!valid_dimensions(width, height))
+		return IMAGEFILE_ERROR_DIMENSIONS;
+
+	int channels = bitmap || gray ? 1 : 3;
+	size_t count = (size_t)width * height;
+	size_t sampleBytes = maxValue > 255 ? 2 : 1;
+	size_t stride = bitmap ? ((size_t)width + 7) / 8 : (size_t)width * channels * sampleBytes;
+
+	// the raster has to be there before the image is allocated, so a header
+	// alone can't claim a huge one. one whitespace byte separates the header
+	// from a binary raster; plain samples are at least a digit each
+	size_t rasterPos = binary ? cursor.pos + 1 : cursor.pos;
+	size_t rasterSize = binary ? stride * height : count * channels;
+	if (rasterPos > size || rasterSize > size - rasterPos)
+		return IMAGEFILE_ERROR_CORRUPT;
+
+	image->width = (int)width;
+	image->height = (int)height;
+	image->pixels.resize(count * 3);
+
+	if (binary) {
+		const unsigned char* raster = data + rasterPos;
+		for (size_t i = 0; i < count; i++) {
+			unsigned char* out = &image->pixels[i * 3];
+			if (bitmap) {
+				const unsigned char* row = raster + (i / width) * stride;
+				memset(out, png_sample(row, i % width, 1) ? 0 : 255, 3);
+				continue;
+			}
+			for (int c = 0; c < 3; c++) {
+				size_t sample = (i * channels + (channels == 3 ? c : 0)) * sampleBytes;
+				uint32_t value = sampleBytes == 2 ? (raster[sample] << 8) | raster[sample + 1] : raster[sample];
+				out[c] = (unsigned char)(std::min<uint32_t>(value, maxValue) * 255 / maxValue);
+			}
+		}
+		return IMAGEFILE_OK;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		unsigned char* out = &image->pixels[i * 3];
+		int64_t values[3];
+		for (int c = 0; c < channels; c++) {
+			if (!pnm_number(&cursor, &values[c], bitmap ? 1 : 10))
+				return IMAGEFILE_ERROR_CORRUPT;
+		}
+		if (bitmap) {
+			memset(out, values[0] ? 0 : 255, 3);
+			continue;
+		}
+		for (int c = 0; c < 3; c++)
+			out[c] = (unsigned char)(std::min(values[channels == 3 ? c : 0], maxValue) * 255 / maxValue);
+	}
+	return IMAGEFILE_OK;
+}
+
+// the format comes from the signature, whatever the file is called
+int imagefile_decode(const unsigned char* data, size_t size, imagefile_image_t* image) {
+	static const unsigned char pngSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	image->width = 0;
+	image->height = 0;
+	image->pixels.clear();
+
+	int error = IMAGEFILE_ERROR_FORMAT;
+	if (size >= 8 && !memcmp(data, pngSignature, 8))
+		error = png_decode(data, size, image);
+	else if (size >= 2 && data[0] == 'B' && data[1] == 'M')
+		error = bmp_decode(data, size, image);
+	else if (size >= 3 && data[0] == 'P' && data[1] >= '1' && data[1] <= '6')
+		error = pnm_decode(data, size, image);
+
+	if (error != IMAGEFILE_OK) {
+		image->width = 0;
+		image->height = 0;
+		image->pixels.clear();
+	}
+	return error;
+}
+
+int imagefile_load(const char* filename, imagefile_image_t* image) {
+	mapped_file_t* mapped = map_file(filename);
+	if (!mapped)
+		return IMAGEFILE_ERROR_OPEN;
+
+	int error = imagefile_decode(mapped->data, mapped->size, image);
+	unmap_file(mapped);
+	return error;
+}
+
+const char* imagefile_error_string(int error) {
+	switch (error) {
+		case IMAGEFILE_OK:
+			return "No error.";
+		case IMAGEFILE_ERROR_OPEN:
+			return "Couldn't open that image.";
+		case IMAGEFILE_ERROR_FORMAT:
+			return "That isn't a PNG, BMP or PPM image.";
+		case IMAGEFILE_ERROR_UNSUPPORTED:
+			return "That image uses a feature that can't be imported.";
+		case IMAGEFILE_ERROR_DIMENSIONS:
+			return "That image is too large to import.";
+		default:
+			return "That image is damaged.";
+	}
+}
+
+/* Area Weights: how much of each source pixel falls under one output pixel,
+   as fractions of the output pixel */
+typedef struct resample_weights_s {
+	std::vector<int> first;
+	std::vector<int> count;
+	std::vector<int> offset;
+	std::vector<float> weights;
+} resample_weights_t;
+
+// in units of 1/(srcSize*dstSize), output i covers [i*src, (i+1)*src) and
+// source j covers [j*dst, (j+1)*dst); the overlaps are the weights
+static void area_weights(int srcSize, int dstSize, resample_weights_t* weights) {
+	weights->first.resize(dstSize);
+	weights->count.resize(dstSize);
+	weights->offset.resize(dstSize);
+	weights->weights.clear();
+	for (int i = 0; i < dstSize; i++) {
+		int64_t start = (int64_t)i * srcSize, end = start + srcSize;
+		int first = (int)(start / dstSize), last = (int)((end - 1) / dstSize);
+		weights->first[i] = first;
+		weights->count[i] = last - first + 1;
+		weights->offset[i] = (int)weights->weights.size();
+		for (int j = first; j <= last; j++) {
+			int64_t overlap = std::min(end, (int64_t)(j + 1) * dstSize) - std::max(start, (int64_t)j * dstSize);
+			weights->weights.push_back((float)overlap / srcSize);
+		}
+	}
+}
+
+// sum += weight * row, over a whole row of bytes
+static void accumulate_row(float* sum, const unsigned char* row, size_t count, float weight) {
+	size_t i = 0;
+#ifdef IMAGEFILE_SSE2
+	__m128 w = _mm_set1_ps(weight);
+	__m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= count; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(row + i));
+		__m128i lo = _mm_unpacklo_epi8(bytes, zero);
+		__m128i hi = _mm_unpackhi_epi8(bytes, zero);
+		__m128 a = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+		__m128 b = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+		__m128 c = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+		__m128 d = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+		_mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i), _mm_mul_ps(a, w)));
+		_mm_storeu_ps(sum + i + 4, _mm_add_ps(_mm_loadu_ps(sum + i + 4), _mm_mul_ps(b, w)));
+		_mm_storeu_ps(sum + i + 8, _mm_add_ps(_mm_loadu_ps(sum + i + 8), _mm_mul_ps(c, w)));
+		_mm_storeu_ps(sum + i + 12, _mm_add_ps(_mm_loadu_ps(sum + i + 12), _mm_mul_ps(d, w)));
+	}
+#endif
+	for (; i < count; i++)
+		sum[i] += weight * row[i];
+}
+
+// each output row first sums its source rows at full width, which streams
+// through every source byte once, then collapses that one row horizontally
+static void resample_band(const unsigned char* src, int srcWidth, unsigned char* dst, int dstWidth, const resample_weights_t* columns, const resample_weights_t* rows, int y1, int y2) {
+	size_t srcStride = (size_t)srcWidth * 3;
+	std::vector<float> sum(srcStride);
+	for (int y = y1; y < y2; y++) {
+		std::fill(sum.begin(), sum.end(), 0.0f);
+		for (int k = 0; k < rows->count[y]; k++)
+			accumulate_row(sum.data(), src + (size_t)(rows->first[y] + k) * srcStride, srcStride, rows->weights[rows->offset[y] + k]);
+
+		unsigned char* out = dst + (size_t)y * dstWidth * 3;
+		for (int x = 0; x < dstWidth; x++, out += 3) {
+			float r = 0.0f, g = 0.0f, b = 0.0f;
+			const float* column = &sum[(size_t)columns->first[x] * 3];
+			const float* weights = &columns->weights[columns->offset[x]];
+			for (int k = 0; k < columns->count[x]; k++, column += 3) {
+				r += weights[k] * column[0];
+				g += weights[k] * column[1];
+				b += weights[k] * column[2];
+			}
+			out[0] = (unsigned char)std::min(r + 0.5f, 255.0f);
+			out[1] = (unsigned char)std::min(g + 0.5f, 255.0f);
+			out[2] = (unsigned char)std::min(b + 0.5f, 255.0f);
+		}
+	}
+}
+
+// box filter over exact pixel coverage, split into bands of output rows
+void imagefile_resample(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight, int threadCount) {
+	resample_weights_t columns, rows;
+	area_weights(srcWidth, dstWidth, &columns);
+	area_weights(srcHeight, dstHeight, &rows);
+
+	// a band is only worth a thread if it streams through a fair bit of source
+	if (threadCount <= 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	int64_t work = (int64_t)srcWidth * srcHeight * 3;
+	threadCount = (int)std::min<int64_t>(threadCount, std::max<int64_t>(1, work / (256 * 1024)));
+	threadCount = std::min(threadCount, dstHeight);
+
+	if (threadCount <= 1) {
+		resample_band(src, srcWidth, dst, dstWidth, &columns, &rows, 0, dstHeight);
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; t++) {
+		int y1 = (int)((int64_t)dstHeight * t / threadCount);
+		int y2 = (int)((int64_t)dstHeight * (t + 1) / threadCount);
+		threads.emplace_back(resample_band, src, srcWidth, dst, dstWidth, &columns, &rows, y1, y2);
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+}
\ No newline at end of file
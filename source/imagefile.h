@@ -0,0 +1,26 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+#define IMAGEFILE_MAX_DIMENSION 16384
+
+enum imagefile_error_e {
+	IMAGEFILE_OK,
+	IMAGEFILE_ERROR_OPEN,
+	IMAGEFILE_ERROR_FORMAT,
+	IMAGEFILE_ERROR_UNSUPPORTED,
+	IMAGEFILE_ERROR_DIMENSIONS,
+	IMAGEFILE_ERROR_CORRUPT
+};
+
+/* Decoded Image: packed RGB, anything transparent already blended onto black */
+typedef struct imagefile_image_s {
+	int width, height;
+	std::vector<unsigned char> pixels;
+} imagefile_image_t;
+
+int imagefile_load(const char* filename, imagefile_image_t* image);
+int imagefile_decode(const unsigned char* data, size_t size, imagefile_image_t* image);
+const char* imagefile_error_string(int error);
+
+void imagefile_resample(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight, int threadCount = 0);
\ No newline at end of file
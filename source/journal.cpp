@@ -0,0 +1,356 @@
+#include "journal.h"
+#include "ledfile.h"
+#include "mapfile.h"
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// a journal is "LEDJ", a version, then records of a 4 character type, a 32 bit
+// payload size, the adler-32 of the payload, then the payload
+//   SNAP: int width, int height, RLE packed RGB
+//   DLTA: span count, spans, then the new RGB of every span back to back
+// the first record is always a snapshot. a crash can leave a torn record at
+// the end; replay stops at the first one that doesn't check out
+#define JOURNAL_RECORD_SNAPSHOT "SNAP"
+#define JOURNAL_RECORD_DELTA "DLTA"
+
+/* Journal Record: deltas arrive ready to append. a snapshot starts a fresh
+   file and arrives as a plain copy of the image, packed by the writer so the
+   editor never waits on the encoder */
+typedef struct journal_record_s {
+	bool snapshot;
+	int width, height;
+	std::vector<unsigned char> pixels;
+	std::vector<unsigned char> data;
+} journal_record_t;
+
+struct journal_s {
+	std::string filename;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable flushed;
+	std::deque<journal_record_t> records;
+	bool writing;
+	bool quit;
+
+	// set by the writer when the file couldn't be started or appended to; the
+	// editor answers with a fresh snapshot instead of its next delta
+	std::atomic<bool> failed;
+
+	// only touched on the editor thread
+	int deltas;
+	size_t deltaBytes;
+};
+
+static void put_bytes(std::vector<unsigned char>& out, const void* data, size_t size) {
+	out.insert(out.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+}
+
+static void put_u32(std::vector<unsigned char>& out, uint32_t value) {
+	put_bytes(out, &value, sizeof(value));
+}
+
+// fills in the size and checksum once the payload is in place
+static void begin_record(std::vector<unsigned char>& out, const char* type) {
+	put_bytes(out, type, 4);
+	put_u32(out, 0);
+	put_u32(out, 0);
+}
+
+static void end_record(std::vector<unsigned char>& out) {
+	uint32_t size = (uint32_t)(out.size() - 12);
+	uint32_t checksum = ledfile_checksum(out.data() + 12, size);
+	memcpy(out.data() + 4, &size, sizeof(size));
+	memcpy(out.data() + 8, &checksum, sizeof(checksum));
+}
+
+static bool sync_file(FILE* file) {
+	if (fflush(file))
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+// the snapshot goes to a temporary file that replaces the journal once it's on
+// disk, so there is always one complete journal to fall back on
+static FILE* start_file(journal_t* journal, const journal_record_t& record) {
+	std::string tempPath = journal->filename + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (!file)
+		return nullptr;
+
+	uint32_t version = JOURNAL_VERSION;
+	bool ok = fwrite("LEDJ", 1, 4, file) == 4 &&
+	fwrite(&version, sizeof(version), 1, file) == 1 &&
+	fwrite(record.data.data(), 1, record.data.size(), file) == record.data.size();
+	ok = sync_file(file) && ok;
+	fclose(file);
+
+	std::error_code error;
+	if (ok)
+		std::filesystem::rename(tempPath, journal->filename, error);
+	if (!ok || error) {
+		std::filesystem::remove(tempPath, error);
+		return nullptr;
+	}
+	return fopen(journal->filename.c_str(), "ab");
+}
+
+static void encode_snapshot(journal_record_t& record) {
+	begin_record(record.data, JOURNAL_RECORD_SNAPSHOT);
+	put_bytes(record.data, &record.width, sizeof(int));
+	put_bytes(record.data, &record.height, sizeof(int));
+	ledfile_rle_encode(record.pixels.data(), (size_t)record.width * record.height, record.data);
+	end_record(record.data);
+	std::vector<unsigned char>().swap(record.pixels);
+}
+
+// writes whatever is queued as soon as it arrives but only syncs once per
+// interval, so a burst of strokes costs one fsync
+static void writer_thread(journal_t* journal) {
+	typedef std::chrono::steady_clock clock;
+	FILE* file = nullptr;
+	bool unsynced = false;
+	clock::time_point lastSync = clock::now();
+	std::chrono::duration<double> interval(JOURNAL_SYNC_INTERVAL);
+
+	std::unique_lock<std::mutex> lock(journal->mutex);
+	while (1) {
+		if (journal->records.empty()) {
+			if (journal->quit)
+				break;
+			if (unsynced)
+				journal->wake.wait_until(lock, lastSync + std::chrono::duration_cast<clock::duration>(interval));
+			else
+				journal->wake.wait(lock);
+		}
+
+		std::deque<journal_record_t> records;
+		records.swap(journal->records);
+		journal->writing = true;
+		lock.unlock();
+
+		for (journal_record_t& record : records) {
+			if (record.snapshot) {
+				if (file)
+					fclose(file);
+				encode_snapshot(record);
+				file = start_file(journal, record);
+				journal->failed = !file;
+				unsynced = false;
+				lastSync = clock::now();
+			} else if (file) {
+				// a short write leaves a torn record that replay stops at, so
+				// nothing after it can be appended until a snapshot starts over
+				if (fwrite(record.data.data(), 1, record.data.size(), file) != record.data.size()) {
+					fclose(file);
+					file = nullptr;
+					journal->failed = true;
+				}
+				unsynced = true;
+			}
+		}
+
+		// the process dying only loses what's still in the stdio buffer, so
+		// that goes out every batch; only the disk sync waits for the interval
+		if (file && unsynced) {
+			if (clock::now() - lastSync >= interval) {
+				sync_file(file);
+				unsynced = false;
+				lastSync = clock::now();
+			} else {
+				fflush(file);
+			}
+		}
+
+		lock.lock();
+		journal->writing = false;
+		journal->flushed.notify_all();
+	}
+
+	if (file) {
+		sync_file(file);
+		fclose(file);
+	}
+}
+
+journal_t* create_journal(const char* filename) {
+	journal_t* journal = new journal_t();
+	journal->filename = filename;
+	journal->writing = false;
+	journal->quit = false;
+	journal->failed = false;
+	journal->deltas = 0;
+	journal->deltaBytes = 0;
+	journal->thread = std::thread(writer_thread, journal);
+	return journal;
+}
+
+void destroy_journal(journal_t* journal) {
+	{
+		std::lock_guard<std::mutex> lock(journal->mutex);
+		journal->quit = true;
+	}
+	journal->wake.notify_one();
+	journal->thread.join();
+	delete journal;
+}
+
+static void queue_record(journal_t* journal, journal_record_t&& record) {
+	{
+		std::lock_guard<std::mutex> lock(journal->mutex);
+		journal->records.push_back(std::move(record));
+	}
+	journal->wake.notify_one();
+}
+
+void journal_snapshot(journal_t* journal, bitmap_t* bitmap) {
+	journal_record_t record;
+	record.snapshot = true;
+	record.width = bitmap->w;
+	record.height = bitmap->h;
+	record.pixels.assign(bitmap->image, bitmap->image + (size_t)bitmap->w * bitmap->h * 3);
+
+	journal->deltas = 0;
+	journal->deltaBytes = 0;
+	queue_record(journal, std::move(record));
+}
+
+// the undo block holds what the pixels were; replay needs what they became,
+// so those are read back from the image while the spans are still current
+void journal_delta(journal_t* journal, bitmap_t* bitmap, const std::vector<bitmap_span_t>& spans) {
+	if (spans.empty())
+		return;
+
+	// once the deltas outweigh the image, a snapshot replays faster than they
+	// do. after a failed write the deltas have nothing to apply to, so the
+	// snapshot doubles as the retry
+	size_t imageSize = (size_t)bitmap->w * bitmap->h * 3;
+	if (journal->deltas >= JOURNAL_SNAPSHOT_DELTAS || journal->deltaBytes >= imageSize || journal->failed.exchange(false)) {
+		journal_snapshot(journal, bitmap);
+		return;
+	}
+
+	journal_record_t record;
+	record.snapshot = false;
+	begin_record(record.data, JOURNAL_RECORD_DELTA);
+	put_u32(record.data, (uint32_t)spans.size());
+	put_bytes(record.data, spans.data(), spans.size() * sizeof(bitmap_span_t));
+	for (const bitmap_span_t& span : spans)
+		put_bytes(record.data, &bitmap->image[((size_t)span.y * bitmap->w + span.x) * 3], span.len * 3);
+	end_record(record.data);
+
+	journal->deltas++;
+	journal->deltaBytes += record.data.size();
+	queue_record(journal, std::move(record));
+}
+
+// blocks until everything queued so far has been handed to the file
+void journal_flush(journal_t* journal) {
+	std::unique_lock<std::mutex> lock(journal->mutex);
+	journal->flushed.wait(lock, [journal]() { return journal->records.empty() && !journal->writing; });
+}
+
+static bool apply_delta(const unsigned char* data, size_t size, int width, int height, unsigned char* image) {
+	uint32_t count;
+	if (size < sizeof(count))
+		return false;
+	memcpy(&count, data, sizeof(count));
+	data += sizeof(count);
+	size -= sizeof(count);
+	if ((uint64_t)count * sizeof(bitmap_span_t) > size)
+		return false;
+
+	const unsigned char* spans = data;
+	const unsigned char* pixels = data + (size_t)count * sizeof(bitmap_span_t);
+	size_t pixelsLeft = size - (size_t)count * sizeof(bitmap_span_t);
+	for (uint32_t i = 0; i < count; i++) {
+		bitmap_span_t span;
+		memcpy(&span, spans + (size_t)i * sizeof(span), sizeof(span));
+		if (span.x < 0 || span.y < 0 || span.len < 0 || span.y >= height || (int64_t)span.x + span.len > width)
+			return false;
+		if ((size_t)span.len * 3 > pixelsLeft)
+			return false;
+
+		memcpy(&image[((size_t)span.y * width + span.x) * 3], pixels, (size_t)span.len * 3);
+		pixels += (size_t)span.len * 3;
+		pixelsLeft -= (size_t)span.len * 3;
+	}
+	return true;
+}
+
+bool journal_replay(const char* filename, int* width, int* height, std::vector<unsigned char>* image) {
+	mapped_file_t* mapped = map_file(filename);
+	if (!mapped)
+		return false;
+
+	const unsigned char* data = mapped->data;
+	size_t size = mapped->size;
+	uint32_t version;
+	if (size < 8 || memcmp(data, "LEDJ", 4)) {
+		unmap_file(mapped);
+		return false;
+	}
+	memcpy(&version, data + 4, sizeof(version));
+	if (version != JOURNAL_VERSION) {
+		unmap_file(mapped);
+		return false;
+	}
+
+	bool restored = false;
+	size_t pos = 8;
+	while (size - pos >= 12) {
+		uint32_t recordSize, checksum;
+		memcpy(&recordSize, data + pos + 4, sizeof(recordSize));
+		memcpy(&checksum, data + pos + 8, sizeof(checksum));
+		if (recordSize > size - pos - 12)
+			break;
+
+		const unsigned char* payload = data + pos + 12;
+		if (ledfile_checksum(payload, recordSize) != checksum)
+			break;
+
+		if (!memcmp(data + pos, JOURNAL_RECORD_SNAPSHOT, 4)) {
+			int w, h;
+			if (recordSize < 8)
+				break;
+			memcpy(&w, payload, sizeof(int));
+			memcpy(&h, payload + 4, sizeof(int));
+			if (!ledfile_valid_dimensions(w, h))
+				break;
+
+			std::vector<unsigned char> pixels((size_t)w * h * 3);
+			if (!ledfile_rle_decode(payload + 8, recordSize - 8, pixels.data(), (size_t)w * h))
+				break;
+			*width = w;
+			*height = h;
+			image->swap(pixels);
+			restored = true;
+		} else if (!memcmp(data + pos, JOURNAL_RECORD_DELTA, 4)) {
+			if (!restored || !apply_delta(payload, recordSize, *width, *height, image->data()))
+				break;
+		}
+
+		pos += 12 + (size_t)recordSize;
+	}
+
+	unmap_file(mapped);
+	return restored;
+}
\ No newline at end of file
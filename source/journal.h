@@ -0,0 +1,21 @@
+#pragma once
+#include "bitmap.h"
+#include <vector>
+#include <cstddef>
+
+#define JOURNAL_VERSION 1
+#define JOURNAL_SYNC_INTERVAL 1.0
+#define JOURNAL_SNAPSHOT_DELTAS 256
+
+/* Autosave Journal: committed edits are appended by a background writer; every
+   snapshot starts the file over, so a replay only ever reads one snapshot and
+   the deltas after it */
+typedef struct journal_s journal_t;
+
+journal_t* create_journal(const char* filename);
+void destroy_journal(journal_t* journal);
+void journal_snapshot(journal_t* journal, bitmap_t* bitmap);
+void journal_delta(journal_t* journal, bitmap_t* bitmap, const std::vector<bitmap_span_t>& spans);
+void journal_flush(journal_t* journal);
+
+bool journal_replay(const char* filename, int* width, int* height, std::vector<unsigned char>* image);
\ No newline at end of file
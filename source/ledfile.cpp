@@ -0,0 +1,307 @@
+#include "ledfile.h"
+#include <fstream>
+#include <cstring>
+#include <climits>
+
+// v2 files are a sequence of chunks after the version: a 4 character type, a
+// 32 bit payload size, then the payload. unknown chunks get skipped
+//   HEAD: int width, int height
+//   PIXR: checksum, raw RGB
+//   PIXC: checksum, RLE packed RGB
+//   END : no payload
+// the checksum is adler-32 over the unpacked RGB
+#define LEDFILE_CHUNK_HEAD "HEAD"
+#define LEDFILE_CHUNK_RAW "PIXR"
+#define LEDFILE_CHUNK_RLE "PIXC"
+#define LEDFILE_CHUNK_END "END "
+
+uint32_t ledfile_checksum(const unsigned char* data, size_t size) {
+	uint32_t a = 1, b = 0;
+	while (size) {
+		// the most bytes that can be summed before b could overflow
+		size_t block = size < 5552 ? size : 5552;
+		size -= block;
+		while (block--) {
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+static bool same_pixel(const unsigned char* a, const unsigned char* b) {
+	return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+// packbits over whole pixels: a control byte with the high bit set repeats the
+// next pixel (low bits + 1) times, otherwise (control + 1) literal pixels follow
+void ledfile_rle_encode(const unsigned char* pixels, size_t count, std::vector<unsigned char>& out) {
+	size_t i = 0;
+	while (i < count) {
+		size_t run = 1;
+		while (i + run < count && run < 128 && same_pixel(&pixels[(i + run) * 3], &pixels[i * 3]))
+			run++;
+
+		if (run > 1) {
+			out.push_back(0x80 | (run - 1));
+			out.insert(out.end(), &pixels[i * 3], &pixels[i * 3 + 3]);
+			i += run;
+			continue;
+		}
+
+		// literals stop where the next run starts
+		size_t start = i;
+		while (i < count && i - start < 128) {
+			if (i + 1 < count && same_pixel(&pixels[i * 3], &pixels[(i + 1) * 3]))
+				break;
+			i++;
+		}
+		out.push_back(i - start - 1);
+		out.insert(out.end(), &pixels[start * 3], &pixels[i * 3]);
+	}
+}
+
+// false if the stream is truncated or doesn't unpack to exactly count pixels
+bool ledfile_rle_decode(const unsigned char* src, size_t size, unsigned char* pixels, size_t count) {
+	const unsigned char* end = src + size;
+	size_t i = 0;
+	while (src < end) {
+		unsigned char control = *src++;
+		size_t length = (control & 0x7F) + 1;
+		if (length > count - i)
+			return false;
+
+		if (control & 0x80) {
+			if (end - src < 3)
+				return false;
+			for (size_t j = 0; j < length; j++, i++)
+				memcpy(&pixels[i * 3], src, 3);
+			src += 3;
+		} else {
+			if ((size_t)(end - src) < length * 3)
+				return false;
+			memcpy(&pixels[i * 3], src, length * 3);
+			src += length * 3;
+			i += length;
+		}
+	}
+	return i == count;
+}
+
+// computes the payload size in 64 bits so a crafted header can't wrap it. the
+// editor indexes canvases with int, so the whole payload has to fit one too
+static bool valid_dimensions(int width, int height, uint64_t* size) {
+	if (width <= 0 || height <= 0 || width > LEDFILE_MAX_DIMENSION || height > LEDFILE_MAX_DIMENSION)
+		return false;
+	*size = (uint64_t)width * (uint64_t)height * 3;
+	return *size <= INT_MAX && *size <= SIZE_MAX;
+}
+
+bool ledfile_valid_dimensions(int width, int height) {
+	uint64_t size;
+	return valid_dimensions(width, height, &size);
+}
+
+/* Read Cursor: bounds-checked reads out of the mapping */
+typedef struct ledfile_cursor_s {
+	const unsigned char* data;
+	size_t size;
+	size_t pos;
+} ledfile_cursor_t;
+
+static const unsigned char* cursor_take(ledfile_cursor_t* cursor, uint64_t size) {
+	if (size > cursor->size - cursor->pos)
+		return nullptr;
+	const unsigned char* data = cursor->data + cursor->pos;
+	cursor->pos += size;
+	return data;
+}
+
+static bool cursor_int(ledfile_cursor_t* cursor, int* value) {
+	const unsigned char* data = cursor_take(cursor, sizeof(int));
+	if (!data)
+		return false;
+	memcpy(value, data, sizeof(int));
+	return true;
+}
+
+static int read_chunks(ledfile_cursor_t* cursor, ledfile_image_t* image) {
+	bool hasHeader = false;
+	uint64_t size = 0;
+
+	while (1) {
+		const unsigned char* type = cursor_take(cursor, 4);
+		uint32_t length;
+		const unsigned char* lengthData = cursor_take(cursor, sizeof(uint32_t));
+		if (!type || !lengthData)
+			return LEDFILE_ERROR_CORRUPT;
+		memcpy(&length, lengthData, sizeof(uint32_t));
+
+		const unsigned char* payload = cursor_take(cursor, length);
+		if (!payload)
+			return LEDFILE_ERROR_CORRUPT;
+
+		if (!memcmp(type, LEDFILE_CHUNK_END, 4))
+			break;
+
+		bool raw = !memcmp(type, LEDFILE_CHUNK_RAW, 4);
+		if (!memcmp(type, LEDFILE_CHUNK_HEAD, 4)) {
+			// a second header would resize the image under pixels already read
+			if (hasHeader || length != sizeof(int) * 2)
+				return LEDFILE_ERROR_CORRUPT;
+			memcpy(&image->width, payload, sizeof(int));
+			memcpy(&image->height, payload + sizeof(int), sizeof(int));
+			if (!valid_dimensions(image->width, image->height, &size))
+				return LEDFILE_ERROR_DIMENSIONS;
+			hasHeader = true;
+		} else if (raw || !memcmp(type, LEDFILE_CHUNK_RLE, 4)) {
+			if (!hasHeader || image->pixels || length < sizeof(uint32_t))
+				return LEDFILE_ERROR_CORRUPT;
+
+			uint32_t checksum;
+			memcpy(&checksum, payload, sizeof(uint32_t));
+			const unsigned char* packed = payload + sizeof(uint32_t);
+			size_t packedSize = length - sizeof(uint32_t);
+
+			if (raw) {
+				if (packedSize != size)
+					return LEDFILE_ERROR_CORRUPT;
+				image->pixels = packed;
+			} else {
+				// every packet unpacks to at most 128 pixels, so a stream this
+				// short can't be hiding a huge image
+				if (size / 3 > (uint64_t)packedSize * 128)
+					return LEDFILE_ERROR_CORRUPT;
+				image->unpacked.resize(size);
+				if (!ledfile_rle_decode(packed, packedSize, image->unpacked.data(), size / 3))
+					return LEDFILE_ERROR_CORRUPT;
+				image->pixels = image->unpacked.data();
+			}
+
+			if (ledfile_checksum(image->pixels, size) != checksum)
+				return LEDFILE_ERROR_CORRUPT;
+		}
+	}
+
+	return image->pixels ? LEDFILE_OK : LEDFILE_ERROR_CORRUPT;
+}
+
+// maps the file and parses it in place; no dialogs, so this is safe to call
+// from batch tools and worker threads. the image stays valid until ledfile_close
+int ledfile_open(const char* filename, ledfile_image_t* image) {
+	image->width = image->height = 0;
+	image->version = 0;
+	image->pixels = nullptr;
+	image->unpacked.clear();
+	image->mapped = map_file(filename);
+	if (!image->mapped)
+		return LEDFILE_ERROR_OPEN;
+
+	ledfile_cursor_t cursor = {image->mapped->data, image->mapped->size, 0};
+	const unsigned char* tag = cursor_take(&cursor, 4);
+	if (!tag || memcmp(tag, "led ", 4)) {
+		ledfile_close(image);
+		return LEDFILE_ERROR_FORMAT;
+	}
+
+	// v0 files go straight from the tag to the dimensions
+	const unsigned char* versionTag = cursor_take(&cursor, 4);
+	if (versionTag && !memcmp(versionTag, "ver ", 4)) {
+		if (!cursor_int(&cursor, &image->version)) {
+			ledfile_close(image);
+			return LEDFILE_ERROR_CORRUPT;
+		}
+	} else {
+		cursor.pos = 4;
+	}
+
+	int error = LEDFILE_OK;
+	if (image->version > LEDFILE_VERSION || image->version < 0) {
+		error = LEDFILE_ERROR_VERSION;
+	} else if (image->version >= 2) {
+		error = read_chunks(&cursor, image);
+	} else {
+		uint64_t size;
+		if (!cursor_int(&cursor, &image->width) || !cursor_int(&cursor, &image->height))
+			error = LEDFILE_ERROR_CORRUPT;
+		else if (!valid_dimensions(image->width, image->height, &size))
+			error = LEDFILE_ERROR_DIMENSIONS;
+		else if (!(image->pixels = cursor_take(&cursor, size)))
+			error = LEDFILE_ERROR_CORRUPT;
+	}
+
+	if (error != LEDFILE_OK)
+		ledfile_close(image);
+	return error;
+}
+
+void ledfile_close(ledfile_image_t* image) {
+	if (image->mapped)
+		unmap_file(image->mapped);
+	image->mapped = nullptr;
+	image->pixels = nullptr;
+	std::vector<unsigned char>().swap(image->unpacked);
+}
+
+static void write_chunk(std::ofstream& file, const char* type, const void* data, uint32_t size) {
+	file.write(type, 4);
+	file.write((char*)&size, sizeof(uint32_t));
+	file.write((char*)data, size);
+}
+
+int ledfile_save(const char* filename, int width, int height, const unsigned char* data) {
+	uint64_t size;
+	if (!valid_dimensions(width, height, &size))
+		return LEDFILE_ERROR_DIMENSIONS;
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open())
+		return LEDFILE_ERROR_OPEN;
+
+	int version = LEDFILE_VERSION;
+	file.write("led ", 4);
+	file.write("ver ", 4);
+	file.write((char*)&version, sizeof(int));
+
+	int dimensions[2] = {width, height};
+	write_chunk(file, LEDFILE_CHUNK_HEAD, dimensions, sizeof(dimensions));
+
+	// LED art is mostly flat color, but noisy images are stored raw rather
+	// than let packing grow them
+	std::vector<unsigned char> payload(sizeof(uint32_t));
+	uint32_t checksum = ledfile_checksum(data, size);
+	memcpy(payload.data(), &checksum, sizeof(uint32_t));
+	ledfile_rle_encode(data, (size_t)width * height, payload);
+	if (payload.size() - sizeof(uint32_t) < size) {
+		write_chunk(file, LEDFILE_CHUNK_RLE, payload.data(), payload.size());
+	} else {
+		payload.resize(sizeof(uint32_t));
+		payload.insert(payload.end(), data, data + size);
+		write_chunk(file, LEDFILE_CHUNK_RAW, payload.data(), payload.size());
+	}
+
+	write_chunk(file, LEDFILE_CHUNK_END, nullptr, 0);
+	file.close();
+	return file.fail() ? LEDFILE_ERROR_WRITE : LEDFILE_OK;
+}
+
+const char* ledfile_error_string(int error) {
+	switch (error) {
+		case LEDFILE_OK:
+			return "No error.";
+		case LEDFILE_ERROR_OPEN:
+			return "Can't open that file.";
+		case LEDFILE_ERROR_WRITE:
+			return "An error occured while writing to that file.";
+		case LEDFILE_ERROR_FORMAT:
+			return "That is not a valid LEDitor image file.";
+		case LEDFILE_ERROR_VERSION:
+			return "That file was saved by a newer version of LEDitor.";
+		case LEDFILE_ERROR_DIMENSIONS:
+			return "That image's dimensions are invalid or too large.";
+		default:
+			return "An error occured while reading from that file.";
+	}
+}
\ No newline at end of file
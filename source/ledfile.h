@@ -0,0 +1,38 @@
+#pragma once
+#include "mapfile.h"
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#define LEDFILE_VERSION 2
+#define LEDFILE_MAX_DIMENSION 65536
+
+enum ledfile_error_e {
+	LEDFILE_OK,
+	LEDFILE_ERROR_OPEN,
+	LEDFILE_ERROR_WRITE,
+	LEDFILE_ERROR_FORMAT,
+	LEDFILE_ERROR_VERSION,
+	LEDFILE_ERROR_DIMENSIONS,
+	LEDFILE_ERROR_CORRUPT
+};
+
+/* Loaded Image: pixels point into the mapping when the payload is stored raw,
+   otherwise at an unpacked copy owned by the image */
+typedef struct ledfile_image_s {
+	int width, height;
+	int version;
+	const unsigned char* pixels;
+	std::vector<unsigned char> unpacked;
+	mapped_file_t* mapped;
+} ledfile_image_t;
+
+int ledfile_open(const char* filename, ledfile_image_t* image);
+void ledfile_close(ledfile_image_t* image);
+int ledfile_save(const char* filename, int width, int height, const unsigned char* data);
+const char* ledfile_error_string(int error);
+bool ledfile_valid_dimensions(int width, int height);
+
+uint32_t ledfile_checksum(const unsigned char* data, size_t size);
+void ledfile_rle_encode(const unsigned char* pixels, size_t count, std::vector<unsigned char>& out);
+bool ledfile_rle_decode(const unsigned char* src, size_t size, unsigned char* pixels, size_t count);
\ No newline at end of file
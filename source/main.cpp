@@ -3,6 +3,10 @@
 #include "text.h"
 #include "uiface.h"
 #include "serialize.h"
+#include "scheduler.h"
+#include "exporter.h"
+#include "colorout.h"
+#include "journal.h"
 
 bool running = true;
 int majorVersion = 0;
@@ -10,16 +14,34 @@ int minorVersion = 2;
 int patchVersion = 0;
 int mainWidth = 800;
 int mainHeight = 600;
+const char* autosavePath = "autosave.journal";
 
 HINSTANCE ghInstance = nullptr;
 HWND ghWnd = nullptr;
+scheduler_t* gScheduler = nullptr;
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
 	ghInstance = hInstance;
+	gScheduler = create_scheduler(60);
+
+	// startup phase timings go to the debugger output
+	double startupTime = scheduler_time();
+	double phaseTime = startupTime;
+	auto startupPhase = [&](const char* phase) {
+		double now = scheduler_time();
+		char message[128];
+		sprintf(message, "startup: %s %.2f ms (%.2f ms total)\n", phase, (now - phaseTime) * 1000.0, (now - startupTime) * 1000.0);
+		OutputDebugStringA(message);
+		phaseTime = now;
+	};
 
 	winapi_initialize();
+	scheduler_set_wake_func(gScheduler, winapi_wake);
+	startupPhase("window");
 	display_initialize();
+	startupPhase("display");
 	text_initialize();
+	startupPhase("text");
 	uiface_initialize();
 
 	display_resize(mainWidth, mainHeight);
@@ -54,10 +76,16 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	UIButton* lineButton = new UIButton("Line", 16, i, standardWidth, standardHeight, 127, 0, 192);
 	i += standardVSpacing;
 
+	int halfWidth = (standardWidth - paddingSm) / 2;
+	UIButton* rectButton = new UIButton("Rect", 16, i, halfWidth, standardHeight, 95, 0, 192);
+	UIButton* ellipseButton = new UIButton("Ellipse", 16 + halfWidth + paddingSm, i, halfWidth, standardHeight, 63, 0, 192);
+	i += standardVSpacing;
+
 	UIButton* eraserButton = new UIButton("Erase", 16, i, standardWidth, standardHeight, 192, 63, 127);
 	i += standardVSpacing;
 
-	UIButton* fillButton = new UIButton("Fill", 16, i, standardWidth, standardHeight, 255, 0, 0);
+	UIButton* fillButton = new UIButton("Fill", 16, i, halfWidth, standardHeight, 255, 0, 0);
+	UIButton* replaceButton = new UIButton("Replace", 16 + halfWidth + paddingSm, i, halfWidth, standardHeight, 255, 0, 63);
 	i += standardVSpacing;
 
 	UISlider* toleranceSlider = new UISlider(16, i, sliderWidth, sliderHeight);
@@ -85,6 +113,14 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	int editorButtonWidth = (editorWidth - padding) / 2;
 	UIEditBitmap* imageEdit = new UIEditBitmap(padding + standardHSpacing, padding, editorWidth, editorHeight, 16, 16);
 
+	// picks up wherever the last session stopped, crashed or not
+	int restoredWidth, restoredHeight;
+	std::vector<unsigned char> restoredImage;
+	if (journal_replay(autosavePath, &restoredWidth, &restoredHeight, &restoredImage))
+		imageEdit->reload(restoredWidth, restoredHeight, restoredImage.data());
+	journal_t* autosave = create_journal(autosavePath);
+	imageEdit->setJournal(autosave);
+
 	UIButton* saveButton = new UIButton("Save",
 	padding + standardHSpacing, editorHeight + padding * 2,
 	editorButtonWidth, standardHeight,
@@ -105,14 +141,74 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	editorButtonWidth, standardHeight,
 	127, 0, 0);
 
+	UIButton* exportTargetButton = new UIButton("Target: C PROGMEM",
+	padding + standardHSpacing, editorHeight + padding * 2 + 80,
+	editorButtonWidth, standardHeight,
+	127, 0, 0);
+
+	UIButton* exportWidthButton = new UIButton("Width: 8-bit",
+	padding + standardHSpacing + editorButtonWidth + 16, editorHeight + padding * 2 + 80,
+	editorButtonWidth, standardHeight,
+	127, 0, 0);
+
+	UIButton* wiringButton = new UIButton("Wiring: Row Snake",
+	padding + standardHSpacing, editorHeight + padding * 2 + 120,
+	editorButtonWidth, standardHeight,
+	127, 0, 0);
+
+	UIButton* exportButton = new UIButton("Export To Target",
+	padding + standardHSpacing + editorButtonWidth + 16, editorHeight + padding * 2 + 120,
+	editorButtonWidth, standardHeight,
+	127, 0, 0);
+
 	UIButton* gridButton = new UIButton("Grid: Off",
 	padding * 2 + standardHSpacing + editorWidth, padding,
 	128, standardHeight,
 	127, 0, 0);
 
-	auto editorToolsFunc = [toolLabel, imageEdit, clearButton, pencilButton, lineButton, eraserButton, fillButton, eyedropperButton, gridButton] (UIButton* button) {
+	UIButton* colorOrderButton = new UIButton("Order: RGB",
+	padding * 2 + standardHSpacing + editorWidth, padding + 40,
+	128, standardHeight,
+	127, 0, 0);
+
+	UIButton* gammaButton = new UIButton("Gamma: 1.0",
+	padding * 2 + standardHSpacing + editorWidth, padding + 80,
+	128, standardHeight,
+	127, 0, 0);
+
+	UIButton* brightnessButton = new UIButton("Bright: 100%",
+	padding * 2 + standardHSpacing + editorWidth, padding + 120,
+	128, standardHeight,
+	127, 0, 0);
+
+	UIButton* importButton = new UIButton("Import",
+	padding * 2 + standardHSpacing + editorWidth, padding + 160,
+	128, standardHeight,
+	127, 0, 0);
+
+	UIButton* brushButton = new UIButton("Brush: Round",
+	padding * 2 + standardHSpacing + editorWidth, padding + 200,
+	128, standardHeight,
+	127, 0, 0);
+
+	UIButton* brushSizeButton = new UIButton("Size: 1",
+	padding * 2 + standardHSpacing + editorWidth, padding + 240,
+	128, standardHeight,
+	127, 0, 0);
+
+	UIButton* shapeFillButton = new UIButton("Shapes: Outline",
+	padding * 2 + standardHSpacing + editorWidth, padding + 280,
+	128, standardHeight,
+	127, 0, 0);
+
+	UILabel* historyLabel = new UILabel("",
+	padding * 2 + standardHSpacing + editorWidth, padding + 320,
+	128, standardHeight,
+	0, 0, 0);
+
+	auto editorToolsFunc = [toolLabel, imageEdit, clearButton, pencilButton, lineButton, rectButton, ellipseButton, eraserButton, fillButton, replaceButton, eyedropperButton, gridButton] (UIButton* button) {
 		if (button == clearButton) {
-			if (MessageBoxA(NULL, "Are you sure? This action cannot be undone.", "Riddle me this...", MB_YESNO | MB_ICONASTERISK) == IDYES)
+			if (MessageBoxA(NULL, "Are you sure you want to clear the image?", "Riddle me this...", MB_YESNO | MB_ICONASTERISK) == IDYES)
 				imageEdit->clear();
 		} else if (button == pencilButton) {
 			imageEdit->setDrawOperation(OPERATION_PENCIL);
@@ -120,12 +216,21 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 		} else if (button == lineButton) {
 			imageEdit->setDrawOperation(OPERATION_LINE);
 			toolLabel->setText("-> Line <-");
+		} else if (button == rectButton) {
+			imageEdit->setDrawOperation(OPERATION_RECT);
+			toolLabel->setText("-> Rectangle <-");
+		} else if (button == ellipseButton) {
+			imageEdit->setDrawOperation(OPERATION_ELLIPSE);
+			toolLabel->setText("-> Ellipse <-");
 		} else if (button == eraserButton) {
 			imageEdit->setDrawOperation(OPERATION_ERASER);
 			toolLabel->setText("-> Eraser <-");
 		} else if (button == fillButton) {
 			imageEdit->setDrawOperation(OPERATION_FILLBUCKET);
 			toolLabel->setText("-> Fill Bucket <-");
+		} else if (button == replaceButton) {
+			imageEdit->setDrawOperation(OPERATION_REPLACECOLOR);
+			toolLabel->setText("-> Replace Color <-");
 		} else if (button == eyedropperButton) {
 			imageEdit->setDrawOperation(OPERATION_EYEDROPPER);
 			toolLabel->setText("-> Color Picker <-");
@@ -147,51 +252,149 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	clearButton->setClickFunc(editorToolsFunc);
 	pencilButton->setClickFunc(editorToolsFunc);
 	lineButton->setClickFunc(editorToolsFunc);
+	rectButton->setClickFunc(editorToolsFunc);
+	ellipseButton->setClickFunc(editorToolsFunc);
 	eraserButton->setClickFunc(editorToolsFunc);
 	fillButton->setClickFunc(editorToolsFunc);
+	replaceButton->setClickFunc(editorToolsFunc);
 	eyedropperButton->setClickFunc(editorToolsFunc);
 	gridButton->setClickFunc(editorToolsFunc);
 
-	auto serializeFunc = [imageEdit, saveButton, loadButton, export1DButton, export2DButton] (UIButton* button) {
+	const int brushSizes[] = {1, 2, 3, 4, 6, 8};
+	int brushShape = BITMAP_BRUSH_ROUND;
+	int brushSizeStep = 0;
+	bool shapesFilled = false;
+
+	auto brushFunc = [&, imageEdit, brushButton, brushSizeButton, shapeFillButton] (UIButton* button) {
+		char text[64];
+		if (button == brushButton) {
+			brushShape = brushShape == BITMAP_BRUSH_ROUND ? BITMAP_BRUSH_SQUARE : BITMAP_BRUSH_ROUND;
+			brushButton->setText(brushShape == BITMAP_BRUSH_ROUND ? "Brush: Round" : "Brush: Square");
+		} else if (button == brushSizeButton) {
+			brushSizeStep = (brushSizeStep + 1) % 6;
+			sprintf(text, "Size: %d", brushSizes[brushSizeStep]);
+			brushSizeButton->setText(text);
+		} else if (button == shapeFillButton) {
+			shapesFilled = !shapesFilled;
+			shapeFillButton->setText(shapesFilled ? "Shapes: Filled" : "Shapes: Outline");
+			imageEdit->setShapeFilled(shapesFilled);
+		}
+
+		imageEdit->setBrush(brushShape, brushSizes[brushSizeStep]);
+	};
+	brushButton->setClickFunc(brushFunc);
+	brushSizeButton->setClickFunc(brushFunc);
+	shapeFillButton->setClickFunc(brushFunc);
+
+	int exportTarget = EXPORTER_TARGET_C_PROGMEM;
+	int exportWidth = EXPORTER_WIDTH_8;
+	int wiringPreset = 0;
+	wiring_layout_t wiringLayout = wiring_preset(wiringPreset);
+
+	const float gammaSteps[] = {1.0f, 1.8f, 2.2f, 2.8f};
+	const int brightnessSteps[] = {100, 75, 50, 25};
+	int colorOrder = COLOROUT_RGB;
+	int gammaStep = 0;
+	int brightnessStep = 0;
+	colorout_t colorOut;
+	colorout_identity(&colorOut);
+
+	auto outputFunc = [&, colorOrderButton, gammaButton, brightnessButton] (UIButton* button) {
+		char text[64];
+		if (button == colorOrderButton) {
+			colorOrder = (colorOrder + 1) % COLOROUT_ORDER_COUNT;
+			sprintf(text, "Order: %s", colorout_order_name(colorOrder));
+			colorOrderButton->setText(text);
+		} else if (button == gammaButton) {
+			gammaStep = (gammaStep + 1) % 4;
+			sprintf(text, "Gamma: %.1f", gammaSteps[gammaStep]);
+			gammaButton->setText(text);
+		} else if (button == brightnessButton) {
+			brightnessStep = (brightnessStep + 1) % 4;
+			sprintf(text, "Bright: %d%%", brightnessSteps[brightnessStep]);
+			brightnessButton->setText(text);
+		}
+
+		float gamma[3] = {gammaSteps[gammaStep], gammaSteps[gammaStep], gammaSteps[gammaStep]};
+		colorout_build(&colorOut, colorOrder, gamma, brightnessSteps[brightnessStep] / 100.0f);
+	};
+	colorOrderButton->setClickFunc(outputFunc);
+	gammaButton->setClickFunc(outputFunc);
+	brightnessButton->setClickFunc(outputFunc);
+
+	auto serializeFunc = [&exportTarget, &exportWidth, &wiringPreset, &wiringLayout, &colorOut, imageEdit, saveButton, loadButton, importButton, export1DButton, export2DButton, exportTargetButton, exportWidthButton, wiringButton, exportButton] (UIButton* button) {
 		if (button == saveButton) {
 			serialize_save_image(imageEdit->getImageWidth(), imageEdit->getImageHeight(), imageEdit->getImageData());
 		} else if (button == loadButton) {
-			int width, height;
-			unsigned char* data = imageEdit->getImageData();
-			serialize_load_image(&width, &height, &data);
-			if (data) {
+			// decoded off the main thread; lands here on a later frame
+			serialize_load_image([imageEdit](int width, int height, unsigned char* data) {
 				imageEdit->reload(width, height, data);
-			}
+			});
+		} else if (button == importButton) {
+			// scaled to the canvas as it is now
+			serialize_import_image(imageEdit->getImageWidth(), imageEdit->getImageHeight(), [imageEdit](int width, int height, unsigned char* data) {
+				imageEdit->reload(width, height, data);
+			});
 		} else if (button == export1DButton) {
-			serialize_export_array1d(imageEdit->getImageWidth(), imageEdit->getImageHeight(), imageEdit->getImageData());
+			serialize_export_array1d(&wiringLayout, &colorOut, imageEdit->getImageWidth(), imageEdit->getImageHeight(), imageEdit->getImageData());
 		} else if (button == export2DButton) {
-			serialize_export_array2d(imageEdit->getImageWidth(), imageEdit->getImageHeight(), imageEdit->getImageData());
+			serialize_export_array2d(&wiringLayout, &colorOut, imageEdit->getImageWidth(), imageEdit->getImageHeight(), imageEdit->getImageData());
+		} else if (button == exportTargetButton) {
+			char text[64];
+			exportTarget = (exportTarget + 1) % EXPORTER_TARGET_COUNT;
+			sprintf(text, "Target: %s", exporter_target_name(exportTarget));
+			exportTargetButton->setText(text);
+		} else if (button == exportWidthButton) {
+			char text[64];
+			exportWidth = (exportWidth + 1) % EXPORTER_WIDTH_COUNT;
+			sprintf(text, "Width: %s", exporter_width_name(exportWidth));
+			exportWidthButton->setText(text);
+		} else if (button == wiringButton) {
+			char text[64];
+			wiringPreset = (wiringPreset + 1) % wiring_preset_count();
+			wiringLayout = wiring_preset(wiringPreset);
+			sprintf(text, "Wiring: %s", wiring_preset_name(wiringPreset));
+			wiringButton->setText(text);
+		} else if (button == exportButton) {
+			serialize_export_target(exportTarget, exportWidth, &wiringLayout, &colorOut, imageEdit->getImageWidth(), imageEdit->getImageHeight(), imageEdit->getImageData());
 		}
 	};
 	saveButton->setClickFunc(serializeFunc);
 	loadButton->setClickFunc(serializeFunc);
+	importButton->setClickFunc(serializeFunc);
 	export1DButton->setClickFunc(serializeFunc);
 	export2DButton->setClickFunc(serializeFunc);
+	exportTargetButton->setClickFunc(serializeFunc);
+	exportWidthButton->setClickFunc(serializeFunc);
+	wiringButton->setClickFunc(serializeFunc);
+	exportButton->setClickFunc(serializeFunc);
 
 	// widget tooltips
 
 	toolLabel->setTooltip(						"Selected tool preview."
 												);
-	clearButton->setTooltip(					"Clear the entire canvas. Cannot be undone."
+	clearButton->setTooltip(					"Clear the entire canvas."
 												);
 	pencilButton->setTooltip(					"Draw a freehand line."
 												);
 	lineButton->setTooltip(						"Draw a straight line."
 												);
+	rectButton->setTooltip(						"Draw a rectangle from one corner to the other."
+												);
+	ellipseButton->setTooltip(					"Draw an ellipse that fits the box dragged out."
+												);
 	eraserButton->setTooltip(					"Erase things. I know, surprising."
 												);
 	fillButton->setTooltip(						"Fill all adjacent pixels of the same color."
 												);
+	replaceButton->setTooltip(					"Recolor every pixel of the clicked color, anywhere\n"
+												"in the image."
+												);
 	eyedropperButton->setTooltip(				"Pick a color from the canvas."
 												);
-	toleranceSlider->setTooltip(				"The fill bucket color similarity tolerance from\n"
-												"0-255, with low values being more picky, and high\n"
-												"values being more lenient."
+	toleranceSlider->setTooltip(				"The fill and replace color similarity tolerance\n"
+												"from 0-255, with low values being more picky, and\n"
+												"high values being more lenient."
 												);
 	colorDisplay->setTooltip(					"Selected color preview."
 												);
@@ -208,8 +411,44 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 												"ranging 0-255, laid out in RGB order. The 2D array\n"
 												"is laid out in [row][col] fashion."
 												);
+	exportTargetButton->setTooltip(				"Choose what to export for: a C/Arduino PROGMEM\n"
+												"array, a packed hex string, Python bytes, or a\n"
+												"raw .bin file."
+												);
+	exportWidthButton->setTooltip(				"Choose the element width: one byte per color\n"
+												"component, 16-bit RGB565 pixels, or 32-bit\n"
+												"0x00RRGGBB pixels."
+												);
+	wiringButton->setTooltip(					"Choose how the LED strip runs through the image.\n"
+												"Every export lists pixels in strip order."
+												);
+	exportButton->setTooltip(					"Export the image for the selected target. Text\n"
+												"targets are copied to the clipboard; binary\n"
+												"files are saved to disk."
+												);
+	colorOrderButton->setTooltip(				"The channel order exports are written in.\n"
+												"WS2812 strips want GRB."
+												);
+	gammaButton->setTooltip(					"The gamma curve applied to exported colors."
+												);
+	brightnessButton->setTooltip(				"Scale exported colors down to stay within a\n"
+												"power budget."
+												);
+	importButton->setTooltip(					"Import a PNG, BMP or PPM image, averaged down\n"
+												"to the size of the canvas."
+												);
 	gridButton->setTooltip(						"Show a grid of lines, points, or nothing at all."
 												);
+	brushButton->setTooltip(					"The shape of the brush the pencil, eraser and line\n"
+												"draw with."
+												);
+	brushSizeButton->setTooltip(				"The width of the brush, in pixels."
+												);
+	shapeFillButton->setTooltip(				"Draw rectangles and ellipses as outlines, or filled."
+												);
+	historyLabel->setTooltip(					"Memory held by the undo and redo history. Older\n"
+												"steps are compressed, then forgotten, past 32 MB."
+												);
 
 	toleranceSlider->setMaxColor(255, 255, 255);
 	toleranceSlider->setValue(8);
@@ -221,13 +460,19 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	blueSlider->setMaxColor(0, 0, 255);
 	colorDisplayLabel->setColor(0, 0, 0, 0);
 	colorDisplayLabel->setFont(defaultSmFont);
+	historyLabel->setColor(0, 0, 0, 0);
+	historyLabel->setFont(defaultSmFont);
+	historyLabel->setTextColor(0, 0, 0);
 	
 	editorScreen->addUIWidget(toolLabel);
 	editorScreen->addUIWidget(clearButton);
 	editorScreen->addUIWidget(pencilButton);
 	editorScreen->addUIWidget(lineButton);
+	editorScreen->addUIWidget(rectButton);
+	editorScreen->addUIWidget(ellipseButton);
 	editorScreen->addUIWidget(eraserButton);
 	editorScreen->addUIWidget(fillButton);
+	editorScreen->addUIWidget(replaceButton);
 	editorScreen->addUIWidget(toleranceSlider);
 	editorScreen->addUIWidget(toleranceDisplayLabel);
 	editorScreen->addUIWidget(eyedropperButton);
@@ -241,11 +486,31 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	editorScreen->addUIWidget(loadButton);
 	editorScreen->addUIWidget(export1DButton);
 	editorScreen->addUIWidget(export2DButton);
+	editorScreen->addUIWidget(exportTargetButton);
+	editorScreen->addUIWidget(exportWidthButton);
+	editorScreen->addUIWidget(wiringButton);
+	editorScreen->addUIWidget(exportButton);
 	editorScreen->addUIWidget(gridButton);
-
+	editorScreen->addUIWidget(colorOrderButton);
+	editorScreen->addUIWidget(gammaButton);
+	editorScreen->addUIWidget(brightnessButton);
+	editorScreen->addUIWidget(importButton);
+	editorScreen->addUIWidget(brushButton);
+	editorScreen->addUIWidget(brushSizeButton);
+	editorScreen->addUIWidget(shapeFillButton);
+	editorScreen->addUIWidget(historyLabel);
+
+	startupPhase("interface");
 	winapi_show();
+	bool firstFrame = true;
+
+	// only redraw once something changed, and no faster than the frame cap
+	while (winapi_run(scheduler_wait_time(gScheduler, scheduler_time()))) {
+		if (!scheduler_begin_frame(gScheduler, scheduler_time()))
+			continue;
+
+		serialize_poll();
 
-	while (winapi_run()) {
 		imageEdit->setFillTolerance(toleranceSlider->getValue());
 
 		unsigned char r;
@@ -276,16 +541,28 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 		colorDisplayLabel->setText(text);
 		colorDisplayLabel->setTextColor(invertR, invertG, invertB);
 
+		sprintf(text, "History: %u KB", (unsigned int)((imageEdit->getHistoryMemory() + 1023) / 1024));
+		historyLabel->setText(text);
+
 		uiface_update();
 		display_update();
+
+		if (firstFrame) {
+			startupPhase("first frame");
+			firstFrame = false;
+		}
 	}
 
+	serialize_shutdown();
+	imageEdit->setJournal(nullptr);
+	destroy_journal(autosave);
 	delete editorScreen;
 
 	uiface_shutdown();
 	text_shutdown();
 	display_shutdown();
 	winapi_shutdown();
+	destroy_scheduler(gScheduler);
 
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "mapfile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+
+// returns nullptr when the file can't be opened; empty files map to a null
+// view of size 0 since windows refuses to map those
+mapped_file_t* map_file(const char* filename) {
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	mapped_file_t* mapped = new mapped_file_t();
+	mapped->file = file;
+	mapped->size = (size_t)size.QuadPart;
+	if (!mapped->size)
+		return mapped;
+
+	mapped->mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapped->mapping)
+		mapped->data = (const unsigned char*)MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!mapped->data) {
+		unmap_file(mapped);
+		return nullptr;
+	}
+
+	return mapped;
+}
+
+void unmap_file(mapped_file_t* mapped) {
+	if (mapped->data)
+		UnmapViewOfFile(mapped->data);
+	if (mapped->mapping)
+		CloseHandle(mapped->mapping);
+	CloseHandle(mapped->file);
+	delete mapped;
+}
+
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+mapped_file_t* map_file(const char* filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat info;
+	if (fstat(fd, &info) < 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	mapped_file_t* mapped = new mapped_file_t();
+	mapped->size = (size_t)info.st_size;
+	if (mapped->size) {
+		void* view = mmap(nullptr, mapped->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view == MAP_FAILED) {
+			close(fd);
+			delete mapped;
+			return nullptr;
+		}
+		mapped->data = (const unsigned char*)view;
+	}
+
+	// the mapping outlives the descriptor
+	close(fd);
+	return mapped;
+}
+
+void unmap_file(mapped_file_t* mapped) {
+	if (mapped->data)
+		munmap((void*)mapped->data, mapped->size);
+	delete mapped;
+}
+
+#endif
\ No newline at end of file
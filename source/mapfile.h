@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+
+/* Mapped File: a read-only view of a whole file */
+typedef struct mapped_file_s {
+	const unsigned char* data;
+	size_t size;
+	void* file;
+	void* mapping;
+} mapped_file_t;
+
+mapped_file_t* map_file(const char* filename);
+void unmap_file(mapped_file_t* mapped);
\ No newline at end of file
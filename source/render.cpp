@@ -0,0 +1,121 @@
+#include "render.h"
+#include <vector>
+#include <chrono>
+
+/* Batch State: everything that forces a separate draw call */
+typedef struct render_batch_state_s {
+	GLenum mode;
+	unsigned int texture;
+	bool blend;
+	bool smooth;
+} render_batch_state_t;
+
+static std::vector<render_vertex_t> vertices = {};
+static render_batch_state_t batchState = {GL_TRIANGLES, 0, false, false};
+static float pxSizeX = 0.0f;
+static float pxSizeY = 0.0f;
+static std::chrono::steady_clock::time_point frameStart;
+static render_stats_t frameStats = {0};
+static render_stats_t lastFrameStats = {0};
+
+void render_resize(int w, int h) {
+	render_flush();
+	pxSizeX = 2.0f / float(w);
+	pxSizeY = 2.0f / float(h);
+}
+
+void render_begin_frame() {
+	frameStart = std::chrono::steady_clock::now();
+}
+
+void render_end_frame() {
+	render_flush();
+	frameStats.cpuTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+	lastFrameStats = frameStats;
+	frameStats = {0};
+}
+
+// switches what the following vertices are drawn with; the pending batch is
+// only flushed when something actually changes
+void render_state(GLenum mode, unsigned int texture, bool blend, bool smooth) {
+	if (mode == batchState.mode && texture == batchState.texture &&
+	blend == batchState.blend && smooth == batchState.smooth)
+		return;
+
+	render_flush();
+	batchState.mode = mode;
+	batchState.texture = texture;
+	batchState.blend = blend;
+	batchState.smooth = smooth;
+}
+
+// draws everything queued so far; also needed before touching any texture the
+// pending batch may still be using
+void render_flush() {
+	if (vertices.empty())
+		return;
+
+	if (batchState.texture)
+		glBindTexture(GL_TEXTURE_2D, batchState.texture);
+	if (batchState.blend) {
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	}
+	if (batchState.smooth)
+		glEnable(GL_LINE_SMOOTH);
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(2, GL_FLOAT, sizeof(render_vertex_t), &vertices[0].x);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(render_vertex_t), &vertices[0].u);
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(render_vertex_t), &vertices[0].r);
+	glDrawArrays(batchState.mode, 0, (GLsizei)vertices.size());
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	if (batchState.smooth)
+		glDisable(GL_LINE_SMOOTH);
+	if (batchState.blend)
+		glDisable(GL_BLEND);
+	if (batchState.texture)
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+	frameStats.drawCalls++;
+	frameStats.vertices += (int)vertices.size();
+	vertices.clear();
+}
+
+// x/y in window pixels
+void render_vertex(float x, float y, float u, float v, unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
+	vertices.push_back({x * pxSizeX - 1.0f, y * -pxSizeY + 1.0f, u, v, r, g, b, a});
+}
+
+// u1/v1 map to the top left corner, u2/v2 to the bottom right
+void render_quad(float x, float y, float w, float h, unsigned char r, unsigned char g, unsigned char b, unsigned char a, float u1, float v1, float u2, float v2) {
+	unsigned char color[4] = {r, g, b, a};
+	render_quad_corners(x, y, w, h, color, color, color, color, u1, v1, u2, v2);
+}
+
+// split along the same diagonal as the old triangle fans, so gradients
+// interpolate exactly as before
+void render_quad_corners(float x, float y, float w, float h, const unsigned char* tl, const unsigned char* bl, const unsigned char* br, const unsigned char* tr, float u1, float v1, float u2, float v2) {
+	render_vertex(x, y, u1, v1, tl[0], tl[1], tl[2], tl[3]);
+	render_vertex(x, y + h, u1, v2, bl[0], bl[1], bl[2], bl[3]);
+	render_vertex(x + w, y + h, u2, v2, br[0], br[1], br[2], br[3]);
+
+	render_vertex(x, y, u1, v1, tl[0], tl[1], tl[2], tl[3]);
+	render_vertex(x + w, y + h, u2, v2, br[0], br[1], br[2], br[3]);
+	render_vertex(x + w, y, u2, v1, tr[0], tr[1], tr[2], tr[3]);
+}
+
+void render_count_texture_upload(size_t bytes) {
+	frameStats.textureUploads++;
+	frameStats.textureUploadBytes += bytes;
+}
+
+// statistics of the last completed frame
+render_stats_t render_get_stats() {
+	return lastFrameStats;
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+#include "display.h"
+#include <cstddef>
+
+/* Batched Vertex, in NDC */
+typedef struct render_vertex_s {
+	float x, y;
+	float u, v;
+	unsigned char r, g, b, a;
+} render_vertex_t;
+
+/* Per-frame Statistics */
+typedef struct render_stats_s {
+	double cpuTime;
+	int drawCalls;
+	int vertices;
+	int textureUploads;
+	size_t textureUploadBytes;
+} render_stats_t;
+
+void render_resize(int w, int h);
+void render_begin_frame();
+void render_end_frame();
+void render_state(GLenum mode, unsigned int texture = 0, bool blend = false, bool smooth = false);
+void render_flush();
+void render_vertex(float x, float y, float u, float v, unsigned char r, unsigned char g, unsigned char b, unsigned char a = 255);
+void render_quad(float x, float y, float w, float h, unsigned char r, unsigned char g, unsigned char b, unsigned char a = 255, float u1 = 0.0f, float v1 = 0.0f, float u2 = 1.0f, float v2 = 1.0f);
+void render_quad_corners(float x, float y, float w, float h, const unsigned char* tl, const unsigned char* bl, const unsigned char* br, const unsigned char* tr, float u1 = 0.0f, float v1 = 0.0f, float u2 = 1.0f, float v2 = 1.0f);
+void render_count_texture_upload(size_t bytes);
+render_stats_t render_get_stats();
\ No newline at end of file
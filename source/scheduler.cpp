@@ -0,0 +1,56 @@
+#include "scheduler.h"
+#include <chrono>
+
+scheduler_t* create_scheduler(int maxFps) {
+	scheduler_t* scheduler = new scheduler_t();
+	scheduler->dirty = true;
+	scheduler->frameInterval = maxFps > 0 ? 1.0 / maxFps : 0.0;
+	scheduler->lastFrameTime = -1e9;
+	scheduler->wakeFunc = nullptr;
+	return scheduler;
+}
+
+void destroy_scheduler(scheduler_t* scheduler) {
+	delete scheduler;
+}
+
+// wakeFunc interrupts a blocking wait in the platform layer; it gets called
+// from whichever thread invalidates, so it has to be thread-safe
+void scheduler_set_wake_func(scheduler_t* scheduler, void (*wakeFunc)()) {
+	scheduler->wakeFunc = wakeFunc;
+}
+
+// safe to call from any thread
+void scheduler_invalidate(scheduler_t* scheduler) {
+	if (scheduler->dirty.exchange(true))
+		return;
+	if (scheduler->wakeFunc)
+		scheduler->wakeFunc();
+}
+
+// how long the platform layer may sleep waiting for input: negative means
+// until something happens, zero means a frame is due right now, and anything
+// else is what's left of the frame cap
+double scheduler_wait_time(scheduler_t* scheduler, double now) {
+	if (!scheduler->dirty)
+		return -1.0;
+
+	double remaining = scheduler->lastFrameTime + scheduler->frameInterval - now;
+	return remaining > 0.0 ? remaining : 0.0;
+}
+
+// true when a frame should be drawn now; consumes the pending damage, so
+// anything invalidated while the frame runs schedules the next one
+bool scheduler_begin_frame(scheduler_t* scheduler, double now) {
+	if (scheduler_wait_time(scheduler, now) != 0.0)
+		return false;
+
+	scheduler->dirty = false;
+	scheduler->lastFrameTime = now;
+	return true;
+}
+
+double scheduler_time() {
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
\ No newline at end of file
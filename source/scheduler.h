@@ -0,0 +1,20 @@
+#pragma once
+#include <atomic>
+
+/* Frame Scheduler: decides when the next frame is due; times are in seconds */
+typedef struct scheduler_s {
+	std::atomic<bool> dirty;
+	double frameInterval;
+	double lastFrameTime;
+	void (*wakeFunc)();
+} scheduler_t;
+
+scheduler_t* create_scheduler(int maxFps);
+void destroy_scheduler(scheduler_t* scheduler);
+void scheduler_set_wake_func(scheduler_t* scheduler, void (*wakeFunc)());
+void scheduler_invalidate(scheduler_t* scheduler);
+double scheduler_wait_time(scheduler_t* scheduler, double now);
+bool scheduler_begin_frame(scheduler_t* scheduler, double now);
+double scheduler_time();
+
+extern scheduler_t* gScheduler;
\ No newline at end of file
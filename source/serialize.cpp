@@ -1,12 +1,95 @@
 #include "serialize.h"
 #include "winapishenanigans.h"
+#include "ledfile.h"
+#include "imagefile.h"
+#include "exporter.h"
+#include "colorout.h"
+#include "scheduler.h"
+#include <functional>
 #include <fstream>
 #include <string>
-
-#define SERIALIZE_FILE_VERSION 1
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
 
 extern HWND ghWnd;
 
+// file i/o runs on one background thread, in order, so a slow disk never
+// stalls the editor; whatever has to touch the UI comes back as a completion
+// that serialize_poll runs on the main thread
+static std::thread ioThread;
+static std::mutex ioMutex;
+static std::condition_variable ioWake;
+static std::deque<std::function<void()>> ioJobs;
+static std::vector<std::function<void()>> ioCompletions;
+static int ioPending = 0;
+static bool ioQuit = false;
+
+static void io_thread() {
+    while (1) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(ioMutex);
+            ioWake.wait(lock, []() { return ioQuit || !ioJobs.empty(); });
+            if (ioJobs.empty())
+                return;
+            job = std::move(ioJobs.front());
+            ioJobs.pop_front();
+        }
+        job();
+    }
+}
+
+static void io_submit(std::function<void()> job) {
+    std::lock_guard<std::mutex> lock(ioMutex);
+    if (!ioThread.joinable())
+        ioThread = std::thread(io_thread);
+    ioJobs.push_back(std::move(job));
+    ioPending++;
+    ioWake.notify_one();
+}
+
+// called from the i/o thread once a job is done
+static void io_complete(std::function<void()> completion) {
+    {
+        std::lock_guard<std::mutex> lock(ioMutex);
+        ioCompletions.push_back(std::move(completion));
+        ioPending--;
+    }
+    scheduler_invalidate(gScheduler);
+}
+
+void serialize_poll() {
+    std::vector<std::function<void()>> completions;
+    {
+        std::lock_guard<std::mutex> lock(ioMutex);
+        completions.swap(ioCompletions);
+    }
+    for (std::function<void()>& completion : completions)
+        completion();
+}
+
+bool serialize_busy() {
+    std::lock_guard<std::mutex> lock(ioMutex);
+    return ioPending > 0;
+}
+
+// lets queued saves finish; completions that never ran are dropped
+void serialize_shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(ioMutex);
+        ioQuit = true;
+    }
+    ioWake.notify_all();
+    if (ioThread.joinable())
+        ioThread.join();
+    ioCompletions.clear();
+}
+
 void serialize_save_image(int width, int height, unsigned char* data) {
     char filename[260];
     filename[0] = '\0';
@@ -23,36 +106,26 @@ void serialize_save_image(int width, int height, unsigned char* data) {
         return;
     }
 
-	std::ofstream file(ofn.lpstrFile, std::ios::binary);
-	if (!file.is_open()) {
-		MessageBoxA(nullptr, "Can't write to that file.", "Joyous occasion", MB_OK | MB_ICONERROR);
-		return;
-	}
-
-    int version = SERIALIZE_FILE_VERSION;
-    file.write("led ", 4);
-    file.write("ver ", 4);
-    file.write((char*)&version, sizeof(int));
-	file.write((char*)&width, sizeof(int));
-	file.write((char*)&height, sizeof(int));
-	file.write((char*)data, width * height * 3);
-
-    if (file.fail()) {
-        MessageBoxA(nullptr, "An error occured while writing to that file.", "Joyous occasion", MB_OK | MB_ICONERROR);
-		return;
-    }
+	// the editor keeps drawing while this is written, so it gets its own copy
+	std::string path = ofn.lpstrFile;
+	std::shared_ptr<std::vector<unsigned char>> snapshot(new std::vector<unsigned char>(data, data + (size_t)width * height * 3));
+	io_submit([path, width, height, snapshot]() {
+		int error = ledfile_save(path.c_str(), width, height, snapshot->data());
+		io_complete([error]() {
+			if (error != LEDFILE_OK) {
+				MessageBoxA(nullptr, ledfile_error_string(error), "Joyous occasion", MB_OK | MB_ICONERROR);
+				return;
+			}
 
-	file.close();
-
-	MessageBoxA(nullptr, "File saved successfully.", "Info", MB_OK | MB_ICONINFORMATION);
+			MessageBoxA(nullptr, "File saved successfully.", "Info", MB_OK | MB_ICONINFORMATION);
+		});
+	});
 }
 
-void serialize_load_image(int* width, int* height, unsigned char** data) {
+void serialize_load_image(std::function<void(int, int, unsigned char*)> loadedFunc) {
     char filename[260];
     filename[0] = '\0';
 
-    *data = nullptr;
-
     OPENFILENAMEA ofn = {0};
     ofn.lStructSize = sizeof(ofn);
     ofn.lpstrFilter = "LEDitor Image Files (*.led)\0*.led\0";
@@ -64,128 +137,191 @@ void serialize_load_image(int* width, int* height, unsigned char** data) {
     if (!GetOpenFileNameA(&ofn))
         return;
 
-	std::ifstream file(ofn.lpstrFile, std::ios::binary);
-	if (!file.is_open()) {
-		MessageBoxA(nullptr, "Can't open that file.", "Joyous occasion", MB_OK | MB_ICONERROR);
-		return;
-	}
-
-    char header[4];
-    file.read(header, 4);
-    if (header[0] != 'l' || header[1] != 'e' || header[2] != 'd' || header[3] != ' ') {
-        MessageBoxA(nullptr, "That is not a valid LEDitor image file.", "Joyous occasion", MB_OK | MB_ICONERROR);
-        return;
-    }
-
-    int version = 1;
+	std::string path = ofn.lpstrFile;
+	io_submit([path, loadedFunc]() {
+		ledfile_image_t image;
+		int error = ledfile_open(path.c_str(), &image);
+		if (error != LEDFILE_OK) {
+			io_complete([error]() {
+				MessageBoxA(nullptr, ledfile_error_string(error), "Joyous occasion", MB_OK | MB_ICONERROR);
+			});
+			return;
+		}
 
-    char versionheader[4];
-    file.read(versionheader, 4);
-    if (versionheader[0] != 'v' || versionheader[1] != 'e' || versionheader[2] != 'r' || versionheader[3] != ' ') {
-        MessageBoxA(nullptr, "That file has an outdated format; please save it again when possible.", "Info", MB_OK | MB_ICONINFORMATION);
-        version = 0;
-        file.seekg(-4, std::ios::cur);
-    }
-
-    if (version > 0)
-        file.read((char*)&version, sizeof(int));
+		// the editor owns its pixels, so this is the one copy out of the mapping
+		int width = image.width;
+		int height = image.height;
+		int version = image.version;
+		size_t size = (size_t)width * height * 3;
+		unsigned char* data = new unsigned char[size];
+		memcpy(data, image.pixels, size);
+		ledfile_close(&image);
 
-	file.read((char*)width, sizeof(int));
-	file.read((char*)height, sizeof(int));
+		io_complete([loadedFunc, width, height, version, data]() {
+			if (version == 0)
+				MessageBoxA(nullptr, "That file has an outdated format; please save it again when possible.", "Info", MB_OK | MB_ICONINFORMATION);
+			loadedFunc(width, height, data);
+			delete[] data;
+		});
+	});
+}
 
-    unsigned char* image = new unsigned char[*width * *height * 3];
-	file.read((char*)image, *width * *height * 3);
+// decodes and scales the image down to width x height on the i/o thread
+void serialize_import_image(int width, int height, std::function<void(int, int, unsigned char*)> loadedFunc) {
+    char filename[260];
+    filename[0] = '\0';
 
-    if (file.fail()) {
-        MessageBoxA(nullptr, "An error occured while reading from that file.", "Joyous occasion", MB_OK | MB_ICONERROR);
-        delete[] image;
-		return;
+    OPENFILENAMEA ofn = {0};
+    ofn.lStructSize = sizeof(ofn);
+    ofn.lpstrFilter = "Images (*.png;*.bmp;*.ppm;*.pgm;*.pbm)\0*.png;*.bmp;*.ppm;*.pgm;*.pbm\0";
+    ofn.lpstrFile = filename;
+    ofn.nMaxFile = sizeof(filename);
+    ofn.lpstrInitialDir = ".";
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
+    if (!GetOpenFileNameA(&ofn)) {
+        return;
     }
 
-    *data = image;
+	std::string path = ofn.lpstrFile;
+	io_submit([path, width, height, loadedFunc]() {
+		imagefile_image_t image;
+		int error = imagefile_load(path.c_str(), &image);
+		if (error != IMAGEFILE_OK) {
+			io_complete([error]() {
+				MessageBoxA(nullptr, imagefile_error_string(error), "Joyous occasion", MB_OK | MB_ICONERROR);
+			});
+			return;
+		}
 
-	file.close();
+		unsigned char* data = new unsigned char[(size_t)width * height * 3];
+		imagefile_resample(image.pixels.data(), image.width, image.height, data, width, height);
+		io_complete([loadedFunc, width, height, data]() {
+			loadedFunc(width, height, data);
+			delete[] data;
+		});
+	});
 }
 
-void serialize_export_array1d(int width, int height, unsigned char* data) {
-    std::string str = "int image[] = {\n";
-    bool reverse = true;
-    for (int y = 0; y < height; y++) {
-        str += "    ";
-        if (reverse) {
-            for (int x = width; x--;) {
-                int idx = (y * width + x) * 3;
-                str += std::to_string(data[idx]) + ", ";
-                str += std::to_string(data[idx + 1]) + ", ";
-                str += std::to_string(data[idx + 2]) + ", ";
-            }
-        } else {
-            for (int x = 0; x < width; x++) {
-                int idx = (y * width + x) * 3;
-                str += std::to_string(data[idx]) + ", ";
-                str += std::to_string(data[idx + 1]) + ", ";
-                str += std::to_string(data[idx + 2]) + ", ";
-            }
-        }
-        str += '\n';
-        reverse = !reverse;
-    }
+// the exporter writes straight into the clipboard's memory
+static bool copy_to_clipboard(size_t size, const std::function<size_t(char*)>& writeFunc) {
+    HANDLE hMem = GlobalAlloc(GMEM_MOVEABLE, size + EXPORTER_SLACK);
+    if (!hMem)
+        return false;
 
-    str.pop_back();
-    str.pop_back();
-    str.pop_back();
-    str += "\n};";
+    char* text = (char*)GlobalLock(hMem);
+    text[writeFunc(text)] = '\0';
+    GlobalUnlock(hMem);
 
     OpenClipboard(ghWnd);
     EmptyClipboard();
-    HANDLE hMem = GlobalAlloc(GMEM_MOVEABLE, str.length() + 1);
-    HANDLE hMemCpy = GlobalLock(hMem);
-    memcpy(hMemCpy, str.c_str(), str.length() + 1);
-    GlobalUnlock(hMemCpy);
     SetClipboardData(CF_TEXT, hMem);
     CloseClipboard();
+    return true;
+}
+
+static wiring_map_t* compile_wiring(const wiring_layout_t* layout, int width, int height) {
+    wiring_map_t* map = wiring_compile(layout, width, height);
+    if (!map)
+        MessageBoxA(nullptr, "That wiring layout doesn't fit the image; the panels must evenly divide it.", "Joyous occasion", MB_OK | MB_ICONERROR);
+    return map;
+}
+
+// exports see the pixels as the hardware will, after the output transform
+static std::vector<unsigned char> transform_pixels(const colorout_t* color, int width, int height, const unsigned char* data) {
+    std::vector<unsigned char> pixels((size_t)width * height * 3);
+    colorout_apply(color, data, pixels.data(), (size_t)width * height);
+    return pixels;
+}
+
+void serialize_export_array1d(const wiring_layout_t* layout, const colorout_t* color, int width, int height, unsigned char* image) {
+    wiring_map_t* map = compile_wiring(layout, width, height);
+    if (!map)
+        return;
+
+    std::vector<unsigned char> pixels = transform_pixels(color, width, height, image);
+    const unsigned char* data = pixels.data();
+
+    size_t size = exporter_array1d_size(map, data);
+    bool copied = copy_to_clipboard(size, [&](char* out) { return exporter_array1d_write(map, data, out); });
+    destroy_wiring_map(map);
+    if (!copied) {
+        MessageBoxA(nullptr, "Not enough memory to export that image.", "Joyous occasion", MB_OK | MB_ICONERROR);
+        return;
+    }
 
     MessageBoxA(nullptr, "Copied 1D Array initialization code to clipboard.", "Info", MB_OK | MB_ICONINFORMATION);
 }
 
-void serialize_export_array2d(int width, int height, unsigned char* data) {
-    std::string str = "int image[][] = {\n";
-    bool reverse = true;
-    for (int y = 0; y < height; y++) {
-        str += "    { ";
-        if (reverse) {
-            for (int x = width; x--;) {
-                int idx = (y * width + x) * 3;
-                str += std::to_string(data[idx]) + ", ";
-                str += std::to_string(data[idx + 1]) + ", ";
-                str += std::to_string(data[idx + 2]) + ", ";
-            }
-        } else {
-            for (int x = 0; x < width; x++) {
-                int idx = (y * width + x) * 3;
-                str += std::to_string(data[idx]) + ", ";
-                str += std::to_string(data[idx + 1]) + ", ";
-                str += std::to_string(data[idx + 2]) + ", ";
-            }
+void serialize_export_array2d(const wiring_layout_t* layout, const colorout_t* color, int width, int height, unsigned char* image) {
+    wiring_map_t* map = compile_wiring(layout, width, height);
+    if (!map)
+        return;
+
+    std::vector<unsigned char> pixels = transform_pixels(color, width, height, image);
+    const unsigned char* data = pixels.data();
+
+    size_t size = exporter_array2d_size(map, data);
+    bool copied = copy_to_clipboard(size, [&](char* out) { return exporter_array2d_write(map, data, out); });
+    destroy_wiring_map(map);
+    if (!copied) {
+        MessageBoxA(nullptr, "Not enough memory to export that image.", "Joyous occasion", MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    MessageBoxA(nullptr, "Copied 2D Array initialization code to clipboard.", "Info", MB_OK | MB_ICONINFORMATION);
+}
+
+void serialize_export_target(int target, int elementWidth, const wiring_layout_t* layout, const colorout_t* color, int width, int height, unsigned char* image) {
+    wiring_map_t* map = compile_wiring(layout, width, height);
+    if (!map)
+        return;
+
+    std::vector<unsigned char> pixels = transform_pixels(color, width, height, image);
+    const unsigned char* data = pixels.data();
+
+    size_t size = exporter_target_size(target, elementWidth, map);
+
+    if (!exporter_target_is_binary(target)) {
+        bool copied = copy_to_clipboard(size, [&](char* out) { return exporter_target_write(target, elementWidth, map, data, out); });
+        destroy_wiring_map(map);
+        if (!copied) {
+            MessageBoxA(nullptr, "Not enough memory to export that image.", "Joyous occasion", MB_OK | MB_ICONERROR);
+            return;
         }
-        str.pop_back();
-        str.pop_back();
-        str += " },\n";
-        reverse = !reverse;
+
+        char message[128];
+        sprintf(message, "Copied %s (%s) export to clipboard.", exporter_target_name(target), exporter_width_name(elementWidth));
+        MessageBoxA(nullptr, message, "Info", MB_OK | MB_ICONINFORMATION);
+        return;
     }
 
-    str.pop_back();
-    str.pop_back();
-    str += "\n};";
+    char filename[260];
+    filename[0] = '\0';
 
-    OpenClipboard(ghWnd);
-    EmptyClipboard();
-    HANDLE hMem = GlobalAlloc(GMEM_MOVEABLE, str.length() + 1);
-    HANDLE hMemCpy = GlobalLock(hMem);
-    memcpy(hMemCpy, str.c_str(), str.length() + 1);
-    GlobalUnlock(hMemCpy);
-    SetClipboardData(CF_TEXT, hMem);
-    CloseClipboard();
+    OPENFILENAMEA ofn = {0};
+    ofn.lStructSize = sizeof(ofn);
+    ofn.lpstrFilter = "Raw Binary Files (*.bin)\0*.bin\0";
+    ofn.lpstrDefExt = "bin";
+    ofn.lpstrFile = filename;
+    ofn.nMaxFile = sizeof(filename);
+    ofn.lpstrInitialDir = ".";
+    ofn.Flags = OFN_PATHMUSTEXIST;
+    if (!GetSaveFileNameA(&ofn)) {
+        destroy_wiring_map(map);
+        return;
+    }
 
-    MessageBoxA(nullptr, "Copied 2D Array initialization code to clipboard.", "Info", MB_OK | MB_ICONINFORMATION);
+    std::vector<char> buffer(size + EXPORTER_SLACK);
+    exporter_target_write(target, elementWidth, map, data, buffer.data());
+    destroy_wiring_map(map);
+
+    std::ofstream file(ofn.lpstrFile, std::ios::binary);
+    file.write(buffer.data(), size);
+    file.close();
+    if (file.fail()) {
+        MessageBoxA(nullptr, "An error occured while writing to that file.", "Joyous occasion", MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    MessageBoxA(nullptr, "File exported successfully.", "Info", MB_OK | MB_ICONINFORMATION);
 }
\ No newline at end of file
@@ -1,6 +1,14 @@
 #pragma once
+#include "wiring.h"
+#include "colorout.h"
+#include <functional>
 
 void serialize_save_image(int width, int height, unsigned char* data);
-void serialize_load_image(int* width, int* height, unsigned char** data);
-void serialize_export_array1d(int width, int height, unsigned char* data);
-void serialize_export_array2d(int width, int height, unsigned char* data);
\ No newline at end of file
+void serialize_load_image(std::function<void(int, int, unsigned char*)> loadedFunc);
+void serialize_import_image(int width, int height, std::function<void(int, int, unsigned char*)> loadedFunc);
+void serialize_poll();
+bool serialize_busy();
+void serialize_shutdown();
+void serialize_export_array1d(const wiring_layout_t* layout, const colorout_t* color, int width, int height, unsigned char* data);
+void serialize_export_array2d(const wiring_layout_t* layout, const colorout_t* color, int width, int height, unsigned char* data);
+void serialize_export_target(int target, int elementWidth, const wiring_layout_t* layout, const colorout_t* color, int width, int height, unsigned char* data);
\ No newline at end of file
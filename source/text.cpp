@@ -1,6 +1,22 @@
 #include "text.h"
+#include "utf8.h"
 #include "display.h"
 #include "uiface.h"
+#include "render.h"
+#include "mapfile.h"
+#include "scheduler.h"
+#include "winapishenanigans.h"
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <atomic>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -15,62 +31,438 @@ Font* buttonFont = nullptr;
 static FT_Library freetype = nullptr;
 static Font* currentFont = nullptr;
 
-Font::Font(const char* filename, unsigned short size) {
+#define FONT_PAGE_WIDTH 256
+#define FONT_PAGE_MAX_HEIGHT 256
+#define FONT_CACHE_LIMIT (256 * 1024)
+
+#define FONT_BAKE_FIRST 32
+#define FONT_BAKE_COUNT 95
+#define FONT_BAKE_THREADS 4
+#define FONT_BAKE_DIR "res/fonts/cache"
+#define FONT_BAKE_VERSION 1
+
+/* Baked Font Cache: header, one record per glyph, then the alpha atlas */
+typedef struct fontcache_header_s {
+	char magic[4];
+	uint32_t version;
+	uint64_t fontHash;
+	uint32_t size;
+	uint32_t cellW, cellH;
+	uint32_t first, count;
+	uint32_t atlasW, atlasH;
+	uint32_t reserved;
+} fontcache_header_t;
+
+typedef struct fontcache_glyph_s {
+	int16_t ofsX, ofsY;
+	uint16_t w, h, adv;
+	uint16_t reserved;
+} fontcache_glyph_t;
+
+static uint64_t font_file_hash(const char* filename) {
+	mapped_file_t* mapped = map_file(filename);
+	if (!mapped)
+		return 0;
+
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < mapped->size; i++)
+		hash = (hash ^ mapped->data[i]) * 0x100000001b3ull;
+
+	unmap_file(mapped);
+	return hash;
+}
+
+static std::string font_cache_path(uint64_t hash, unsigned short size) {
+	char name[64];
+	sprintf(name, "/%016llx_%d.bin", (unsigned long long)hash, size);
+	return FONT_BAKE_DIR + std::string(name);
+}
+
+static FT_Face open_face(FT_Library library, const char* filename, unsigned short size) {
 	FT_Face face;
+	if (FT_New_Face(library, filename, 0, &face))
+		return nullptr;
+	FT_Set_Pixel_Sizes(face, 0, size);
+	return face;
+}
+
+// renders a glyph into the top-left of a cell, clearing the rest of it; with
+// no cell only the metrics are filled in
+static void rasterize_glyph(FT_Face face, unsigned int codepoint, unsigned short size, int cellW, int cellH, unsigned char* cell, int pitch, fontchar_t* character) {
+	FT_Load_Char(face, codepoint, FT_LOAD_RENDER);
+	FT_GlyphSlot slot = face->glyph;
 	short ofsY = size * 3 / 4;
-	
+	character->ofsX = slot->bitmap_left;
+	character->ofsY = slot->bitmap_top - ofsY;
+	character->w = std::min((int)slot->bitmap.width, cellW - 1);
+	character->h = std::min((int)slot->bitmap.rows, cellH - 1);
+	character->adv = slot->advance.x >> 6;
+
+	if (!cell)
+		return;
+	for (int row = 0; row < cellH; row++)
+		memset(&cell[row * pitch], 0, cellW);
+	for (int row = 0; row < character->h; row++)
+		memcpy(&cell[row * pitch], &slot->bitmap.buffer[row * slot->bitmap.pitch], character->w);
+}
+
+Font::Font(const char* filename, unsigned short size) {
+	double startTime = scheduler_time();
+
 	m_size = size;
-	FT_New_Face(freetype, filename, 0, &face);
-	FT_Set_Pixel_Sizes(face, 0, size);
+	m_face = nullptr;
+	m_filename = filename;
+	m_fontHash = font_file_hash(filename);
+	m_cacheLimit = FONT_CACHE_LIMIT;
+
+	bool cached = loadBakedCache();
+	if (!cached)
+		bakeGlyphs();
+
+	char message[256];
+	sprintf(message, "font: %s %d %s in %.2f ms\n", filename, size, cached ? "mapped" : "baked", (scheduler_time() - startTime) * 1000.0);
+	OutputDebugStringA(message);
+}
+
+Font::~Font() {
+	render_flush();
+	for (fontpage_t& page : m_pages)
+		glDeleteTextures(1, &page.texture);
+	if (m_face)
+		FT_Done_Face(m_face);
+}
+
+unsigned short Font::getSize() {
+	return m_size;
+}
+
+// the face is only needed for glyphs outside the baked set, so a cache hit
+// never opens it
+FT_FaceRec_* Font::getFace() {
+	if (!m_face)
+		m_face = open_face(freetype, m_filename.c_str(), m_size);
+	return m_face;
+}
+
+// rasterizes the glyph on first use; each lookup also marks it most recently used
+fontchar_t Font::getCharacter(unsigned int codepoint) {
+	auto find = m_glyphs.find(codepoint);
+	if (find != m_glyphs.end()) {
+		m_lru.splice(m_lru.begin(), m_lru, find->second.lru);
+		return find->second.character;
+	}
+
+	fontglyph_t glyph = {0};
+	FT_Face face = getFace();
+	if (!face)
+		return glyph.character;
+
+	if (!allocCell(&glyph.page, &glyph.cell)) {
+		// nowhere to put it; still advance the pen, just draw nothing
+		rasterize_glyph(face, codepoint, m_size, m_cellW, m_cellH, nullptr, 0, &glyph.character);
+		glyph.character.w = glyph.character.h = 0;
+		return glyph.character;
+	}
+
+	fontpage_t& page = m_pages[glyph.page];
+	int columns = page.w / m_cellW;
+	int cellX = glyph.cell % columns * m_cellW;
+	int cellY = glyph.cell / columns * m_cellH;
+	rasterize_glyph(face, codepoint, m_size, m_cellW, m_cellH, &page.pixels[cellY * page.w + cellX], page.w, &glyph.character);
+	uploadCell(glyph.page, glyph.cell);
+	addGlyph(codepoint, glyph);
+	return m_glyphs[codepoint].character;
+}
+
+void Font::setCacheLimit(size_t bytes) {
+	m_cacheLimit = bytes;
+}
+
+// atlas bytes held for this font, counted once for the CPU copy and once for the texture
+size_t Font::getCacheMemory() {
+	size_t memory = 0;
+	for (fontpage_t& page : m_pages)
+		memory += page.pixels.size() * 2;
+	return memory;
+}
+
+// maps the baked cache for this face and size; anything that doesn't match
+// exactly is treated as a miss and gets baked over
+bool Font::loadBakedCache() {
+	if (!m_fontHash)
+		return false;
+
+	mapped_file_t* mapped = map_file(font_cache_path(m_fontHash, m_size).c_str());
+	if (!mapped)
+		return false;
+
+	const fontcache_header_t* header = (const fontcache_header_t*)mapped->data;
+	bool valid = mapped->size >= sizeof(fontcache_header_t)
+		&& !memcmp(header->magic, "LEDF", 4)
+		&& header->version == FONT_BAKE_VERSION
+		&& header->fontHash == m_fontHash
+		&& header->size == m_size
+		&& header->cellW > 0 && header->cellH > 0
+		&& header->atlasW >= header->cellW && header->atlasW <= 4096
+		&& header->atlasH >= header->cellH && header->atlasH <= 4096
+		&& header->count <= (header->atlasW / header->cellW) * (header->atlasH / header->cellH)
+		&& mapped->size == sizeof(fontcache_header_t) + header->count * sizeof(fontcache_glyph_t) + (size_t)header->atlasW * header->atlasH;
+
+	if (valid) {
+		const fontcache_glyph_t* glyphs = (const fontcache_glyph_t*)(header + 1);
+		const unsigned char* atlas = (const unsigned char*)(glyphs + header->count);
+		for (uint32_t i = 0; i < header->count; i++)
+			valid = valid && glyphs[i].w < header->cellW && glyphs[i].h < header->cellH;
+		if (valid)
+			installBaked(header->first, header->count, header->cellW, header->cellH, glyphs, header->atlasW, header->atlasH, atlas);
+	}
+
+	unmap_file(mapped);
+	return valid;
+}
+
+// rasterizes the baked set straight into an atlas, one FT_Face per thread
+// since a face can't be shared across threads, then writes it out for next time
+void Font::bakeGlyphs() {
+	FT_Face face = getFace();
+	if (!face)
+		return;
+
+	// every glyph of a scalable face fits the scaled global bounding box; the
+	// spare pixel each way absorbs hinting and keeps neighbors apart
+	int cellW = (int)(FT_MulFix(face->bbox.xMax - face->bbox.xMin, face->size->metrics.x_scale) >> 6) + 2;
+	int cellH = (int)(FT_MulFix(face->bbox.yMax - face->bbox.yMin, face->size->metrics.y_scale) >> 6) + 2;
+	cellW = std::max(cellW, (int)m_size / 2);
+	cellH = std::max(cellH, (int)m_size);
+
+	int atlasW = std::max(FONT_PAGE_WIDTH, cellW);
+	int columns = atlasW / cellW;
+	int rows = (FONT_BAKE_COUNT + columns - 1) / columns;
+	int atlasH = 1;
+	while (atlasH < rows * cellH)
+		atlasH *= 2;
+
+	std::vector<unsigned char> atlas((size_t)atlasW * atlasH);
+	std::vector<fontcache_glyph_t> glyphs(FONT_BAKE_COUNT);
+	std::atomic<bool> failed(false);
+
+	int threadCount = std::max(1, std::min((int)std::thread::hardware_concurrency(), FONT_BAKE_THREADS));
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; t++) {
+		threads.emplace_back([&, t]() {
+			// FT_Library isn't thread-safe either, so each thread brings its own
+			FT_Library library;
+			if (FT_Init_FreeType(&library)) {
+				failed = true;
+				return;
+			}
+
+			FT_Face threadFace = open_face(library, m_filename.c_str(), m_size);
+			if (!threadFace) {
+				failed = true;
+				FT_Done_FreeType(library);
+				return;
+			}
+
+			// cells are disjoint, so nothing here needs a lock
+			for (int i = t; i < FONT_BAKE_COUNT; i += threadCount) {
+				fontchar_t character;
+				unsigned char* cell = &atlas[(i / columns * cellH) * atlasW + i % columns * cellW];
+				rasterize_glyph(threadFace, FONT_BAKE_FIRST + i, m_size, cellW, cellH, cell, atlasW, &character);
+				glyphs[i] = {character.ofsX, character.ofsY, character.w, character.h, character.adv, 0};
+			}
+
+			FT_Done_Face(threadFace);
+			FT_Done_FreeType(library);
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+
+	if (failed) {
+		// fall back on rasterizing lazily
+		m_cellW = cellW;
+		m_cellH = cellH;
+		return;
+	}
+
+	installBaked(FONT_BAKE_FIRST, FONT_BAKE_COUNT, cellW, cellH, glyphs.data(), atlasW, atlasH, atlas.data());
+
+	if (!m_fontHash)
+		return;
+
+	fontcache_header_t header = {{'L', 'E', 'D', 'F'}, FONT_BAKE_VERSION, m_fontHash, m_size,
+		(uint32_t)cellW, (uint32_t)cellH, FONT_BAKE_FIRST, FONT_BAKE_COUNT, (uint32_t)atlasW, (uint32_t)atlasH, 0};
+
+	// written under a temporary name so a half-written file is never mapped
+	std::error_code error;
+	std::filesystem::create_directories(FONT_BAKE_DIR, error);
+	std::string path = font_cache_path(m_fontHash, m_size);
+	std::string tempPath = path + ".tmp";
+	std::ofstream file(tempPath, std::ios::binary);
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)glyphs.data(), glyphs.size() * sizeof(fontcache_glyph_t));
+	file.write((const char*)atlas.data(), atlas.size());
+	file.close();
+	if (file.fail()) {
+		std::filesystem::remove(tempPath, error);
+		return;
+	}
+	std::filesystem::rename(tempPath, path, error);
+}
+
+// turns a baked atlas into the font's first page, its glyphs already cached
+void Font::installBaked(unsigned int first, unsigned int count, int cellW, int cellH, const fontcache_glyph_t* glyphs, int atlasW, int atlasH, const unsigned char* atlas) {
+	m_cellW = cellW;
+	m_cellH = cellH;
+
+	fontpage_t page;
+	page.w = atlasW;
+	page.h = atlasH;
+	page.pixels.assign(atlas, atlas + (size_t)atlasW * atlasH);
+	int cells = (atlasW / cellW) * (atlasH / cellH);
+	for (int cell = cells; cell-- > (int)count;)
+		page.freeCells.push_back(cell);
+
+	render_flush();
+	glGenTextures(1, &page.texture);
+	m_pages.push_back(page);
+	uploadPage((int)m_pages.size() - 1);
+
+	for (unsigned int i = 0; i < count; i++) {
+		fontglyph_t glyph = {0};
+		glyph.character = {glyphs[i].ofsX, glyphs[i].ofsY, glyphs[i].w, glyphs[i].h, glyphs[i].adv};
+		glyph.page = (int)m_pages.size() - 1;
+		glyph.cell = i;
+		addGlyph(first + i, glyph);
+	}
+}
+
+// fills in the texture coordinates and puts the glyph at the front of the LRU
+void Font::addGlyph(unsigned int codepoint, fontglyph_t glyph) {
+	fontpage_t& page = m_pages[glyph.page];
+	int columns = page.w / m_cellW;
+	int cellX = glyph.cell % columns * m_cellW;
+	int cellY = glyph.cell / columns * m_cellH;
+
+	glyph.character.texture = page.texture;
+	glyph.character.u1 = float(cellX) / page.w;
+	glyph.character.v1 = float(cellY) / page.h;
+	glyph.character.u2 = float(cellX + glyph.character.w) / page.w;
+	glyph.character.v2 = float(cellY + glyph.character.h) / page.h;
+
+	m_lru.push_front(codepoint);
+	glyph.lru = m_lru.begin();
+	m_glyphs[codepoint] = glyph;
+}
 
-	for (int i = 0; i < 128; i++) {
-		FT_Load_Char(face, i, FT_LOAD_RENDER);
-		unsigned short width = face->glyph->bitmap.width;
-		unsigned short height = face->glyph->bitmap.rows;
-
-		m_characters[i].ofsX = face->glyph->bitmap_left;
-		m_characters[i].ofsY = face->glyph->bitmap_top - ofsY;
-		m_characters[i].w = width;
-		m_characters[i].h = height;
-		m_characters[i].adv = face->glyph->advance.x >> 6;
-		
-		int area = width * height;
-		unsigned char* image = new unsigned char[area * 4];
-		for (int k = 0; k < area; k++) {
-			int idx = k * 4;
-			image[idx] = 255;
-			image[idx + 1] = 255;
-			image[idx + 2] = 255;
-			image[idx + 3] = face->glyph->bitmap.buffer[k];
+// finds a free cell, growing or adding pages while under the cache limit and
+// evicting the least recently used glyph once over it
+bool Font::allocCell(int* page, int* cell) {
+	while (1) {
+		for (int i = 0; i < (int)m_pages.size(); i++) {
+			if (m_pages[i].freeCells.empty())
+				continue;
+			*page = i;
+			*cell = m_pages[i].freeCells.back();
+			m_pages[i].freeCells.pop_back();
+			return true;
 		}
 
-		GLuint texture;
-		glGenTextures(1, &texture);
-		glBindTexture(GL_TEXTURE_2D, texture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-		width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		m_characters[i].texture = texture;
+		if (growPages())
+			continue;
+		if (m_lru.empty())
+			return false;
+		evictGlyph();
+	}
+}
 
-		delete[] image;
+// doubles the height of the newest page, or starts a new one when it's full
+bool Font::growPages() {
+	int pageW = std::max(FONT_PAGE_WIDTH, m_cellW);
+	int columns = pageW / m_cellW;
+	bool newPage = m_pages.empty() || m_pages.back().h >= std::max(FONT_PAGE_MAX_HEIGHT, m_cellH);
+	int pageH = newPage ? 1 : m_pages.back().h * 2;
+	while (pageH < m_cellH)
+		pageH *= 2;
+
+	size_t growth = (size_t)pageW * (newPage ? pageH : pageH / 2) * 2;
+	if (!m_pages.empty() && getCacheMemory() + growth > m_cacheLimit)
+		return false;
+
+	render_flush();
+	if (newPage) {
+		fontpage_t page;
+		page.w = pageW;
+		page.h = 0;
+		glGenTextures(1, &page.texture);
+		m_pages.push_back(page);
 	}
 
-	glBindTexture(GL_TEXTURE_2D, 0);
-	FT_Done_Face(face);
+	// rows are only ever appended, so cells keep their pixel positions; the
+	// glyphs' normalized v coordinates do change with the height though
+	fontpage_t& page = m_pages.back();
+	int oldRows = page.h / m_cellH;
+	page.h = pageH;
+	page.pixels.resize((size_t)page.w * page.h);
+	for (int cell = pageH / m_cellH * columns; cell-- > oldRows * columns;)
+		page.freeCells.push_back(cell);
+
+	int pageIndex = (int)m_pages.size() - 1;
+	for (auto& entry : m_glyphs) {
+		fontglyph_t& glyph = entry.second;
+		if (glyph.page != pageIndex)
+			continue;
+		int cellY = glyph.cell / columns * m_cellH;
+		glyph.character.v1 = float(cellY) / page.h;
+		glyph.character.v2 = float(cellY + glyph.character.h) / page.h;
+	}
+
+	uploadPage(pageIndex);
+	return true;
 }
 
-Font::~Font() {
-	for (int i = 0; i < 128; i++)
-		glDeleteTextures(1, &m_characters[i].texture);
+void Font::uploadPage(int pageIndex) {
+	fontpage_t& page = m_pages[pageIndex];
+
+	glBindTexture(GL_TEXTURE_2D, page.texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA,
+	page.w, page.h, 0, GL_ALPHA, GL_UNSIGNED_BYTE, page.pixels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	render_count_texture_upload(page.pixels.size());
 }
 
-unsigned short Font::getSize() {
-	return m_size;
+void Font::uploadCell(int pageIndex, int cell) {
+	fontpage_t& page = m_pages[pageIndex];
+	int columns = page.w / m_cellW;
+	int cellX = cell % columns * m_cellW;
+	int cellY = cell / columns * m_cellH;
+
+	// the pending batch may still sample whatever this cell held before
+	render_flush();
+	glBindTexture(GL_TEXTURE_2D, page.texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, page.w);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, cellX, cellY,
+	m_cellW, m_cellH, GL_ALPHA, GL_UNSIGNED_BYTE, &page.pixels[cellY * page.w + cellX]);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	render_count_texture_upload((size_t)m_cellW * m_cellH);
 }
 
-fontchar_t Font::getCharacter(char ascii) {
-	return m_characters[ascii];
+void Font::evictGlyph() {
+	unsigned int codepoint = m_lru.back();
+	m_lru.pop_back();
+
+	auto find = m_glyphs.find(codepoint);
+	m_pages[find->second.page].freeCells.push_back(find->second.cell);
+	m_glyphs.erase(find);
 }
 
 void text_initialize() {
@@ -82,6 +474,7 @@ void text_initialize() {
 
 void text_shutdown() {
 	delete buttonFont;
+	delete defaultSmFont;
 	delete defaultFont;
 	FT_Done_FreeType(freetype);
 }
@@ -91,33 +484,27 @@ void set_text_font(Font* font) {
 }
 
 int get_text_width(const char* text) {
-	int i = 0;
-	char ch = text[i];
 	int width = 0;
 
-	while (ch && ch != '\n') {
-		width += currentFont->getCharacter(ch).adv;
-		ch = text[++i];
-	}
+	while (*text && *text != '\n')
+		width += currentFont->getCharacter(utf8_decode(&text)).adv;
 
 	return width;
 }
 
 int get_text_width_max(const char* text) {
-	int i = 0;
-	char ch = text[i];
 	int width = 0;
 	int linewidth = 0;
 
-	while (ch) {
-		if (ch == '\n') {
+	while (*text) {
+		if (*text == '\n') {
 			if (linewidth > width)
 				width = linewidth;
 			linewidth = 0;
+			text++;
 		} else {
-			linewidth += currentFont->getCharacter(ch).adv;
+			linewidth += currentFont->getCharacter(utf8_decode(&text)).adv;
 		}
-		ch = text[++i];
 	}
 
 	return linewidth > width ? linewidth : width;
@@ -160,38 +547,19 @@ void draw_character(fontchar_t fontchar, int x, int y, unsigned char r, unsigned
 	int originX = x + fontchar.ofsX;
 	int originY = y - fontchar.ofsY;
 
-	glBindTexture(GL_TEXTURE_2D, fontchar.texture);
-	glBegin(GL_TRIANGLE_FAN);
-	glColor3ub(r, g, b);
-
-	glTexCoord2i(0, 0);
-	glVertex2f(XNDC(originX), YNDC(originY));
-	glTexCoord2i(0, 1);
-	glVertex2f(XNDC(originX), YNDC(originY + fontchar.h));
-	glTexCoord2i(1, 1);
-	glVertex2f(XNDC(originX + fontchar.w), YNDC(originY + fontchar.h));
-	glTexCoord2i(1, 0);
-	glVertex2f(XNDC(originX + fontchar.w), YNDC(originY));
-
-	glEnd();
+	render_state(GL_TRIANGLES, fontchar.texture, true);
+	render_quad(originX, originY, fontchar.w, fontchar.h, r, g, b, 255, fontchar.u1, fontchar.v1, fontchar.u2, fontchar.v2);
 }
 
 void draw_text_line(const char* text, int x, int y, bool centered, unsigned char r, unsigned char g, unsigned char b) {
-	int i = 0;
-	char ch = text[i];
 	int width = centered ? get_text_width(text) : 0;
 	int ofsX = width / -2;
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	while (ch && ch != '\n') {
-		fontchar_t character = currentFont->getCharacter(ch);
-		draw_character(character, x + ofsX, y, r, g, b);
+	// glyphs sharing an atlas page batch together, which is usually the whole line
+	while (*text && *text != '\n') {
+		fontchar_t character = currentFont->getCharacter(utf8_decode(&text));
+		if (character.w && character.h)
+			draw_character(character, x + ofsX, y, r, g, b);
 		ofsX += character.adv;
-		ch = text[++i];
 	}
-
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glDisable(GL_BLEND);
 }
\ No newline at end of file
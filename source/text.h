@@ -1,4 +1,13 @@
 #pragma once
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct FT_FaceRec_;
+struct fontcache_glyph_s;
 
 /* Font Character */
 typedef struct fontchar_s {
@@ -6,19 +15,56 @@ typedef struct fontchar_s {
 	unsigned short w, h;
 	unsigned short adv;
 	unsigned int texture;
+	float u1, v1, u2, v2;
 } fontchar_t;
 
+/* Font Atlas Page: a grid of equally sized glyph cells, grown downwards on demand */
+typedef struct fontpage_s {
+	unsigned int texture;
+	int w, h;
+	std::vector<unsigned char> pixels;
+	std::vector<int> freeCells;
+} fontpage_t;
+
+/* Cached Glyph */
+typedef struct fontglyph_s {
+	fontchar_t character;
+	int page, cell;
+	std::list<unsigned int>::iterator lru;
+} fontglyph_t;
+
 class Font {
 private:
 	unsigned short m_size;
-	fontchar_t m_characters[128];
+	FT_FaceRec_* m_face;
+	std::string m_filename;
+	uint64_t m_fontHash;
+	int m_cellW, m_cellH;
+	size_t m_cacheLimit;
+	std::vector<fontpage_t> m_pages;
+	std::unordered_map<unsigned int, fontglyph_t> m_glyphs;
+	std::list<unsigned int> m_lru;
 
 public:
 	Font(const char* filename, unsigned short size);
 	~Font();
 
 	unsigned short getSize();
-	fontchar_t getCharacter(char ascii);
+	fontchar_t getCharacter(unsigned int codepoint);
+	void setCacheLimit(size_t bytes);
+	size_t getCacheMemory();
+
+private:
+	FT_FaceRec_* getFace();
+	bool loadBakedCache();
+	void bakeGlyphs();
+	void installBaked(unsigned int first, unsigned int count, int cellW, int cellH, const fontcache_glyph_s* glyphs, int atlasW, int atlasH, const unsigned char* atlas);
+	void addGlyph(unsigned int codepoint, fontglyph_t glyph);
+	bool allocCell(int* page, int* cell);
+	bool growPages();
+	void uploadPage(int page);
+	void uploadCell(int page, int cell);
+	void evictGlyph();
 };
 
 void text_initialize();
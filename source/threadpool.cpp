@@ -0,0 +1,133 @@
+#include "threadpool.h"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+/* Work Queue: one per worker; the owner works from the back, thieves take
+   from the front so they grab the oldest (usually biggest) work */
+typedef struct threadpool_queue_s {
+	std::mutex mutex;
+	std::deque<std::function<void()>> tasks;
+} threadpool_queue_t;
+
+struct threadpool_s {
+	std::vector<std::thread> threads;
+	std::vector<std::unique_ptr<threadpool_queue_t>> queues;
+
+	// sleeping workers and waiters share this; queued counts tasks sitting in
+	// queues, pending counts ones not yet finished
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	std::atomic<int> queued;
+	std::atomic<int> pending;
+	std::atomic<unsigned int> nextQueue;
+	bool quit;
+};
+
+// which pool queue the current thread owns, if it's a worker
+static thread_local threadpool_t* currentPool = nullptr;
+static thread_local int currentQueue = -1;
+
+static bool take_task(threadpool_t* pool, int self, std::function<void()>* task) {
+	int count = (int)pool->queues.size();
+	for (int i = 0; i < count; i++) {
+		int index = (self + i) % count;
+		threadpool_queue_t* queue = pool->queues[index].get();
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (queue->tasks.empty())
+			continue;
+
+		if (index == self) {
+			*task = std::move(queue->tasks.back());
+			queue->tasks.pop_back();
+		} else {
+			*task = std::move(queue->tasks.front());
+			queue->tasks.pop_front();
+		}
+		pool->queued--;
+		return true;
+	}
+	return false;
+}
+
+static void worker_thread(threadpool_t* pool, int self) {
+	currentPool = pool;
+	currentQueue = self;
+
+	while (1) {
+		std::function<void()> task;
+		if (take_task(pool, self, &task)) {
+			task();
+			if (--pool->pending == 0) {
+				std::lock_guard<std::mutex> lock(pool->mutex);
+				pool->idle.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(pool->mutex);
+		pool->wake.wait(lock, [pool]() { return pool->quit || pool->queued > 0; });
+		if (pool->quit && pool->queued == 0)
+			return;
+	}
+}
+
+// 0 threads means one per hardware thread
+threadpool_t* create_threadpool(int threadCount) {
+	if (threadCount <= 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	threadpool_t* pool = new threadpool_t();
+	pool->queued = 0;
+	pool->pending = 0;
+	pool->nextQueue = 0;
+	pool->quit = false;
+	for (int i = 0; i < threadCount; i++)
+		pool->queues.push_back(std::unique_ptr<threadpool_queue_t>(new threadpool_queue_t()));
+	for (int i = 0; i < threadCount; i++)
+		pool->threads.emplace_back(worker_thread, pool, i);
+	return pool;
+}
+
+// finishes whatever is queued before returning
+void destroy_threadpool(threadpool_t* pool) {
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+		pool->quit = true;
+	}
+	pool->wake.notify_all();
+	for (std::thread& thread : pool->threads)
+		thread.join();
+	delete pool;
+}
+
+// tasks submitted from inside a task go to that worker's own queue, so
+// nested work stays local until someone idle steals it
+void threadpool_submit(threadpool_t* pool, std::function<void()> task) {
+	int index = currentPool == pool ? currentQueue : (int)(pool->nextQueue++ % pool->queues.size());
+	pool->pending++;
+	{
+		std::lock_guard<std::mutex> lock(pool->queues[index]->mutex);
+		pool->queues[index]->tasks.push_back(std::move(task));
+	}
+
+	std::lock_guard<std::mutex> lock(pool->mutex);
+	pool->queued++;
+	pool->wake.notify_one();
+}
+
+// blocks until every submitted task has finished; not for use inside a task
+void threadpool_wait(threadpool_t* pool) {
+	std::unique_lock<std::mutex> lock(pool->mutex);
+	pool->idle.wait(lock, [pool]() { return pool->pending == 0; });
+}
+
+int threadpool_thread_count(threadpool_t* pool) {
+	return (int)pool->threads.size();
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+#pragma once
+#include <functional>
+
+typedef struct threadpool_s threadpool_t;
+
+threadpool_t* create_threadpool(int threadCount = 0);
+void destroy_threadpool(threadpool_t* pool);
+void threadpool_submit(threadpool_t* pool, std::function<void()> task);
+void threadpool_wait(threadpool_t* pool);
+int threadpool_thread_count(threadpool_t* pool);
\ No newline at end of file
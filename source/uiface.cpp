@@ -1,6 +1,8 @@
 #include "uiface.h"
 #include "display.h"
 #include "text.h"
+#include "scheduler.h"
+#include "render.h"
 #include <algorithm>
 
 std::vector<UIWidget*> gUIWidgets = {};
@@ -38,26 +40,8 @@ void destroy_rect(rect_t* rect) {
 }
 
 void draw_rect(rect_t* rect) {
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	if (rect->texture) {
-		glBindTexture(GL_TEXTURE_2D, rect->texture);
-	}
-	glBegin(GL_TRIANGLE_FAN);
-	glColor4ub(rect->r, rect->g, rect->b, rect->a);
-	glTexCoord2i(0, 1);
-	glVertex2f(XNDC(rect->x), YNDC(rect->y));
-	glTexCoord2i(0, 0);
-	glVertex2f(XNDC(rect->x), YNDC(rect->y + rect->h));
-	glTexCoord2i(1, 0);
-	glVertex2f(XNDC(rect->x + rect->w), YNDC(rect->y + rect->h));
-	glTexCoord2i(1, 1);
-	glVertex2f(XNDC(rect->x + rect->w), YNDC(rect->y));
-	glEnd();
-	if (rect->texture) {
-		glBindTexture(GL_TEXTURE_2D, 0);
-	}
-	glDisable(GL_BLEND);
+	render_state(GL_TRIANGLES, rect->texture, true);
+	render_quad(rect->x, rect->y, rect->w, rect->h, rect->r, rect->g, rect->b, rect->a, 0.0f, 1.0f, 1.0f, 0.0f);
 }
 
 UIWidget::UIWidget(int x, int y, int width, int height) {
@@ -156,6 +140,15 @@ void UIScreen::undo() {
 	}
 }
 
+void UIScreen::redo() {
+	for (UIWidget* uiwidget : m_uiwidgets) {
+		UIEditBitmap* editBitmap = dynamic_cast<UIEditBitmap*>(uiwidget);
+		if (editBitmap) {
+			editBitmap->redo();
+		}
+	}
+}
+
 UIRect::UIRect(int x, int y, int width, int height, unsigned char r, unsigned char g, unsigned char b) :
 UIWidget(x, y, width, height) {
 	m_rect = create_rect(x, y, width, height, r, g, b);
@@ -293,7 +286,10 @@ void UISlider::update() {
 
 	if (m_pressing) {
 		int fractional = std::max(0, std::min(m_rect->w, mouseX - m_rect->x));
-		m_value = fractional * 255 / m_rect->w;
+		unsigned char value = fractional * 255 / m_rect->w;
+		if (value != m_value)
+			uiface_invalidate();
+		m_value = value;
 		refreshValue();
 	}
 }
@@ -304,23 +300,10 @@ void UISlider::draw() {
 	m_rect->b = m_minB;
 	UIRect::draw();
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	glBegin(GL_TRIANGLE_FAN);
-	glColor4ub(m_maxR, m_maxG, m_maxB, 0);
-	glTexCoord2i(0, 1);
-	glVertex2f(XNDC(m_rect->x), YNDC(m_rect->y));
-	glTexCoord2i(0, 0);
-	glVertex2f(XNDC(m_rect->x), YNDC(m_rect->y + m_rect->h));
-	glColor4ub(m_maxR, m_maxG, m_maxB, 255);
-	glTexCoord2i(1, 0);
-	glVertex2f(XNDC(m_rect->x + m_rect->w), YNDC(m_rect->y + m_rect->h));
-	glTexCoord2i(1, 1);
-	glVertex2f(XNDC(m_rect->x + m_rect->w), YNDC(m_rect->y));
-	glEnd();
-
-	glDisable(GL_BLEND);
+	unsigned char minColor[4] = {m_maxR, m_maxG, m_maxB, 0};
+	unsigned char maxColor[4] = {m_maxR, m_maxG, m_maxB, 255};
+	render_state(GL_TRIANGLES, 0, true);
+	render_quad_corners(m_rect->x, m_rect->y, m_rect->w, m_rect->h, minColor, minColor, maxColor, maxColor, 0.0f, 1.0f, 1.0f, 0.0f);
 
 	m_tick->texture = 0;
 	
@@ -350,13 +333,29 @@ UIEditBitmap::UIEditBitmap(int x, int y, int width, int height, int imageWidth,
 UIRect(x, y, width, height, 0, 0, 0) {
 	m_bitmap = create_bitmap(imageWidth, imageHeight);
 	bitmap_fill(m_bitmap, 0, 0, 0);
+	bitmap_set_tiled_undo(m_bitmap, imageWidth * imageHeight >= BITMAP_TILED_UNDO_PIXELS);
+	bitmap_set_undo_budget(m_bitmap, UNDO_HISTORY_BUDGET, uiface_invalidate);
 	m_previewBitmap = create_bitmap(imageWidth, imageHeight);
 	bitmap_fill(m_previewBitmap, 0, 0, 0);
+	m_previewSynced = false;
+	m_previewGeneration = 0;
+	m_previewW = 0;
 
 	m_texture = 0;
+	m_maskTexture = 0;
+	m_fillMask.valid = false;
+	m_fillMask.count = 0;
+	m_replaceMask.valid = false;
+	m_replaceMask.count = 0;
+	m_maskShowsReplace = false;
+	m_floodWorker = create_flood_worker(uiface_invalidate);
+	m_journal = nullptr;
 	regenTexture(true);
 	
 	m_selectedOp = OPERATION_PENCIL;
+	m_brush = BITMAP_BRUSH_ROUND;
+	m_brushWidth = 1;
+	m_shapeFilled = false;
 	m_selectedR = 255;
 	m_selectedG = 255;
 	m_selectedB = 255;
@@ -366,25 +365,58 @@ UIRect(x, y, width, height, 0, 0, 0) {
 }
 
 UIEditBitmap::~UIEditBitmap() {
+	destroy_flood_worker(m_floodWorker);
 	glDeleteTextures(1, &m_texture);
+	glDeleteTextures(1, &m_maskTexture);
 	destroy_bitmap(m_previewBitmap);
 	destroy_bitmap(m_bitmap);
 }
 
+// clearing is an ordinary undo block, so it can be taken back like a stroke
 void UIEditBitmap::clear() {
-	bitmap_fill(m_bitmap, 0, 0, 0);
-	bitmap_clear_undo_blocks(m_bitmap);
+	bitmap_start_undo_block(m_bitmap);
+	for (int y = 0; y < m_bitmap->h; y++)
+		bitmap_span(m_bitmap, 0, y, m_bitmap->w, 0, 0, 0, true);
+	endUndoBlock();
 }
 
 void UIEditBitmap::reload(int width, int height, unsigned char* data) {
+	bool resized = width != m_bitmap->w || height != m_bitmap->h;
 	bitmap_resize(m_bitmap, width, height);
 	bitmap_resize(m_previewBitmap, width, height);
-	memcpy(m_bitmap->image, data, width * height * 3);
+	bitmap_set_tiled_undo(m_bitmap, width * height >= BITMAP_TILED_UNDO_PIXELS);
+	m_previewSynced = false;
+	memcpy(m_bitmap->image, data, (size_t)width * height * 3);
+	if (resized)
+		regenTexture();
+
+	if (m_journal)
+		journal_snapshot(m_journal, m_bitmap);
 }
 
 void UIEditBitmap::undo() {
-	if (!m_pressing)
-		bitmap_pop_undo_block(m_bitmap);
+	if (m_pressing || m_bitmap->undo_blocks.empty())
+		return;
+
+	// the spans the block restores are exactly what the journal needs to redo it
+	std::vector<bitmap_span_t> spans;
+	if (m_journal)
+		bitmap_undo_block_spans(m_bitmap, m_bitmap->undo_blocks.back(), &spans);
+	bitmap_pop_undo_block(m_bitmap);
+	if (m_journal)
+		journal_delta(m_journal, m_bitmap, spans);
+}
+
+void UIEditBitmap::redo() {
+	if (m_pressing || m_bitmap->redo_blocks.empty())
+		return;
+
+	std::vector<bitmap_span_t> spans;
+	if (m_journal)
+		bitmap_undo_block_spans(m_bitmap, m_bitmap->redo_blocks.back(), &spans);
+	bitmap_pop_redo_block(m_bitmap);
+	if (m_journal)
+		journal_delta(m_journal, m_bitmap, spans);
 }
 
 void UIEditBitmap::setDrawColor(unsigned char r, unsigned char g, unsigned char b) {
@@ -411,6 +443,23 @@ void UIEditBitmap::setGridMode(unsigned char mode) {
 	m_gridMode = mode;
 }
 
+// the brush the pencil, eraser and line tools draw with
+void UIEditBitmap::setBrush(int brush, int width) {
+	m_brush = brush;
+	m_brushWidth = width;
+}
+
+void UIEditBitmap::setShapeFilled(bool filled) {
+	m_shapeFilled = filled;
+}
+
+// starts the journal over from the current image
+void UIEditBitmap::setJournal(journal_t* journal) {
+	m_journal = journal;
+	if (m_journal)
+		journal_snapshot(m_journal, m_bitmap);
+}
+
 int UIEditBitmap::getImageWidth() {
 	return m_bitmap->w;
 }
@@ -436,8 +485,13 @@ unsigned char UIEditBitmap::getGridMode() {
 	return m_gridMode;
 }
 
+size_t UIEditBitmap::getHistoryMemory() {
+	return bitmap_undo_memory(m_bitmap);
+}
+
 void UIEditBitmap::update() {
 	UIRect::update();
+	bitmap_history_poll(m_bitmap);
 
 	if (m_pressed) {
 		m_mouseXStart = mouseX;
@@ -458,121 +512,206 @@ void UIEditBitmap::update() {
 
 		if (m_pressing && (m_pressed || xbmap != xbmapLast || ybmap != ybmapLast)) {
 			if (m_selectedOp)
-				bitmap_line(m_bitmap, xbmapLast, ybmapLast, xbmap, ybmap, 0, 0, 0, true);
+				bitmap_brush_line(m_bitmap, xbmapLast, ybmapLast, xbmap, ybmap, m_brushWidth, m_brush, 0, 0, 0, true);
 			else
-				bitmap_line(m_bitmap, xbmapLast, ybmapLast, xbmap, ybmap, m_selectedR, m_selectedG, m_selectedB, true);
+				bitmap_brush_line(m_bitmap, xbmapLast, ybmapLast, xbmap, ybmap, m_brushWidth, m_brush, m_selectedR, m_selectedG, m_selectedB, true);
 		}
 
 		if (m_released) {
-			bitmap_end_undo_block(m_bitmap);
+			endUndoBlock();
 		}
-	} else if (m_selectedOp == OPERATION_LINE) {
+	} else if (m_selectedOp == OPERATION_LINE || m_selectedOp == OPERATION_RECT || m_selectedOp == OPERATION_ELLIPSE) {
 		if (m_released) {
 			bitmap_start_undo_block(m_bitmap);
-			bitmap_line(m_bitmap, xbmapStart, ybmapStart, xbmap, ybmap, m_selectedR, m_selectedG, m_selectedB, true);
-			bitmap_end_undo_block(m_bitmap);
+			drawShape(m_bitmap, xbmapStart, ybmapStart, xbmap, ybmap, true);
+			endUndoBlock();
 		}
 	} else if (m_selectedOp == OPERATION_EYEDROPPER) {
 		if (m_pressed) {
 			int idx = (ybmap * m_bitmap->w + xbmap) * 3;
 			setDrawColor(m_bitmap->image[idx], m_bitmap->image[idx + 1], m_bitmap->image[idx + 2]);
 			m_colorChanged = true;
+			uiface_invalidate();
 		}
 	} else if (m_selectedOp == OPERATION_FILLBUCKET) {
 		if (m_pressed) {
-			int matchIdx = (ybmap * m_bitmap->w + xbmap) * 3;
-			unsigned char matchR = m_bitmap->image[matchIdx];
-			unsigned char matchG = m_bitmap->image[matchIdx + 1];
-			unsigned char matchB = m_bitmap->image[matchIdx + 2];
+			// the hover preview has usually finished this exact region already
+			bitmap_start_undo_block(m_bitmap);
+			if (bitmap_fillmask_matches(&m_fillMask, m_bitmap, xbmap, ybmap, m_tolerance, m_selectedR, m_selectedG, m_selectedB)) {
+				if (m_fillMask.count)
+					bitmap_fill_mask(m_bitmap, m_fillMask.mask.data(), m_selectedR, m_selectedG, m_selectedB, true);
+			} else {
+				bitmap_flood_fill(m_bitmap, xbmap, ybmap, m_selectedR, m_selectedG, m_selectedB, m_tolerance, true);
+			}
+			endUndoBlock();
+		}
+	} else if (m_selectedOp == OPERATION_REPLACECOLOR) {
+		if (m_pressed) {
 			bitmap_start_undo_block(m_bitmap);
-			recurseFill(m_bitmap, xbmap, ybmap, m_selectedR, m_selectedG, m_selectedB, matchR, matchG, matchB);
-			bitmap_end_undo_block(m_bitmap);
+			if (bitmap_fillmask_matches(&m_replaceMask, m_bitmap, xbmap, ybmap, m_tolerance, m_selectedR, m_selectedG, m_selectedB)) {
+				if (m_replaceMask.count)
+					bitmap_fill_mask(m_bitmap, m_replaceMask.mask.data(), m_selectedR, m_selectedG, m_selectedB, true);
+			} else {
+				bitmap_replace_color(m_bitmap, xbmap, ybmap, m_selectedR, m_selectedG, m_selectedB, m_tolerance, true);
+			}
+			endUndoBlock();
 		}
 	}
 }
 
 void UIEditBitmap::draw() {
 	updateTexture(m_bitmap);
-	glBindTexture(GL_TEXTURE_2D, m_texture);
-	glBegin(GL_TRIANGLE_FAN);
-	glColor3ub(255, 255, 255);
-
-	glTexCoord2i(0, 0);
-	glVertex2f(XNDC(m_rect->x), YNDC(m_rect->y));
-	glTexCoord2i(0, 1);
-	glVertex2f(XNDC(m_rect->x), YNDC(m_rect->y + m_rect->h));
-	glTexCoord2i(1, 1);
-	glVertex2f(XNDC(m_rect->x + m_rect->w), YNDC(m_rect->y + m_rect->h));
-	glTexCoord2i(1, 0);
-	glVertex2f(XNDC(m_rect->x + m_rect->w), YNDC(m_rect->y));
-
-	glEnd();
-	glBindTexture(GL_TEXTURE_2D, 0);
+	render_state(GL_TRIANGLES, m_texture);
+	render_quad(m_rect->x, m_rect->y, m_rect->w, m_rect->h, 255, 255, 255);
 
 	drawPreview();
 	drawGrid();
 }
 
+// what the line and shape tools draw for a drag from one point to the other
+void UIEditBitmap::drawShape(bitmap_t* bitmap, int x1, int y1, int x2, int y2, bool undo) {
+	switch (m_selectedOp) {
+		case OPERATION_RECT:
+			bitmap_rect(bitmap, x1, y1, x2, y2, m_shapeFilled, m_selectedR, m_selectedG, m_selectedB, undo);
+			break;
+		case OPERATION_ELLIPSE:
+			bitmap_ellipse(bitmap, x1, y1, x2, y2, m_shapeFilled, m_selectedR, m_selectedG, m_selectedB, undo);
+			break;
+		default:
+			bitmap_brush_line(bitmap, x1, y1, x2, y2, m_brushWidth, m_brush, m_selectedR, m_selectedG, m_selectedB, undo);
+			break;
+	}
+}
+
+// commits the open block and logs it to the journal, if it kept anything
+void UIEditBitmap::endUndoBlock() {
+	size_t count = m_bitmap->undo_blocks.size();
+	bitmap_end_undo_block(m_bitmap);
+	if (m_journal && m_bitmap->undo_blocks.size() > count) {
+		std::vector<bitmap_span_t> spans;
+		bitmap_undo_block_spans(m_bitmap, m_bitmap->undo_blocks.back(), &spans);
+		journal_delta(m_journal, m_bitmap, spans);
+	}
+}
+
 void UIEditBitmap::regenTexture(bool first) {
+	render_flush();
 	if (!first) {
 		glDeleteTextures(1, &m_texture);
+		glDeleteTextures(1, &m_maskTexture);
 		m_texture = 0;
+		m_maskTexture = 0;
 	}
 
 	glGenTextures(1, &m_texture);
 	glBindTexture(GL_TEXTURE_2D, m_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
 	m_bitmap->w, m_bitmap->h, 0, GL_RGB,
 	GL_UNSIGNED_BYTE, m_bitmap->image);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glBindTexture(GL_TEXTURE_2D, 0);
+
+	render_count_texture_upload((size_t)m_bitmap->w * m_bitmap->h * 3);
+	bitmap_clear_dirty(m_bitmap);
+
+	// alpha-only coverage for the fill previews, filled in by uploadMask
+	glGenTextures(1, &m_maskTexture);
+	glBindTexture(GL_TEXTURE_2D, m_maskTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA,
+	m_bitmap->w, m_bitmap->h, 0, GL_ALPHA,
+	GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	m_fillMask.valid = false;
+	m_replaceMask.valid = false;
 }
 
 void UIEditBitmap::updateTexture(bitmap_t* bitmap) {
+	int x, y, w, h;
+	if (!bitmap_get_dirty(bitmap, &x, &y, &w, &h))
+		return;
+	bitmap_clear_dirty(bitmap);
+	render_flush();
+
+	// upload just the dirty rectangle straight out of the full-width image
 	glBindTexture(GL_TEXTURE_2D, m_texture);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
-	bitmap->w, bitmap->h, GL_RGB,
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, bitmap->w);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, x);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, y);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y,
+	w, h, GL_RGB,
 	GL_UNSIGNED_BYTE, bitmap->image);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 	glBindTexture(GL_TEXTURE_2D, 0);
+
+	render_count_texture_upload((size_t)w * h * 3);
 }
 
-void UIEditBitmap::recurseFill(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char matchR, unsigned char matchG, unsigned char matchB, bool undo) {
-	int idx = (y * bitmap->w + x) * 3;
-	bool bogusTest = abs((int)r - (int)matchR) <= m_tolerance &&
-	abs((int)g - (int)matchG) <= m_tolerance &&
-	abs((int)b - (int)matchB) <= m_tolerance;
-	if (bogusTest)
+// hands the current key to the flood worker and uploads whichever mask it
+// finished last; until a newer one arrives the previous mask stays on screen
+void UIEditBitmap::refreshFillMask(int x, int y) {
+	flood_worker_request(m_floodWorker, m_bitmap, x, y, m_tolerance, m_selectedR, m_selectedG, m_selectedB);
+	if (!flood_worker_poll(m_floodWorker, &m_fillMask) && !m_maskShowsReplace)
 		return;
-	
-	bitmap_pixel(bitmap, x, y, r, g, b, undo);
-	for (int ofsX = -1; ofsX < 2; ofsX++) {
-		for (int ofsY = -1; ofsY < 2; ofsY++) {
-			if (!ofsX && !ofsY)
-				continue;
-			if (ofsX && ofsY)
-				continue;
-
-			int testx = std::max(0, std::min(bitmap->w - 1, x + ofsX));
-			int testy = std::max(0, std::min(bitmap->h - 1, y + ofsY));
-			if (testx == x && testy == y)
-				continue;
-
-			idx = (testy * bitmap->w + testx) * 3;
-			bool test = abs((int)bitmap->image[idx] - (int)matchR) <= m_tolerance &&
-			abs((int)bitmap->image[idx + 1] - (int)matchG) <= m_tolerance &&
-			abs((int)bitmap->image[idx + 2] - (int)matchB) <= m_tolerance;
-			if (test) {
-				recurseFill(bitmap, testx, testy, r, g, b, matchR, matchG, matchB, undo);
-			}
-		}
+
+	m_maskShowsReplace = false;
+	uploadMask(&m_fillMask);
+}
+
+// the whole-image match is cheap enough to redo right here whenever the key moves
+void UIEditBitmap::refreshReplaceMask(int x, int y) {
+	if (x < 0 || x >= m_bitmap->w || y < 0 || y >= m_bitmap->h)
+		return;
+
+	bool fresh = !bitmap_fillmask_matches(&m_replaceMask, m_bitmap, x, y, m_tolerance, m_selectedR, m_selectedG, m_selectedB);
+	if (fresh) {
+		const unsigned char* seed = &m_bitmap->image[(y * m_bitmap->w + x) * 3];
+		m_replaceMask.mask.resize((size_t)m_bitmap->w * m_bitmap->h);
+		m_replaceMask.count = bitmap_match_mask(m_bitmap, seed[0], seed[1], seed[2], m_tolerance, m_replaceMask.mask.data());
+		m_replaceMask.x = x;
+		m_replaceMask.y = y;
+		m_replaceMask.tolerance = m_tolerance;
+		m_replaceMask.r = m_selectedR;
+		m_replaceMask.g = m_selectedG;
+		m_replaceMask.b = m_selectedB;
+		m_replaceMask.generation = m_bitmap->generation;
+		m_replaceMask.valid = true;
 	}
+	if (!fresh && m_maskShowsReplace)
+		return;
+
+	m_maskShowsReplace = true;
+	uploadMask(&m_replaceMask);
+}
+
+// both previews share the mask texture
+void UIEditBitmap::uploadMask(const bitmap_fillmask_t* fillmask) {
+	if (!fillmask->valid || !fillmask->count || fillmask->mask.size() != (size_t)m_bitmap->w * m_bitmap->h)
+		return;
+
+	render_flush();
+	glBindTexture(GL_TEXTURE_2D, m_maskTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+	m_bitmap->w, m_bitmap->h, GL_ALPHA,
+	GL_UNSIGNED_BYTE, fillmask->mask.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	render_count_texture_upload(fillmask->mask.size());
 }
 
 void UIEditBitmap::drawGrid() {
 	if (m_gridMode == 1) {
-		glEnable(GL_LINE_SMOOTH);
-		glBegin(GL_LINES);
+		render_state(GL_LINES, 0, false, true);
 
 		for (int x = 1; x < m_bitmap->w; x++) {
 			/*
@@ -592,11 +731,9 @@ void UIEditBitmap::drawGrid() {
 			glColor3ub(invertR, invertG, invertB);
 			*/
 
-			glColor3ub(255, 255, 255);
-
 			int xsize = x * m_rect->w / (m_bitmap->w);
-			glVertex2f(XNDC(m_rect->x + xsize), YNDC(m_rect->y));
-			glVertex2f(XNDC(m_rect->x + xsize), YNDC(m_rect->y + m_rect->h));
+			render_vertex(m_rect->x + xsize, m_rect->y, 0.0f, 0.0f, 255, 255, 255);
+			render_vertex(m_rect->x + xsize, m_rect->y + m_rect->h, 0.0f, 0.0f, 255, 255, 255);
 		}
 		for (int y = 1; y < m_bitmap->h; y++) {
 			/*
@@ -616,31 +753,20 @@ void UIEditBitmap::drawGrid() {
 			glColor3ub(invertR, invertG, invertB);
 			*/
 
-			glColor3ub(255, 255, 255);
-
 			int ysize = y * m_rect->h / (m_bitmap->h);
-			glVertex2f(XNDC(m_rect->x), YNDC(m_rect->y + ysize));
-			glVertex2f(XNDC(m_rect->x + m_rect->w), YNDC(m_rect->y + ysize));
+			render_vertex(m_rect->x, m_rect->y + ysize, 0.0f, 0.0f, 255, 255, 255);
+			render_vertex(m_rect->x + m_rect->w, m_rect->y + ysize, 0.0f, 0.0f, 255, 255, 255);
 		}
-
-		glEnd();
-		glDisable(GL_LINE_SMOOTH);
 	} else if (m_gridMode == 2) {
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		glBegin(GL_POINTS);
-		glColor4ub(255, 255, 255, 127);
+		render_state(GL_POINTS, 0, true);
 
 		for (int x = 0; x < m_bitmap->w + 1; x++) {
 			for (int y = 0; y <  m_bitmap->h + 1; y++) {
 				int xsize = x * m_rect->w / (m_bitmap->w);
 				int ysize = y * m_rect->h / (m_bitmap->h);
-				glVertex2f(XNDC(m_rect->x + xsize), YNDC(m_rect->y + ysize));
+				render_vertex(m_rect->x + xsize, m_rect->y + ysize, 0.0f, 0.0f, 255, 255, 255, 127);
 			}
 		}
-
-		glEnd();
-		glDisable(GL_BLEND);
 	}
 }
 
@@ -651,57 +777,61 @@ void UIEditBitmap::drawPreview() {
 	int ybmapLast = (mouseYLast - m_rect->y) * m_bitmap->h / m_rect->h;
 	int xbmapStart = (m_mouseXStart - m_rect->x) * m_bitmap->w / m_rect->w;
 	int ybmapStart = (m_mouseYStart - m_rect->y) * m_bitmap->h / m_rect->h;
-
-	if ((m_pressing && m_selectedOp == OPERATION_LINE) || (m_hovering && m_selectedOp == OPERATION_FILLBUCKET)) {
-		memcpy(m_previewBitmap->image, m_bitmap->image, m_previewBitmap->w * m_previewBitmap->h * 3);
-
-		if (m_selectedOp == OPERATION_LINE)
-			bitmap_line(m_previewBitmap, xbmapStart, ybmapStart, xbmap, ybmap, m_selectedR, m_selectedG, m_selectedB);
-		else {
-			int idx = (ybmap * m_bitmap->w + xbmap) * 3;
-			unsigned char r = m_bitmap->image[idx];
-			unsigned char g = m_bitmap->image[idx + 1];
-			unsigned char b = m_bitmap->image[idx + 2];
-			recurseFill(m_previewBitmap, xbmap, ybmap, m_selectedR, m_selectedG, m_selectedB, r, g, b, false);
+	bool shapeOp = m_selectedOp == OPERATION_LINE || m_selectedOp == OPERATION_RECT || m_selectedOp == OPERATION_ELLIPSE;
+	bool brushOp = m_selectedOp == OPERATION_PENCIL || m_selectedOp == OPERATION_ERASER;
+
+	if (m_hovering && (m_selectedOp == OPERATION_FILLBUCKET || m_selectedOp == OPERATION_REPLACECOLOR)) {
+		// the mask's coverage is the texture alpha; the fill color comes from
+		// the vertex color, so the overlay matches the canvas blended with it
+		bitmap_fillmask_t* fillmask = &m_fillMask;
+		if (m_selectedOp == OPERATION_REPLACECOLOR) {
+			refreshReplaceMask(xbmap, ybmap);
+			fillmask = &m_replaceMask;
+		} else {
+			refreshFillMask(xbmap, ybmap);
 		}
+		if (!fillmask->valid || !fillmask->count || fillmask->mask.size() != (size_t)m_bitmap->w * m_bitmap->h)
+			return;
+
+		render_state(GL_TRIANGLES, m_maskTexture, true);
+		render_quad(m_rect->x, m_rect->y, m_rect->w, m_rect->h, m_selectedR, m_selectedG, m_selectedB, 127);
+	} else if ((m_pressing && shapeOp) || (m_hovering && !m_pressing && brushOp && m_brushWidth > 1)) {
+		// the canvas doesn't change mid-drag, so only last frame's shape needs
+		// putting back; a full copy only happens once the canvas has moved on
+		if (!m_previewSynced || m_previewGeneration != m_bitmap->generation) {
+			memcpy(m_previewBitmap->image, m_bitmap->image, (size_t)m_previewBitmap->w * m_previewBitmap->h * 3);
+			m_previewSynced = true;
+			m_previewGeneration = m_bitmap->generation;
+		} else if (m_previewW) {
+			bitmap_copy_rect(m_previewBitmap, m_bitmap, m_previewX, m_previewY, m_previewW, m_previewH);
+		}
+		bitmap_clear_dirty(m_previewBitmap);
+		if (shapeOp)
+			drawShape(m_previewBitmap, xbmapStart, ybmapStart, xbmap, ybmap, false);
+		else if (m_selectedOp == OPERATION_ERASER)
+			bitmap_brush_line(m_previewBitmap, xbmap, ybmap, xbmap, ybmap, m_brushWidth, m_brush, 0, 0, 0);
+		else
+			bitmap_brush_line(m_previewBitmap, xbmap, ybmap, xbmap, ybmap, m_brushWidth, m_brush, m_selectedR, m_selectedG, m_selectedB);
+		if (!bitmap_get_dirty(m_previewBitmap, &m_previewX, &m_previewY, &m_previewW, &m_previewH))
+			m_previewW = 0;
+
+		// the preview only differs from the canvas inside its dirty rectangle;
+		// uploading it over the canvas texture leaves that area stale, so mark
+		// it dirty on the canvas too and the next frame restores it
+		if (m_previewW)
+			bitmap_mark_dirty(m_bitmap, m_previewX, m_previewY, m_previewW, m_previewH);
 
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		updateTexture(m_previewBitmap);
-		glBindTexture(GL_TEXTURE_2D, m_texture);
-		glBegin(GL_TRIANGLE_FAN);
-		glColor4ub(255, 255, 255, 127);
-
-		glTexCoord2i(0, 0);
-		glVertex2f(XNDC(m_rect->x), YNDC(m_rect->y));
-		glTexCoord2i(0, 1);
-		glVertex2f(XNDC(m_rect->x), YNDC(m_rect->y + m_rect->h));
-		glTexCoord2i(1, 1);
-		glVertex2f(XNDC(m_rect->x + m_rect->w), YNDC(m_rect->y + m_rect->h));
-		glTexCoord2i(1, 0);
-		glVertex2f(XNDC(m_rect->x + m_rect->w), YNDC(m_rect->y));
-
-		glEnd();
-		glBindTexture(GL_TEXTURE_2D, 0);
-		glDisable(GL_BLEND);
+		render_state(GL_TRIANGLES, m_texture, true);
+		render_quad(m_rect->x, m_rect->y, m_rect->w, m_rect->h, 255, 255, 255, 127);
 	} else if (m_hovering) {
 		int xsize = m_rect->w / (m_bitmap->w - 1);
 		int ysize = m_rect->h / (m_bitmap->h - 1);
 		int x = m_rect->x + xbmap * m_rect->w / m_bitmap->w;
 		int y = m_rect->y + ybmap * m_rect->h / m_bitmap->h;
 
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		glBegin(GL_TRIANGLE_FAN);
-		glColor4ub(m_selectedR, m_selectedG, m_selectedB, 127);
-
-		glVertex2f(XNDC(x), YNDC(y));
-		glVertex2f(XNDC(x), YNDC(y + ysize));
-		glVertex2f(XNDC(x + xsize), YNDC(y + ysize));
-		glVertex2f(XNDC(x + xsize), YNDC(y));
-
-		glEnd();
-		glDisable(GL_BLEND);
+		render_state(GL_TRIANGLES, 0, true);
+		render_quad(x, y, xsize, ysize, m_selectedR, m_selectedG, m_selectedB, 127);
 	}
 }
 
@@ -801,6 +931,15 @@ void uiface_undo() {
 	currentScreen->undo();
 }
 
+void uiface_redo() {
+	currentScreen->redo();
+}
+
+// schedules another frame; safe to call from any thread
+void uiface_invalidate() {
+	scheduler_invalidate(gScheduler);
+}
+
 void uiface_set_tooltip(const char* text) {
 	strcpy_s(currentTooltip, 256, text);
 }
@@ -1,6 +1,7 @@
 #pragma once
 #include "bitmap.h"
 #include "text.h"
+#include "journal.h"
 #include <vector>
 #include <functional>
 
@@ -10,6 +11,9 @@
 #define MOUSE_XMB1      (1 << 3)
 #define MOUSE_XMB2      (1 << 4)
 
+// past this much history, older undo steps get compressed and then dropped
+#define UNDO_HISTORY_BUDGET (32 * 1024 * 1024)
+
 /* Rectangle */
 typedef struct rect_s {
 	int x, y;
@@ -59,6 +63,7 @@ public:
 	void addUIWidget(UIWidget* uiwidget);
 	void removeUIWidget(UIWidget* uiwidget);
 	void undo();
+	void redo();
 };
 
 class UIRect : public UIWidget {
@@ -135,14 +140,26 @@ enum UIEditBitmapOperation {
 	OPERATION_ERASER,
 	OPERATION_LINE,
 	OPERATION_EYEDROPPER,
-	OPERATION_FILLBUCKET
+	OPERATION_FILLBUCKET,
+	OPERATION_REPLACECOLOR,
+	OPERATION_RECT,
+	OPERATION_ELLIPSE
 };
 
 class UIEditBitmap : public UIRect {
 private:
 	bitmap_t* m_bitmap;
 	bitmap_t* m_previewBitmap;
+	bool m_previewSynced;
+	unsigned int m_previewGeneration;
+	int m_previewX, m_previewY, m_previewW, m_previewH;
 	unsigned int m_texture;
+	unsigned int m_maskTexture;
+	bitmap_fillmask_t m_fillMask;
+	bitmap_fillmask_t m_replaceMask;
+	bool m_maskShowsReplace;
+	flood_worker_t* m_floodWorker;
+	journal_t* m_journal;
 	UIEditBitmapOperation m_selectedOp;
 	unsigned char m_selectedR;
 	unsigned char m_selectedG;
@@ -152,6 +169,9 @@ private:
 	bool m_colorChanged;
 	unsigned char m_tolerance;
 	unsigned char m_gridMode;
+	int m_brush;
+	int m_brushWidth;
+	bool m_shapeFilled;
 
 public:
 	UIEditBitmap(int x, int y, int width, int height, int imageWidth, int imageHeight);
@@ -160,11 +180,15 @@ public:
 	void clear();
 	void reload(int width, int height, unsigned char* data);
 	void undo();
+	void redo();
 
 	void setDrawColor(unsigned char r, unsigned char g, unsigned char b);
 	void setDrawOperation(UIEditBitmapOperation op);
 	void setFillTolerance(unsigned char tolerance);
 	void setGridMode(unsigned char mode);
+	void setBrush(int brush, int width);
+	void setShapeFilled(bool filled);
+	void setJournal(journal_t* journal);
 	
 	void getDrawColor(unsigned char* r, unsigned char* g, unsigned char* b);
 	int getImageWidth();
@@ -172,14 +196,19 @@ public:
 	unsigned char* getImageData();
 	bool getColorChanged();
 	unsigned char getGridMode();
+	size_t getHistoryMemory();
 
 	virtual void update() override;
 	virtual void draw() override;
 
 private:
+	void endUndoBlock();
+	void drawShape(bitmap_t* bitmap, int x1, int y1, int x2, int y2, bool undo);
 	void regenTexture(bool first = false);
 	void updateTexture(bitmap_t* bitmap);
-	void recurseFill(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char matchR, unsigned char matchG, unsigned char matchB, bool undo = true);
+	void refreshFillMask(int x, int y);
+	void refreshReplaceMask(int x, int y);
+	void uploadMask(const bitmap_fillmask_t* fillmask);
 	void drawGrid();
 	void drawPreview();
 };
@@ -195,6 +224,8 @@ void uiface_mouse_buttons_down(int buttons);
 void uiface_mouse_buttons_up(int buttons);
 int uiface_get_mouse_buttons_down();
 void uiface_undo();
+void uiface_redo();
+void uiface_invalidate();
 void uiface_set_tooltip(const char* text);
 void uiface_smart_color_invert(unsigned char r, unsigned char g, unsigned char b, unsigned char* out_r, unsigned char* out_g, unsigned char* out_b);
 
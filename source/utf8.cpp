@@ -0,0 +1,42 @@
+#include "utf8.h"
+
+// decodes one UTF-8 sequence and steps past it; malformed bytes decode to
+// U+FFFD one at a time, so a stray byte never swallows the text after it
+unsigned int utf8_decode(const char** text) {
+	const unsigned char* str = (const unsigned char*)*text;
+	unsigned int ch = str[0];
+	int length = 1;
+	unsigned int min = 0;
+
+	if (ch >= 0xF0 && ch < 0xF8) {
+		length = 4;
+		ch &= 0x07;
+		min = 0x10000;
+	} else if (ch >= 0xE0) {
+		length = ch < 0xF0 ? 3 : 0;
+		ch &= 0x0F;
+		min = 0x800;
+	} else if (ch >= 0xC0) {
+		length = 2;
+		ch &= 0x1F;
+		min = 0x80;
+	} else if (ch >= 0x80) {
+		length = 0;
+	}
+
+	for (int i = 1; i < length; i++) {
+		if ((str[i] & 0xC0) != 0x80) {
+			length = 0;
+			break;
+		}
+		ch = (ch << 6) | (str[i] & 0x3F);
+	}
+
+	if (!length || ch < min || ch > 0x10FFFF || (ch >= 0xD800 && ch <= 0xDFFF)) {
+		*text += 1;
+		return 0xFFFD;
+	}
+
+	*text += length;
+	return ch;
+}
\ No newline at end of file
@@ -0,0 +1,4 @@
+#pragma once
+
+// kept apart from the font code so headless tools and tests can link it
+unsigned int utf8_decode(const char** text);
\ No newline at end of file
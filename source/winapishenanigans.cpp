@@ -1,6 +1,7 @@
 #include "winapishenanigans.h"
 #include "display.h"
 #include "uiface.h"
+#include "scheduler.h"
 
 LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
@@ -58,17 +59,28 @@ void winapi_show() {
 	ShowWindow(ghWnd, SW_SHOW);
 }
 
-bool winapi_run() {
+// sleeps until a message arrives or timeout (seconds) runs out, then drains
+// the queue; a negative timeout waits for as long as it takes
+bool winapi_run(double timeout) {
+	if (timeout != 0.0) {
+		DWORD millis = timeout < 0.0 ? INFINITE : (DWORD)(timeout * 1000.0);
+		MsgWaitForMultipleObjectsEx(0, nullptr, millis, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+	}
+
 	MSG msg = {0};
 	while (PeekMessageA(&msg, nullptr, 0, 0, PM_REMOVE)) {
 		TranslateMessage(&msg);
 		DispatchMessageA(&msg);
-		
 	}
 
 	return !quitProgram;
 }
 
+// thread-safe; just enough of a message to end the wait in winapi_run
+void winapi_wake() {
+	PostMessageA(ghWnd, WM_APP, 0, 0);
+}
+
 LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
 	TRACKMOUSEEVENT trackMouse = {0};
 	trackMouse.cbSize = sizeof(TRACKMOUSEEVENT);
@@ -76,6 +88,24 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 	trackMouse.hwndTrack = ghWnd;
 	trackMouse.dwHoverTime = HOVER_DEFAULT;
 
+	switch (uMsg) {
+		case WM_SIZE:
+		case WM_PAINT:
+		case WM_MOUSEMOVE:
+		case WM_MOUSELEAVE:
+		case WM_LBUTTONDOWN:
+		case WM_RBUTTONDOWN:
+		case WM_MBUTTONDOWN:
+		case WM_XBUTTONDOWN:
+		case WM_LBUTTONUP:
+		case WM_RBUTTONUP:
+		case WM_MBUTTONUP:
+		case WM_XBUTTONUP:
+		case WM_KEYDOWN:
+			scheduler_invalidate(gScheduler);
+			break;
+	}
+
 	switch (uMsg) {
 		case WM_CLOSE:
 			quitProgram = true;
@@ -138,8 +168,12 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 			return 0;
 
 		case WM_KEYDOWN:
-			if (wParam == 'Z' && GetKeyState(VK_CONTROL))
+			if (wParam == 'Z' && (GetKeyState(VK_CONTROL) & 0x8000) && (GetKeyState(VK_SHIFT) & 0x8000))
+				uiface_redo();
+			else if (wParam == 'Z' && (GetKeyState(VK_CONTROL) & 0x8000))
 				uiface_undo();
+			else if (wParam == 'Y' && (GetKeyState(VK_CONTROL) & 0x8000))
+				uiface_redo();
 	}
 
 	return DefWindowProcA(hWnd, uMsg, wParam, lParam);
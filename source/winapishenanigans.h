@@ -7,4 +7,5 @@
 void winapi_initialize();
 void winapi_shutdown();
 void winapi_show();
-bool winapi_run();
\ No newline at end of file
+bool winapi_run(double timeout);
+void winapi_wake();
\ No newline at end of file
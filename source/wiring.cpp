@@ -0,0 +1,112 @@
+#include "wiring.h"
+
+// rows snaking back and forth, the first one right to left
+wiring_layout_t wiring_default_layout() {
+	wiring_layout_t layout;
+	layout.order = WIRING_ROWS;
+	layout.serpentine = true;
+	layout.startReversed = true;
+	layout.panelsX = 1;
+	layout.panelsY = 1;
+	layout.panelSerpentine = false;
+	layout.rotation = 0;
+	return layout;
+}
+
+// walks the strip once so exporters can gather in a single linear pass;
+// returns nullptr when the panels don't evenly divide the image
+wiring_map_t* wiring_compile(const wiring_layout_t* layout, int width, int height) {
+	int rotation = ((layout->rotation % 360) + 360) % 360;
+	if (rotation % 90 || width <= 0 || height <= 0 || layout->panelsX <= 0 || layout->panelsY <= 0)
+		return nullptr;
+
+	// the layout is described in the mount's frame, which is the image turned
+	bool sideways = rotation == 90 || rotation == 270;
+	int frameW = sideways ? height : width;
+	int frameH = sideways ? width : height;
+	if (frameW % layout->panelsX || frameH % layout->panelsY)
+		return nullptr;
+
+	int panelW = frameW / layout->panelsX;
+	int panelH = frameH / layout->panelsY;
+	int panelSize = panelW * panelH;
+	bool rows = layout->order == WIRING_ROWS;
+
+	wiring_map_t* map = new wiring_map_t();
+	map->width = width;
+	map->height = height;
+	map->lineLength = rows ? panelW : panelH;
+	map->lut.resize((size_t)width * height);
+
+	for (size_t i = 0; i < map->lut.size(); i++) {
+		int panel = i / panelSize;
+		int local = i % panelSize;
+		int panelRow = panel / layout->panelsX;
+		int panelCol = panel % layout->panelsX;
+		if (layout->panelSerpentine && (panelRow & 1))
+			panelCol = layout->panelsX - 1 - panelCol;
+
+		int line = local / map->lineLength;
+		int pos = local % map->lineLength;
+		bool reverse = layout->startReversed != (layout->serpentine && (line & 1));
+		if (reverse)
+			pos = map->lineLength - 1 - pos;
+
+		int u = panelCol * panelW + (rows ? pos : line);
+		int v = panelRow * panelH + (rows ? line : pos);
+
+		int x, y;
+		switch (rotation) {
+			case 90:
+				x = v;
+				y = height - 1 - u;
+				break;
+			case 180:
+				x = width - 1 - u;
+				y = height - 1 - v;
+				break;
+			case 270:
+				x = width - 1 - v;
+				y = u;
+				break;
+			default:
+				x = u;
+				y = v;
+				break;
+		}
+
+		map->lut[i] = (unsigned int)y * width + x;
+	}
+
+	return map;
+}
+
+void destroy_wiring_map(wiring_map_t* map) {
+	delete map;
+}
+
+/* Wiring Presets: the layouts selectable from the editor */
+typedef struct wiring_preset_s {
+	const char* name;
+	wiring_layout_t layout;
+} wiring_preset_t;
+
+static const wiring_preset_t presets[] = {
+	{"Row Snake", {WIRING_ROWS, true, true, 1, 1, false, 0}},
+	{"Rows", {WIRING_ROWS, false, false, 1, 1, false, 0}},
+	{"Column Snake", {WIRING_COLUMNS, true, false, 1, 1, false, 0}},
+	{"Columns", {WIRING_COLUMNS, false, false, 1, 1, false, 0}},
+	{"Row Snake 180", {WIRING_ROWS, true, true, 1, 1, false, 180}}
+};
+
+int wiring_preset_count() {
+	return sizeof(presets) / sizeof(presets[0]);
+}
+
+wiring_layout_t wiring_preset(int preset) {
+	return presets[preset].layout;
+}
+
+const char* wiring_preset_name(int preset) {
+	return presets[preset].name;
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+enum wiring_order_e {
+	WIRING_ROWS,
+	WIRING_COLUMNS
+};
+
+/* Wiring Layout: how a strip runs through the image. the image is split into
+   a grid of equally sized panels chained row by row; inside each panel the
+   strip runs along rows or columns, optionally snaking back and forth.
+   rotation is how far the whole mount is turned clockwise, in degrees */
+typedef struct wiring_layout_s {
+	int order;
+	bool serpentine;
+	bool startReversed;
+	int panelsX, panelsY;
+	bool panelSerpentine;
+	int rotation;
+} wiring_layout_t;
+
+/* Wiring Map: lut[i] is the index of the pixel driven by LED i. lines are the
+   straight runs of the strip, which exporters put one per line of text */
+typedef struct wiring_map_s {
+	int width, height;
+	int lineLength;
+	std::vector<unsigned int> lut;
+} wiring_map_t;
+
+wiring_layout_t wiring_default_layout();
+wiring_map_t* wiring_compile(const wiring_layout_t* layout, int width, int height);
+void destroy_wiring_map(wiring_map_t* map);
+
+int wiring_preset_count();
+wiring_layout_t wiring_preset(int preset);
+const char* wiring_preset_name(int preset);
\ No newline at end of file
@@ -0,0 +1,260 @@
+#include "reference.h"
+#include "../source/bitmap.h"
+#include "../source/ledfile.h"
+#include "../source/exporter.h"
+#include "../source/wiring.h"
+#include "../source/colorout.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+/* Benchmark */
+typedef struct bench_case_s {
+	const char* name;
+	void (*func)();
+} bench_case_t;
+
+// keeps results alive so the optimizer can't drop the work being timed
+static volatile size_t benchSink;
+
+// runs func until at least a quarter second has passed and returns the
+// average time of one run in microseconds
+static double time_us(const std::function<void()>& func) {
+	using clock = std::chrono::steady_clock;
+	func();
+	int runs = 0;
+	clock::time_point start = clock::now();
+	double elapsed;
+	do {
+		func();
+		runs++;
+		elapsed = std::chrono::duration<double, std::micro>(clock::now() - start).count();
+	} while (elapsed < 250000.0);
+	return elapsed / runs;
+}
+
+static void report(const char* what, double oldUs, double newUs) {
+	printf("  %-28s old %12.1f us  new %12.1f us  %6.2fx\n", what, oldUs, newUs, oldUs / newUs);
+}
+
+static std::vector<unsigned char> random_image(int width, int height) {
+	std::vector<unsigned char> image((size_t)width * height * 3);
+	for (unsigned char& value : image)
+		value = rand() & 255;
+	return image;
+}
+
+// scatters small blocks of color over a canvas, the way LED art is mostly
+// flat runs with some detail
+static void scatter_blocks(bitmap_t* bitmap, int count, int size) {
+	for (int i = 0; i < count; i++) {
+		int x = rand() % bitmap->w, y = rand() % bitmap->h;
+		unsigned char r = rand() & 255, g = rand() & 255, b = rand() & 255;
+		for (int row = y; row < std::min(y + size, bitmap->h); row++)
+			bitmap_span(bitmap, x, row, std::min(size, bitmap->w - x), r, g, b);
+	}
+}
+
+// fills the background of a canvas scattered with small blocks, alternating
+// between two colors so every run has the whole region to repaint
+static void flood_bench() {
+	static const int sizes[] = {16, 64, 256, 4096};
+	for (int size : sizes) {
+		bitmap_t* bitmap = create_bitmap(size, size);
+		bitmap_fill(bitmap, 0, 0, 0);
+		scatter_blocks(bitmap, size * size / 256, 4);
+		bitmap_pixel(bitmap, 0, 0, 0, 0, 0);
+
+		unsigned char color = 0;
+		auto fill = [&](bool recursive) {
+			unsigned char next = color ^ 1;
+			bitmap_start_undo_block(bitmap);
+			if (recursive)
+				reference_recurse_fill(bitmap, 0, 0, next, next, next, color, color, color, 0, true);
+			else
+				bitmap_flood_fill(bitmap, 0, 0, next, next, next, 0, true);
+			bitmap_end_undo_block(bitmap);
+			bitmap_clear_undo_blocks(bitmap);
+			color = next;
+		};
+
+		char what[64];
+		snprintf(what, sizeof(what), "fill %dx%d", size, size);
+		double newUs = time_us([&] { fill(false); });
+		// the recursive fill is one stack frame per pixel, which the larger
+		// canvases don't have room for
+		if (size <= 64)
+			report(what, time_us([&] { fill(true); }), newUs);
+		else
+			printf("  %-28s old   (overflows)    new %12.1f us\n", what, newUs);
+		destroy_bitmap(bitmap);
+	}
+}
+
+// v1 stored the raw RGB; v2 checksums it and packs it, falling back to raw
+// when packing doesn't pay, the way the save path does. sizes include the
+// header and chunk framing of each version
+static void ledfile_bench() {
+	static const int sizes[][2] = {{256, 128}, {1024, 1024}};
+	for (const int* size : sizes) {
+		for (int noisy = 0; noisy < 2; noisy++) {
+			bitmap_t* bitmap = create_bitmap(size[0], size[1]);
+			bitmap_fill(bitmap, 0, 0, 40);
+			if (noisy) {
+				for (int i = 0; i < size[0] * size[1] * 3; i++)
+					bitmap->image[i] = rand() & 255;
+			} else {
+				scatter_blocks(bitmap, 64, 48);
+			}
+
+			size_t count = (size_t)size[0] * size[1];
+			size_t rawSize = count * 3;
+			std::vector<unsigned char> payload, unpacked(rawSize);
+			bool packed = false;
+			auto encode = [&] {
+				payload.resize(sizeof(uint32_t));
+				uint32_t checksum = ledfile_checksum(bitmap->image, rawSize);
+				memcpy(payload.data(), &checksum, sizeof(uint32_t));
+				ledfile_rle_encode(bitmap->image, count, payload);
+				packed = payload.size() - sizeof(uint32_t) < rawSize;
+				if (!packed) {
+					payload.resize(sizeof(uint32_t));
+					payload.insert(payload.end(), bitmap->image, bitmap->image + rawSize);
+				}
+			};
+			auto decode = [&] {
+				const unsigned char* data = payload.data() + sizeof(uint32_t);
+				if (packed)
+					ledfile_rle_decode(data, payload.size() - sizeof(uint32_t), unpacked.data(), count);
+				else
+					memcpy(unpacked.data(), data, rawSize);
+				benchSink = ledfile_checksum(unpacked.data(), rawSize);
+			};
+
+			double newEncode = time_us(encode);
+			double newDecode = time_us(decode);
+			double oldEncode = time_us([&] { payload.assign(bitmap->image, bitmap->image + rawSize); benchSink = payload[0]; });
+			double oldDecode = time_us([&] { memcpy(unpacked.data(), payload.data(), rawSize); benchSink = unpacked[0]; });
+			encode();
+
+			char what[64];
+			snprintf(what, sizeof(what), "%s %dx%d", noisy ? "noise" : "flat", size[0], size[1]);
+			size_t oldSize = 20 + rawSize;
+			size_t newSize = 12 + 16 + 8 + payload.size() + 8;
+			printf("  %-28s v1 %12zu bytes  v2 %12zu bytes\n", what, oldSize, newSize);
+			report("  encode", oldEncode, newEncode);
+			report("  decode", oldDecode, newDecode);
+			destroy_bitmap(bitmap);
+		}
+	}
+}
+
+static void exporter_bench() {
+	static const int sizes[][2] = {{16, 16}, {128, 64}, {512, 256}};
+	wiring_layout_t layout = wiring_default_layout();
+	for (const int* size : sizes) {
+		std::vector<unsigned char> image = random_image(size[0], size[1]);
+		wiring_map_t* map = wiring_compile(&layout, size[0], size[1]);
+		std::vector<char> out(exporter_array1d_size(map, image.data()) + EXPORTER_SLACK);
+
+		double oldUs = time_us([&] { benchSink = reference_array1d(size[0], size[1], image.data()).size(); });
+		double newUs = time_us([&] { benchSink = exporter_array1d_write(map, image.data(), out.data()); });
+		char what[64];
+		snprintf(what, sizeof(what), "array1d %dx%d", size[0], size[1]);
+		report(what, oldUs, newUs);
+		destroy_wiring_map(map);
+	}
+}
+
+// WS2812 order with a brightness cap, with a gamma curve (table kernel) and
+// without (vector kernel), against the same transform computed per pixel
+static void colorout_bench() {
+	static const int sizes[][2] = {{128, 64}, {1024, 1024}, {4096, 2048}};
+	static const struct {
+		const char* name;
+		float gamma[3];
+	} curves[] = {
+		{"gamma", {2.2f, 2.2f, 2.8f}},
+		{"linear", {1.0f, 1.0f, 1.0f}}
+	};
+	for (const auto& curve : curves) {
+		colorout_t transform;
+		colorout_build(&transform, COLOROUT_GRB, curve.gamma, 0.5f);
+		for (const int* size : sizes) {
+			size_t count = (size_t)size[0] * size[1];
+			std::vector<unsigned char> src = random_image(size[0], size[1]);
+			std::vector<unsigned char> dst(count * 3);
+
+			double oldUs = time_us([&] { reference_colorout(COLOROUT_GRB, curve.gamma, 0.5f, src.data(), dst.data(), count); benchSink = dst[0]; });
+			double newUs = time_us([&] { colorout_apply(&transform, src.data(), dst.data(), count); benchSink = dst[0]; });
+			char what[64];
+			snprintf(what, sizeof(what), "%s %dx%d (%.0f MB/s)", curve.name, size[0], size[1], count * 3 / newUs);
+			report(what, oldUs, newUs);
+		}
+	}
+}
+
+// one undoable stroke per run on a 256x256 canvas, the way a drag commits it
+static void line_bench() {
+	static const struct {
+		const char* name;
+		int x1, y1, x2, y2;
+	} lines[] = {
+		{"diagonal", -20, 10, 300, 200},
+		{"horizontal", 0, 100, 255, 100},
+		{"vertical", 100, 0, 100, 255},
+		{"mostly off-canvas", -40000, -30000, 40000, 128}
+	};
+
+	bitmap_t* bitmap = create_bitmap(256, 256);
+	for (const auto& line : lines) {
+		auto stroke = [&](bool old) {
+			bitmap_start_undo_block(bitmap);
+			if (old)
+				reference_line(bitmap, line.x1, line.y1, line.x2, line.y2, 255, 0, 0, true);
+			else
+				bitmap_line(bitmap, line.x1, line.y1, line.x2, line.y2, 255, 0, 0, true);
+			bitmap_end_undo_block(bitmap);
+			bitmap_clear_undo_blocks(bitmap);
+		};
+		report(line.name, time_us([&] { stroke(true); }), time_us([&] { stroke(false); }));
+	}
+	destroy_bitmap(bitmap);
+}
+
+static const bench_case_t benchCases[] = {
+	{"flood", flood_bench},
+	{"ledfile", ledfile_bench},
+	{"exporter", exporter_bench},
+	{"colorout", colorout_bench},
+	{"line", line_bench}
+};
+
+// runs every benchmark, or just the ones named on the command line
+int main(int argc, char** argv) {
+	srand(1);
+	int ran = 0;
+	for (const bench_case_t& bench : benchCases) {
+		bool wanted = argc < 2;
+		for (int i = 1; i < argc; i++)
+			wanted |= !strcmp(argv[i], bench.name);
+		if (!wanted)
+			continue;
+
+		printf("%s:\n", bench.name);
+		bench.func();
+		ran++;
+	}
+
+	if (!ran) {
+		fprintf(stderr, "no such benchmark\n");
+		return 1;
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,336 @@
+#include "test.h"
+#include "reference.h"
+#include "../source/bitmap.h"
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+static bool same_image(bitmap_t* a, bitmap_t* b) {
+	return a->w == b->w && a->h == b->h && !memcmp(a->image, b->image, (size_t)a->w * a->h * 3);
+}
+
+static std::vector<unsigned char> image_of(bitmap_t* bitmap) {
+	return std::vector<unsigned char>(bitmap->image, bitmap->image + (size_t)bitmap->w * bitmap->h * 3);
+}
+
+// one random undoable stroke, often running off the canvas; returns whether
+// it left a new block on the undo stack
+static bool random_edit(bitmap_t* bitmap) {
+	unsigned int last = bitmap->undo_blocks.empty() ? 0 : bitmap->undo_blocks.back()->id;
+	int x1 = rand() % (bitmap->w + 40) - 20, y1 = rand() % (bitmap->h + 40) - 20;
+	int x2 = rand() % (bitmap->w + 40) - 20, y2 = rand() % (bitmap->h + 40) - 20;
+	unsigned char r = rand() % 4 * 80, g = rand() % 4 * 80, b = rand() % 4 * 80;
+
+	bitmap_start_undo_block(bitmap);
+	switch (rand() % 4) {
+	case 0:
+		bitmap_line(bitmap, x1, y1, x2, y2, r, g, b, true);
+		break;
+	case 1:
+		bitmap_brush_line(bitmap, x1, y1, x2, y2, 1 + rand() % 9, rand() % 2 ? BITMAP_BRUSH_ROUND : BITMAP_BRUSH_SQUARE, r, g, b, true);
+		break;
+	case 2:
+		bitmap_rect(bitmap, x1, y1, x2, y2, rand() % 2, r, g, b, true);
+		break;
+	default:
+		bitmap_flood_fill(bitmap, rand() % bitmap->w, rand() % bitmap->h, r, g, b, rand() % 40, true);
+		break;
+	}
+	bitmap_end_undo_block(bitmap);
+	return !bitmap->undo_blocks.empty() && bitmap->undo_blocks.back()->id != last;
+}
+
+// the scanline fill has to paint exactly what the recursive one did, for
+// every tolerance, and undo back to where it started
+static void flood_matches_recursive() {
+	srand(1);
+	for (int i = 0; i < 300; i++) {
+		int width = 1 + rand() % 40, height = 1 + rand() % 40;
+		bitmap_t* scanline = create_bitmap(width, height);
+		bitmap_t* recursive = create_bitmap(width, height);
+		for (int j = 0; j < width * height * 3; j++)
+			scanline->image[j] = recursive->image[j] = (rand() % 3) * 20;
+		std::vector<unsigned char> before(scanline->image, scanline->image + width * height * 3);
+
+		int x = rand() % width, y = rand() % height;
+		int tolerance = rand() % 30;
+		unsigned char* match = &recursive->image[(y * width + x) * 3];
+		reference_recurse_fill(recursive, x, y, 200, 100, 50, match[0], match[1], match[2], tolerance);
+
+		bitmap_start_undo_block(scanline);
+		bitmap_flood_fill(scanline, x, y, 200, 100, 50, tolerance, true);
+		bitmap_end_undo_block(scanline);
+		CHECK(same_image(scanline, recursive));
+
+		if (!scanline->undo_blocks.empty())
+			bitmap_pop_undo_block(scanline);
+		CHECK(!memcmp(scanline->image, before.data(), before.size()));
+
+		destroy_bitmap(scanline);
+		destroy_bitmap(recursive);
+	}
+}
+
+// clipped lines have to land on the same pixels the full Bresenham walk did,
+// including segments that start or end far off the canvas
+static void line_matches_reference() {
+	srand(24);
+	for (int i = 0; i < 3000; i++) {
+		int width = 1 + rand() % 30, height = 1 + rand() % 30;
+		bitmap_t* clipped = create_bitmap(width, height);
+		bitmap_t* walked = create_bitmap(width, height);
+		bitmap_fill(clipped, 0, 0, 0);
+		bitmap_fill(walked, 0, 0, 0);
+
+		int range = rand() % 4 ? 60 : 4000;
+		int x1 = rand() % range - range / 2, y1 = rand() % range - range / 2;
+		int x2 = rand() % range - range / 2, y2 = rand() % range - range / 2;
+		if (rand() % 4 == 0)
+			y2 = y1;
+		else if (rand() % 4 == 0)
+			x2 = x1;
+
+		reference_line(walked, x1, y1, x2, y2, 255, 255, 255);
+		bitmap_start_undo_block(clipped);
+		bitmap_line(clipped, x1, y1, x2, y2, 255, 255, 255, true);
+		bitmap_end_undo_block(clipped);
+		CHECK(same_image(clipped, walked));
+
+		if (!clipped->undo_blocks.empty())
+			bitmap_pop_undo_block(clipped);
+		bitmap_fill(walked, 0, 0, 0);
+		CHECK(same_image(clipped, walked));
+
+		destroy_bitmap(clipped);
+		destroy_bitmap(walked);
+	}
+}
+// whether a pixel is in the ellipse filling the box, from its distance to the
+// middle alone; rows too narrow to reach a pixel center keep the middle one
+// or two, and the middle row or pair of rows spans the whole box
+static bool in_ellipse(int x, int y, int x1, int y1, int x2, int y2) {
+	if (x < x1 || x > x2 || y < y1 || y > y2)
+		return false;
+	double cx = (x1 + x2) / 2.0, cy = (y1 + y2) / 2.0;
+	double t = fabs(y - cy) <= 0.5 ? 0.0 : (y - cy) / ((y2 - y1 + 1) / 2.0);
+	double half = (x2 - x1 + 1) / 2.0 * sqrt(std::max(1.0 - t * t, 0.0));
+	return fabs(x - cx) <= std::max(half, cx - floor(cx));
+}
+
+// the shapes drawn one pixel at a time: a brush line is the plain line moved
+// to every offset inside the brush, a rectangle is its box or border, and an
+// outlined ellipse keeps the ends of each row and the pixels the rows above
+// and below don't both cover
+static void reference_shape(bitmap_t* bitmap, int shape, int x1, int y1, int x2, int y2, int width, int brush, bool filled) {
+	if (shape == 0) {
+		int lo = -(width / 2), hi = (width - 1) / 2;
+		double middle = (lo + hi) / 2.0, radius = width / 2.0 - 0.25;
+		for (int dy = lo; dy <= hi; dy++) {
+			for (int dx = lo; dx <= hi; dx++) {
+				if (brush == BITMAP_BRUSH_SQUARE || (dx - middle) * (dx - middle) + (dy - middle) * (dy - middle) <= radius * radius)
+					reference_line(bitmap, x1 + dx, y1 + dy, x2 + dx, y2 + dy, 255, 255, 255);
+			}
+		}
+		return;
+	}
+
+	if (x1 > x2)
+		std::swap(x1, x2);
+	if (y1 > y2)
+		std::swap(y1, y2);
+	for (int y = 0; y < bitmap->h; y++) {
+		for (int x = 0; x < bitmap->w; x++) {
+			bool on;
+			if (shape == 1)
+				on = x >= x1 && x <= x2 && y >= y1 && y <= y2 && (filled || x == x1 || x == x2 || y == y1 || y == y2);
+			else
+				on = in_ellipse(x, y, x1, y1, x2, y2) && (filled || !in_ellipse(x - 1, y, x1, y1, x2, y2) || !in_ellipse(x + 1, y, x1, y1, x2, y2) ||
+					!in_ellipse(x, y - 1, x1, y1, x2, y2) || !in_ellipse(x, y + 1, x1, y1, x2, y2));
+			if (on)
+				bitmap_pixel(bitmap, x, y, 255, 255, 255);
+		}
+	}
+}
+
+// brush lines, rectangles and ellipses have to cover what drawing them one
+// pixel at a time does, clipped or not, and undo back to the canvas under them
+static void shapes_match_reference() {
+	srand(25);
+	for (int i = 0; i < 2000; i++) {
+		int width = 1 + rand() % 30, height = 1 + rand() % 30;
+		bitmap_t* spans = create_bitmap(width, height);
+		bitmap_t* pixels = create_bitmap(width, height);
+		for (int j = 0; j < width * height * 3; j++)
+			spans->image[j] = pixels->image[j] = rand() % 2 * 100;
+		std::vector<unsigned char> before = image_of(spans);
+
+		int range = rand() % 8 ? 60 : 1000;
+		int x1 = rand() % range - range / 2 + width / 2, y1 = rand() % range - range / 2 + height / 2;
+		int x2 = rand() % range - range / 2 + width / 2, y2 = rand() % range - range / 2 + height / 2;
+		int shape = rand() % 3, brushWidth = 1 + rand() % 9;
+		int brush = rand() % 2 ? BITMAP_BRUSH_ROUND : BITMAP_BRUSH_SQUARE;
+		bool filled = rand() % 2;
+
+		reference_shape(pixels, shape, x1, y1, x2, y2, brushWidth, brush, filled);
+		bitmap_start_undo_block(spans);
+		if (shape == 0)
+			bitmap_brush_line(spans, x1, y1, x2, y2, brushWidth, brush, 255, 255, 255, true);
+		else if (shape == 1)
+			bitmap_rect(spans, x1, y1, x2, y2, filled, 255, 255, 255, true);
+		else
+			bitmap_ellipse(spans, x1, y1, x2, y2, filled, 255, 255, 255, true);
+		bitmap_end_undo_block(spans);
+		CHECK(same_image(spans, pixels));
+
+		if (!spans->undo_blocks.empty())
+			bitmap_pop_undo_block(spans);
+		CHECK(image_of(spans) == before);
+
+		destroy_bitmap(spans);
+		destroy_bitmap(pixels);
+	}
+}
+
+
+// every pixel within tolerance of the seed changes, wherever it is, unless
+// the new color already matches the seed
+static void replace_color() {
+	srand(21);
+	for (int i = 0; i < 200; i++) {
+		int width = 1 + rand() % 40, height = 1 + rand() % 40;
+		int tolerance = rand() % 30;
+		bitmap_t* bitmap = create_bitmap(width, height);
+		for (int j = 0; j < width * height * 3; j++)
+			bitmap->image[j] = (rand() % 3) * 20;
+		std::vector<unsigned char> before(bitmap->image, bitmap->image + width * height * 3);
+
+		int x = rand() % width, y = rand() % height;
+		const unsigned char* seed = &before[(y * width + x) * 3];
+		unsigned char color = rand() % 2 ? seed[0] + tolerance / 2 : 200;
+		bool noop = bitmap_match_color(bitmap, x, y, color, color, color, tolerance);
+
+		bitmap_start_undo_block(bitmap);
+		int count = bitmap_replace_color(bitmap, x, y, color, color, color, tolerance, true);
+		bitmap_end_undo_block(bitmap);
+
+		int expected = 0;
+		for (int j = 0; j < width * height; j++) {
+			const unsigned char* pixel = &before[j * 3];
+			bool match = !noop && abs(pixel[0] - seed[0]) <= tolerance && abs(pixel[1] - seed[1]) <= tolerance && abs(pixel[2] - seed[2]) <= tolerance;
+			expected += match;
+			for (int c = 0; c < 3; c++)
+				CHECK(bitmap->image[j * 3 + c] == (match ? color : pixel[c]));
+		}
+		CHECK(count == expected);
+		CHECK(bitmap->undo_blocks.empty() == noop);
+
+		destroy_bitmap(bitmap);
+	}
+}
+
+// tiled undo has to step back through every stroke on a big canvas to the
+// image it started from, then redo forward to the same final image
+static void tiled_undo_roundtrip() {
+	srand(22);
+	bitmap_t* bitmap = create_bitmap(300, 260);
+	bitmap_set_tiled_undo(bitmap, true);
+	bitmap_fill(bitmap, 40, 40, 40);
+	for (int i = 0; i < 20; i++)
+		bitmap_rect(bitmap, rand() % 300, rand() % 260, rand() % 300, rand() % 260, true, rand() & 255, rand() & 255, rand() & 255);
+
+	std::vector<std::vector<unsigned char>> images = {image_of(bitmap)};
+	for (int i = 0; i < 60; i++) {
+		if (random_edit(bitmap))
+			images.push_back(image_of(bitmap));
+	}
+	CHECK(bitmap->undo_blocks.size() == images.size() - 1);
+	for (bitmap_undo_block_t* undo_block : bitmap->undo_blocks)
+		CHECK(undo_block->spans.empty() && !undo_block->tiles.empty());
+
+	for (size_t i = images.size() - 1; i > 0; i--) {
+		bitmap_pop_undo_block(bitmap);
+		CHECK(image_of(bitmap) == images[i - 1]);
+	}
+	CHECK(bitmap->undo_blocks.empty());
+	for (size_t i = 1; i < images.size(); i++) {
+		bitmap_pop_redo_block(bitmap);
+		CHECK(image_of(bitmap) == images[i]);
+	}
+	CHECK(bitmap->redo_blocks.empty());
+
+	destroy_bitmap(bitmap);
+}
+
+// polls the compressor until the history fits its budget, or is down to the
+// one undo step that always survives; false if it never gets there
+static bool settle_history(bitmap_t* bitmap) {
+	for (int i = 0; i < 5000; i++) {
+		bitmap_history_poll(bitmap);
+		if (bitmap_undo_memory(bitmap) <= bitmap->undo_budget || (bitmap->undo_blocks.size() <= 1 && bitmap->redo_blocks.empty()))
+			return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return false;
+}
+
+// a small budget compresses the older blocks and drops what still doesn't
+// fit, but every step left has to undo and redo to the image it was made on,
+// packed or not. a new stroke after undoing throws the redo steps away
+static void undo_budget() {
+	srand(23);
+	for (int tiled = 0; tiled < 2; tiled++) {
+		int size = tiled ? 256 : 64;
+		bitmap_t* bitmap = create_bitmap(size, size);
+		bitmap_set_tiled_undo(bitmap, tiled);
+		bitmap_fill(bitmap, 40, 40, 40);
+		bitmap_set_undo_budget(bitmap, tiled ? 1024 * 1024 : 48 * 1024);
+
+		std::vector<std::vector<unsigned char>> images = {image_of(bitmap)};
+		for (int i = 0; i < 80; i++) {
+			if (random_edit(bitmap))
+				images.push_back(image_of(bitmap));
+			CHECK(settle_history(bitmap));
+		}
+		int packed = 0;
+		for (bitmap_undo_block_t* undo_block : bitmap->undo_blocks)
+			packed += !undo_block->packed.empty();
+		CHECK(packed > 0);
+
+		size_t at = images.size() - 1;
+		while (!bitmap->undo_blocks.empty()) {
+			bitmap_pop_undo_block(bitmap);
+			at--;
+			CHECK(image_of(bitmap) == images[at]);
+		}
+		CHECK(settle_history(bitmap));
+		while (!bitmap->redo_blocks.empty()) {
+			bitmap_pop_redo_block(bitmap);
+			at++;
+			CHECK(image_of(bitmap) == images[at]);
+		}
+
+		for (int i = 0; i < 3; i++)
+			bitmap_pop_undo_block(bitmap);
+		CHECK(!bitmap->redo_blocks.empty());
+		while (!random_edit(bitmap))
+			;
+		CHECK(bitmap->redo_blocks.empty());
+		std::vector<unsigned char> edited = image_of(bitmap);
+		bitmap_pop_redo_block(bitmap);
+		CHECK(image_of(bitmap) == edited);
+
+		destroy_bitmap(bitmap);
+	}
+}
+
+void bitmap_tests() {
+	flood_matches_recursive();
+	line_matches_reference();
+	replace_color();
+	tiled_undo_roundtrip();
+	undo_budget();
+	shapes_match_reference();
+}
\ No newline at end of file
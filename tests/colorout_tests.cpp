@@ -0,0 +1,64 @@
+#include "test.h"
+#include "reference.h"
+#include "../source/colorout.h"
+#include <algorithm>
+#include <cstdlib>
+
+// the tables and the unrolled kernel have to give what computing every pixel
+// directly would, for every order, odd lengths and in place
+static void apply_matches_reference() {
+	srand(16);
+	for (int i = 0; i < 200; i++) {
+		int order = rand() % COLOROUT_ORDER_COUNT;
+		float gamma[3];
+		for (float& value : gamma)
+			value = rand() % 2 ? 1.0f : 0.5f + (rand() % 300) / 100.0f;
+		float brightness = rand() % 3 ? (rand() % 101) / 100.0f : 1.0f;
+		colorout_t transform;
+		colorout_build(&transform, order, gamma, brightness);
+
+		size_t count = rand() % 50;
+		std::vector<unsigned char> src(count * 3 + 1), expected(count * 3 + 1), out(count * 3 + 1);
+		for (unsigned char& value : src)
+			value = rand() & 255;
+		reference_colorout(order, gamma, brightness, src.data(), expected.data(), count);
+
+		colorout_apply(&transform, src.data(), out.data(), count);
+		CHECK(std::equal(out.begin(), out.begin() + count * 3, expected.begin()));
+		colorout_apply(&transform, src.data(), src.data(), count);
+		CHECK(std::equal(src.begin(), src.begin() + count * 3, expected.begin()));
+	}
+}
+
+// without gamma the vector kernel reorders and scales; it has to agree with
+// the per-pixel transform at every order and length, including the pixels
+// left over after the last full register and runs done in place
+static void linear_matches_reference() {
+	srand(1616);
+	const float gamma[3] = {1.0f, 1.0f, 1.0f};
+	for (int order = 0; order < COLOROUT_ORDER_COUNT; order++) {
+		for (int i = 0; i < 40; i++) {
+			float brightness = i < 2 ? i * 0.5f + 0.5f : (rand() % 1001) / 1000.0f;
+			colorout_t transform;
+			colorout_build(&transform, order, gamma, brightness);
+			if (i < 2)
+				CHECK(transform.linear);
+
+			size_t count = rand() % 120;
+			std::vector<unsigned char> src(count * 3), expected(count * 3), out(count * 3);
+			for (unsigned char& value : src)
+				value = rand() & 255;
+			reference_colorout(order, gamma, brightness, src.data(), expected.data(), count);
+
+			colorout_apply(&transform, src.data(), out.data(), count);
+			CHECK(out == expected);
+			colorout_apply(&transform, src.data(), src.data(), count);
+			CHECK(src == expected);
+		}
+	}
+}
+
+void colorout_tests() {
+	apply_matches_reference();
+	linear_matches_reference();
+}
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "test.h"
+#include "../source/exporter.h"
+#include "../source/wiring.h"
+#include "reference.h"
+#include <cstring>
+#include <cstdlib>
+
+// runs a writer into a buffer with the slack it's allowed, checking the size
+// it promised up front
+template <typename Size, typename Write>
+static std::string export_text(Size size, Write write) {
+	size_t expected = size();
+	std::vector<char> out(expected + EXPORTER_SLACK);
+	size_t written = write(out.data());
+	CHECK(written == expected);
+	return std::string(out.data(), written);
+}
+
+static void golden_arrays() {
+	srand(13);
+	wiring_layout_t layout = wiring_default_layout();
+	for (int height = 1; height < 20; height++) {
+		for (int width = 1; width < 20; width++) {
+			std::vector<unsigned char> image((size_t)width * height * 3);
+			for (unsigned char& value : image)
+				value = rand() % 4 ? rand() & 255 : (rand() % 2) * 255;
+
+			wiring_map_t* map = wiring_compile(&layout, width, height);
+			const unsigned char* data = image.data();
+			std::string text1d = export_text([&] { return exporter_array1d_size(map, data); }, [&](char* out) { return exporter_array1d_write(map, data, out); });
+			std::string text2d = export_text([&] { return exporter_array2d_size(map, data); }, [&](char* out) { return exporter_array2d_write(map, data, out); });
+			CHECK(text1d == reference_array1d(width, height, data));
+			CHECK(text2d == reference_array2d(width, height, data));
+			destroy_wiring_map(map);
+		}
+	}
+}
+
+static std::string export_target(int target, int elementWidth, const wiring_map_t* map, const unsigned char* data) {
+	return export_text([&] { return exporter_target_size(target, elementWidth, map); },
+		[&](char* out) { return exporter_target_write(target, elementWidth, map, data, out); });
+}
+
+// a 2x2 image in default wiring runs p01 p00, then p10 p11
+static void golden_targets() {
+	const unsigned char image[] = {255, 0, 16, 1, 2, 3, 0, 128, 255, 9, 99, 200};
+	wiring_layout_t layout = wiring_default_layout();
+	wiring_map_t* map = wiring_compile(&layout, 2, 2);
+
+	CHECK(export_target(EXPORTER_TARGET_C_PROGMEM, EXPORTER_WIDTH_8, map, image) ==
+		"const uint8_t image[12] PROGMEM = {\n"
+		"    0x01, 0x02, 0x03, 0xFF, 0x00, 0x10,\n"
+		"    0x00, 0x80, 0xFF, 0x09, 0x63, 0xC8,\n"
+		"};");
+	CHECK(export_target(EXPORTER_TARGET_C_PROGMEM, EXPORTER_WIDTH_16, map, image) ==
+		"const uint16_t image[4] PROGMEM = {\n"
+		"    0x0000, 0xF802,\n"
+		"    0x041F, 0x0B19,\n"
+		"};");
+	CHECK(export_target(EXPORTER_TARGET_HEX, EXPORTER_WIDTH_16, map, image) == "000002F81F04190B");
+	CHECK(export_target(EXPORTER_TARGET_PYTHON, EXPORTER_WIDTH_32, map, image) ==
+		"image = bytes.fromhex(\n"
+		"    \"030201001000FF00\"\n"
+		"    \"FF800000C8630900\"\n"
+		")");
+	CHECK(export_target(EXPORTER_TARGET_BINARY, EXPORTER_WIDTH_8, map, image) ==
+		std::string("\x01\x02\x03\xFF\x00\x10\x00\x80\xFF\x09\x63\xC8", 12));
+	CHECK(export_target(EXPORTER_TARGET_BINARY, EXPORTER_WIDTH_32, map, image).size() == 16);
+
+	destroy_wiring_map(map);
+}
+
+void exporter_tests() {
+	golden_arrays();
+	golden_targets();
+}
\ No newline at end of file
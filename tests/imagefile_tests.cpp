@@ -0,0 +1,187 @@
+#include "test.h"
+#include "../source/imagefile.h"
+#include "../source/ledfile.h"
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+static void put_be32(std::vector<unsigned char>& out, uint32_t value) {
+	for (int shift = 24; shift >= 0; shift -= 8)
+		out.push_back((value >> shift) & 0xFF);
+}
+
+static void put_le(std::vector<unsigned char>& out, uint32_t value, int bytes) {
+	for (int i = 0; i < bytes; i++, value >>= 8)
+		out.push_back(value & 0xFF);
+}
+
+static uint32_t crc32(const unsigned char* data, size_t size) {
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+	}
+	return ~crc;
+}
+
+static void png_chunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& payload) {
+	put_be32(out, payload.size());
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), payload.begin(), payload.end());
+	put_be32(out, crc32(&out[start], out.size() - start));
+}
+
+// an 8-bit RGB PNG with unfiltered rows in stored deflate blocks
+static std::vector<unsigned char> make_png(int width, int height, const std::vector<unsigned char>& rgb) {
+	std::vector<unsigned char> raw;
+	for (int y = 0; y < height; y++) {
+		raw.push_back(0);
+		raw.insert(raw.end(), rgb.begin() + (size_t)y * width * 3, rgb.begin() + (size_t)(y + 1) * width * 3);
+	}
+
+	std::vector<unsigned char> zlib = {0x78, 0x01};
+	for (size_t pos = 0; pos < raw.size(); pos += 65535) {
+		size_t length = std::min<size_t>(raw.size() - pos, 65535);
+		zlib.push_back(pos + length == raw.size());
+		put_le(zlib, length, 2);
+		put_le(zlib, ~length & 0xFFFF, 2);
+		zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + length);
+	}
+	put_be32(zlib, ledfile_checksum(raw.data(), raw.size()));
+
+	std::vector<unsigned char> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	std::vector<unsigned char> header;
+	put_be32(header, width);
+	put_be32(header, height);
+	header.insert(header.end(), {8, 2, 0, 0, 0});
+	png_chunk(png, "IHDR", header);
+	png_chunk(png, "IDAT", zlib);
+	png_chunk(png, "IEND", {});
+	return png;
+}
+
+// 24-bit bottom-up BMP with padded rows
+static std::vector<unsigned char> make_bmp(int width, int height, const std::vector<unsigned char>& rgb) {
+	size_t stride = ((size_t)width * 3 + 3) & ~(size_t)3;
+	std::vector<unsigned char> bmp = {'B', 'M'};
+	put_le(bmp, 54 + stride * height, 4);
+	put_le(bmp, 0, 4);
+	put_le(bmp, 54, 4);
+	put_le(bmp, 40, 4);
+	put_le(bmp, width, 4);
+	put_le(bmp, height, 4);
+	put_le(bmp, 1, 2);
+	put_le(bmp, 24, 2);
+	put_le(bmp, 0, 4);
+	put_le(bmp, stride * height, 4);
+	put_le(bmp, 2835, 4);
+	put_le(bmp, 2835, 4);
+	put_le(bmp, 0, 4);
+	put_le(bmp, 0, 4);
+	for (int y = height - 1; y >= 0; y--) {
+		for (int x = 0; x < width; x++) {
+			const unsigned char* pixel = &rgb[((size_t)y * width + x) * 3];
+			bmp.insert(bmp.end(), {pixel[2], pixel[1], pixel[0]});
+		}
+		bmp.resize(bmp.size() + stride - width * 3, 0);
+	}
+	return bmp;
+}
+
+static std::vector<unsigned char> make_ppm(int width, int height, const std::vector<unsigned char>& rgb, bool ascii) {
+	std::string text = (ascii ? "P3\n# test\n" : "P6\n") + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+	std::vector<unsigned char> ppm(text.begin(), text.end());
+	if (!ascii) {
+		ppm.insert(ppm.end(), rgb.begin(), rgb.end());
+		return ppm;
+	}
+	for (unsigned char value : rgb) {
+		std::string sample = std::to_string(value) + " ";
+		ppm.insert(ppm.end(), sample.begin(), sample.end());
+	}
+	return ppm;
+}
+
+static int decode(const std::vector<unsigned char>& data, imagefile_image_t* image) {
+	return imagefile_decode(data.data(), data.size(), image);
+}
+
+// every truncation and a pile of single bit flips either fail or decode to an
+// image whose pixels match its dimensions; none of them may crash
+static void check_malformed(const std::vector<unsigned char>& file) {
+	for (size_t cut = 0; cut < file.size(); cut++) {
+		imagefile_image_t image;
+		int error = imagefile_decode(file.data(), cut, &image);
+		CHECK(error != IMAGEFILE_OK || image.pixels.size() == (size_t)image.width * image.height * 3);
+	}
+	for (int i = 0; i < 500; i++) {
+		std::vector<unsigned char> flipped = file;
+		flipped[rand() % flipped.size()] ^= 1 << (rand() % 8);
+		imagefile_image_t image;
+		if (decode(flipped, &image) == IMAGEFILE_OK)
+			CHECK(image.pixels.size() == (size_t)image.width * image.height * 3);
+	}
+}
+
+static void decode_formats() {
+	srand(20);
+	int width = 7, height = 5;
+	std::vector<unsigned char> rgb((size_t)width * height * 3);
+	for (unsigned char& value : rgb)
+		value = rand() & 255;
+
+	const std::vector<unsigned char> files[] = {
+		make_png(width, height, rgb),
+		make_bmp(width, height, rgb),
+		make_ppm(width, height, rgb, false),
+		make_ppm(width, height, rgb, true)
+	};
+	for (const std::vector<unsigned char>& file : files) {
+		imagefile_image_t image;
+		CHECK(decode(file, &image) == IMAGEFILE_OK);
+		CHECK(image.width == width && image.height == height);
+		CHECK(image.pixels == rgb);
+		check_malformed(file);
+	}
+}
+
+static void bad_headers() {
+	imagefile_image_t image;
+	std::vector<unsigned char> text = {'h', 'e', 'l', 'l', 'o', '!', '!', '!'};
+	CHECK(decode(text, &image) == IMAGEFILE_ERROR_FORMAT);
+	CHECK(imagefile_decode(nullptr, 0, &image) == IMAGEFILE_ERROR_FORMAT);
+
+	std::string tooWide = "P6 16385 1 255\n";
+	CHECK(decode(std::vector<unsigned char>(tooWide.begin(), tooWide.end()), &image) == IMAGEFILE_ERROR_DIMENSIONS);
+	std::string empty = "P6 0 4 255\n";
+	CHECK(decode(std::vector<unsigned char>(empty.begin(), empty.end()), &image) == IMAGEFILE_ERROR_DIMENSIONS);
+
+	// a header alone claiming the largest raster is refused before the pixels
+	// are allocated
+	const char* headersOnly[] = {"P6 16384 16384 255\n", "P3 16384 16384 255\n", "P5 16384 16384 65535\n", "P1 16384 16384\n"};
+	for (const char* header : headersOnly) {
+		imagefile_image_t huge;
+		std::string text(header);
+		CHECK(decode(std::vector<unsigned char>(text.begin(), text.end()), &huge) == IMAGEFILE_ERROR_CORRUPT);
+		CHECK(huge.pixels.capacity() == 0);
+	}
+	std::string packedBits = "P1 3 1 010";
+	CHECK(decode(std::vector<unsigned char>(packedBits.begin(), packedBits.end()), &image) == IMAGEFILE_OK);
+	CHECK(image.pixels.size() == 9 && image.pixels[0] == 255 && image.pixels[3] == 0);
+
+	std::vector<unsigned char> bmp = make_bmp(2, 2, std::vector<unsigned char>(12, 0));
+	bmp[22] = 0xFF;
+	bmp[23] = 0xFF;
+	bmp[24] = 0xFF;
+	bmp[25] = 0x7F;
+	CHECK(decode(bmp, &image) != IMAGEFILE_OK);
+
+	CHECK(imagefile_load(test_path("missing.png").c_str(), &image) == IMAGEFILE_ERROR_OPEN);
+}
+
+void imagefile_tests() {
+	decode_formats();
+	bad_headers();
+}
\ No newline at end of file
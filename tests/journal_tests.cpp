@@ -0,0 +1,153 @@
+#include "test.h"
+#include "../source/journal.h"
+#include "../source/bitmap.h"
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+
+static std::vector<unsigned char> image_of(bitmap_t* bitmap) {
+	return std::vector<unsigned char>(bitmap->image, bitmap->image + (size_t)bitmap->w * bitmap->h * 3);
+}
+
+// commits one random stroke the way the editor does and journals it
+static void random_edit(journal_t* journal, bitmap_t* bitmap) {
+	bitmap_start_undo_block(bitmap);
+	for (int i = 0; i < 3; i++)
+		bitmap_line(bitmap, rand() % bitmap->w, rand() % bitmap->h, rand() % bitmap->w, rand() % bitmap->h, rand() & 255, rand() & 255, rand() & 255, true);
+	size_t count = bitmap->undo_blocks.size();
+	bitmap_end_undo_block(bitmap);
+	if (bitmap->undo_blocks.size() > count) {
+		std::vector<bitmap_span_t> spans;
+		bitmap_undo_block_spans(bitmap, bitmap->undo_blocks.back(), &spans);
+		journal_delta(journal, bitmap, spans);
+	}
+}
+
+static void replay_matches() {
+	srand(19);
+	std::string path = test_path("replay.journal");
+	bitmap_t* bitmap = create_bitmap(24, 16);
+	bitmap_fill(bitmap, 10, 20, 30);
+
+	journal_t* journal = create_journal(path.c_str());
+	journal_snapshot(journal, bitmap);
+	for (int i = 0; i < 40; i++)
+		random_edit(journal, bitmap);
+	journal_flush(journal);
+
+	int width, height;
+	std::vector<unsigned char> restored;
+	CHECK(journal_replay(path.c_str(), &width, &height, &restored));
+	CHECK(width == 24 && height == 16);
+	CHECK(restored == image_of(bitmap));
+
+	random_edit(journal, bitmap);
+	destroy_journal(journal);
+	CHECK(journal_replay(path.c_str(), &width, &height, &restored));
+	CHECK(restored == image_of(bitmap));
+
+	destroy_bitmap(bitmap);
+	remove(path.c_str());
+}
+
+// a crash can cut the file anywhere; whatever is left replays to one of the
+// states it went through, or to nothing if the snapshot itself is torn
+static void torn_tails() {
+	srand(1919);
+	std::string path = test_path("torn.journal");
+	std::string cutPath = test_path("torn-cut.journal");
+	bitmap_t* bitmap = create_bitmap(12, 9);
+	bitmap_fill(bitmap, 0, 0, 0);
+
+	journal_t* journal = create_journal(path.c_str());
+	journal_snapshot(journal, bitmap);
+	std::vector<std::vector<unsigned char>> states = {image_of(bitmap)};
+	for (int i = 0; i < 12; i++) {
+		random_edit(journal, bitmap);
+		states.push_back(image_of(bitmap));
+	}
+	destroy_journal(journal);
+
+	std::vector<unsigned char> file = test_read_file(path);
+	CHECK(!file.empty());
+	for (size_t cut = 0; cut <= file.size(); cut++) {
+		CHECK(test_write_file(cutPath, std::vector<unsigned char>(file.begin(), file.begin() + cut)));
+		int width, height;
+		std::vector<unsigned char> restored;
+		if (!journal_replay(cutPath.c_str(), &width, &height, &restored))
+			continue;
+		bool known = false;
+		for (const std::vector<unsigned char>& state : states)
+			known |= restored == state;
+		CHECK(known);
+		if (cut == file.size())
+			CHECK(restored == states.back());
+	}
+
+	// a flipped byte in a record stops the replay there instead of applying it
+	for (int i = 0; i < 200; i++) {
+		std::vector<unsigned char> flipped = file;
+		flipped[8 + rand() % (flipped.size() - 8)] ^= 1 << (rand() % 8);
+		CHECK(test_write_file(cutPath, flipped));
+		int width, height;
+		std::vector<unsigned char> restored;
+		if (!journal_replay(cutPath.c_str(), &width, &height, &restored))
+			continue;
+		bool known = false;
+		for (const std::vector<unsigned char>& state : states)
+			known |= restored == state;
+		CHECK(known);
+	}
+
+	int width, height;
+	std::vector<unsigned char> restored;
+	CHECK(!journal_replay(test_path("missing.journal").c_str(), &width, &height, &restored));
+	CHECK(test_write_file(cutPath, {'L', 'E', 'D', 'J', 99, 0, 0, 0}));
+	CHECK(!journal_replay(cutPath.c_str(), &width, &height, &restored));
+
+	destroy_bitmap(bitmap);
+	remove(path.c_str());
+	remove(cutPath.c_str());
+}
+
+// while the journal can't be written, edits go nowhere; the first one after
+// it can be written again has to bring the file up to date on its own
+static void retries_after_failure() {
+	srand(190);
+	std::error_code error;
+	std::string directory = test_path("journal-dir");
+	std::string path = directory + "/autosave.journal";
+	std::filesystem::remove_all(directory, error);
+	bitmap_t* bitmap = create_bitmap(20, 10);
+	bitmap_fill(bitmap, 1, 2, 3);
+
+	journal_t* journal = create_journal(path.c_str());
+	journal_snapshot(journal, bitmap);
+	for (int i = 0; i < 5; i++) {
+		journal_flush(journal);
+		random_edit(journal, bitmap);
+	}
+	journal_flush(journal);
+
+	int width, height;
+	std::vector<unsigned char> restored;
+	CHECK(!journal_replay(path.c_str(), &width, &height, &restored));
+
+	CHECK(std::filesystem::create_directory(directory, error));
+	random_edit(journal, bitmap);
+	random_edit(journal, bitmap);
+	journal_flush(journal);
+	CHECK(journal_replay(path.c_str(), &width, &height, &restored));
+	CHECK(restored == image_of(bitmap));
+
+	destroy_journal(journal);
+	destroy_bitmap(bitmap);
+	std::filesystem::remove_all(directory, error);
+}
+
+void journal_tests() {
+	replay_matches();
+	torn_tails();
+	retries_after_failure();
+}
\ No newline at end of file
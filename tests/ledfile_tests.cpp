@@ -0,0 +1,235 @@
+#include "test.h"
+#include "../source/ledfile.h"
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+static void put_bytes(std::vector<unsigned char>& out, const void* data, size_t size) {
+	size_t pos = out.size();
+	out.resize(pos + size);
+	if (size)
+		memcpy(&out[pos], data, size);
+}
+
+static void put_int(std::vector<unsigned char>& out, int value) {
+	put_bytes(out, &value, sizeof(int));
+}
+
+static void put_chunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& payload) {
+	uint32_t length = payload.size();
+	put_bytes(out, type, 4);
+	put_bytes(out, &length, sizeof(uint32_t));
+	put_bytes(out, payload.data(), payload.size());
+}
+
+static std::vector<unsigned char> v2_header() {
+	std::vector<unsigned char> out = {'l', 'e', 'd', ' ', 'v', 'e', 'r', ' '};
+	put_int(out, 2);
+	return out;
+}
+
+static std::vector<unsigned char> head_chunk(int width, int height) {
+	std::vector<unsigned char> payload;
+	put_int(payload, width);
+	put_int(payload, height);
+	return payload;
+}
+
+static std::vector<unsigned char> pixel_chunk(const std::vector<unsigned char>& pixels) {
+	std::vector<unsigned char> payload;
+	uint32_t checksum = ledfile_checksum(pixels.data(), pixels.size());
+	put_bytes(payload, &checksum, sizeof(uint32_t));
+	put_bytes(payload, pixels.data(), pixels.size());
+	return payload;
+}
+
+static int open_bytes(const std::vector<unsigned char>& data, ledfile_image_t* image) {
+	std::string path = test_path("bytes.led");
+	if (!test_write_file(path, data))
+		return -1;
+	int error = ledfile_open(path.c_str(), image);
+	return error;
+}
+
+static int open_error(const std::vector<unsigned char>& data) {
+	ledfile_image_t image;
+	int error = open_bytes(data, &image);
+	if (error == LEDFILE_OK)
+		ledfile_close(&image);
+	return error;
+}
+
+static bool loads_as(const std::vector<unsigned char>& data, int width, int height, const std::vector<unsigned char>& pixels) {
+	ledfile_image_t image;
+	if (open_bytes(data, &image) != LEDFILE_OK)
+		return false;
+	bool same = image.width == width && image.height == height && !memcmp(image.pixels, pixels.data(), pixels.size());
+	ledfile_close(&image);
+	return same;
+}
+
+// packbits has to give back exactly the pixels it was given, with or without
+// runs in them, and the decoder has to refuse a stream that doesn't fill the
+// image exactly
+static void rle_roundtrip() {
+	srand(11);
+	for (int i = 0; i < 300; i++) {
+		size_t count = 1 + rand() % 400;
+		int colors = 1 + rand() % 4;
+		std::vector<unsigned char> pixels(count * 3);
+		for (size_t j = 0; j < count; j++) {
+			if (j && rand() % 3)
+				memcpy(&pixels[j * 3], &pixels[(j - 1) * 3], 3);
+			else
+				pixels[j * 3] = pixels[j * 3 + 1] = pixels[j * 3 + 2] = rand() % colors * 60;
+		}
+
+		std::vector<unsigned char> packed;
+		ledfile_rle_encode(pixels.data(), count, packed);
+		std::vector<unsigned char> unpacked(count * 3);
+		CHECK(ledfile_rle_decode(packed.data(), packed.size(), unpacked.data(), count));
+		CHECK(unpacked == pixels);
+
+		CHECK(!ledfile_rle_decode(packed.data(), packed.size() - 1, unpacked.data(), count));
+		CHECK(!ledfile_rle_decode(packed.data(), packed.size(), unpacked.data(), count - 1));
+		packed.push_back(0x80);
+		CHECK(!ledfile_rle_decode(packed.data(), packed.size(), unpacked.data(), count));
+	}
+}
+
+
+static void roundtrip() {
+	srand(12);
+	std::string path = test_path("roundtrip.led");
+	std::vector<unsigned char> noise(31 * 17 * 3), flat(64 * 48 * 3, 40);
+	for (unsigned char& value : noise)
+		value = rand() & 255;
+	for (size_t i = 0; i < flat.size(); i += 97)
+		flat[i] = 200;
+
+	// noise is stored raw and flat color packed; both must come back exactly
+	CHECK(ledfile_save(path.c_str(), 31, 17, noise.data()) == LEDFILE_OK);
+	CHECK(loads_as(test_read_file(path), 31, 17, noise));
+	CHECK(ledfile_save(path.c_str(), 64, 48, flat.data()) == LEDFILE_OK);
+	std::vector<unsigned char> packed = test_read_file(path);
+	CHECK(packed.size() < flat.size());
+	CHECK(loads_as(packed, 64, 48, flat));
+	CHECK(ledfile_save(path.c_str(), 0, 5, flat.data()) == LEDFILE_ERROR_DIMENSIONS);
+
+	// every truncation of a valid file is refused
+	for (size_t cut = 0; cut < packed.size(); cut++)
+		CHECK(open_error(std::vector<unsigned char>(packed.begin(), packed.begin() + cut)) != LEDFILE_OK);
+
+	remove(path.c_str());
+}
+
+static void old_versions() {
+	std::vector<unsigned char> pixels = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+
+	std::vector<unsigned char> v0;
+	put_bytes(v0, "led ", 4);
+	put_int(v0, 2);
+	put_int(v0, 2);
+	put_bytes(v0, pixels.data(), pixels.size());
+	CHECK(loads_as(v0, 2, 2, pixels));
+
+	std::vector<unsigned char> v1;
+	put_bytes(v1, "led ver ", 8);
+	put_int(v1, 1);
+	put_int(v1, 4);
+	put_int(v1, 1);
+	put_bytes(v1, pixels.data(), pixels.size());
+	CHECK(loads_as(v1, 4, 1, pixels));
+
+	v1.pop_back();
+	CHECK(open_error(v1) == LEDFILE_ERROR_CORRUPT);
+}
+
+static void malformed() {
+	std::vector<unsigned char> pixels = {1, 2, 3, 4, 5, 6};
+	std::vector<unsigned char> data;
+
+	CHECK(open_error({'l', 'e', 'd', '!', 0, 0, 0, 0}) == LEDFILE_ERROR_FORMAT);
+	data = {'l', 'e', 'd', ' ', 'v', 'e', 'r', ' '};
+	put_int(data, 3);
+	CHECK(open_error(data) == LEDFILE_ERROR_VERSION);
+	CHECK(open_error({}) != LEDFILE_OK);
+	ledfile_image_t image;
+	CHECK(ledfile_open(test_path("missing.led").c_str(), &image) == LEDFILE_ERROR_OPEN);
+
+	// a well formed file, then the same file broken one way at a time
+	data = v2_header();
+	put_chunk(data, "HEAD", head_chunk(2, 1));
+	put_chunk(data, "PIXR", pixel_chunk(pixels));
+	put_chunk(data, "END ", {});
+	CHECK(loads_as(data, 2, 1, pixels));
+
+	std::vector<unsigned char> flipped = data;
+	flipped[flipped.size() - 9] ^= 1;
+	CHECK(open_error(flipped) == LEDFILE_ERROR_CORRUPT);
+
+	data = v2_header();
+	put_chunk(data, "HEAD", head_chunk(0, 1));
+	put_chunk(data, "END ", {});
+	CHECK(open_error(data) == LEDFILE_ERROR_DIMENSIONS);
+
+	data = v2_header();
+	put_chunk(data, "PIXR", pixel_chunk(pixels));
+	put_chunk(data, "HEAD", head_chunk(2, 1));
+	put_chunk(data, "END ", {});
+	CHECK(open_error(data) == LEDFILE_ERROR_CORRUPT);
+
+	data = v2_header();
+	put_chunk(data, "HEAD", head_chunk(2, 1));
+	put_chunk(data, "PIXR", pixel_chunk(pixels));
+	CHECK(open_error(data) == LEDFILE_ERROR_CORRUPT);
+
+	data = v2_header();
+	put_chunk(data, "HEAD", head_chunk(2, 1));
+	put_chunk(data, "END ", {});
+	CHECK(open_error(data) == LEDFILE_ERROR_CORRUPT);
+
+	// a second header after the pixels would leave them sized for the first
+	data = v2_header();
+	put_chunk(data, "HEAD", head_chunk(1, 1));
+	put_chunk(data, "PIXR", pixel_chunk({1, 2, 3}));
+	put_chunk(data, "HEAD", head_chunk(4000, 4000));
+	put_chunk(data, "END ", {});
+	CHECK(open_error(data) == LEDFILE_ERROR_CORRUPT);
+
+	data = v2_header();
+	put_chunk(data, "HEAD", head_chunk(2, 1));
+	put_chunk(data, "HEAD", head_chunk(2, 1));
+	put_chunk(data, "PIXR", pixel_chunk(pixels));
+	put_chunk(data, "END ", {});
+	CHECK(open_error(data) == LEDFILE_ERROR_CORRUPT);
+
+	// each side is in range, but the canvas wouldn't fit an int index
+	CHECK(ledfile_valid_dimensions(LEDFILE_MAX_DIMENSION, 1));
+	CHECK(ledfile_valid_dimensions(16384, 16384));
+	CHECK(!ledfile_valid_dimensions(30000, 30000));
+	CHECK(!ledfile_valid_dimensions(LEDFILE_MAX_DIMENSION, LEDFILE_MAX_DIMENSION));
+	CHECK(ledfile_save(test_path("huge.led").c_str(), 30000, 30000, pixels.data()) == LEDFILE_ERROR_DIMENSIONS);
+	data = v2_header();
+	put_chunk(data, "HEAD", head_chunk(30000, 30000));
+	put_chunk(data, "END ", {});
+	CHECK(open_error(data) == LEDFILE_ERROR_DIMENSIONS);
+
+	// a few bytes of packed data claiming to fill a huge canvas is refused
+	// before anything is allocated
+	data = v2_header();
+	put_chunk(data, "HEAD", head_chunk(20000, 20000));
+	put_chunk(data, "PIXC", {0, 0, 0, 0, 0xFF, 1, 2, 3});
+	put_chunk(data, "END ", {});
+	CHECK(open_error(data) == LEDFILE_ERROR_CORRUPT);
+
+	remove(test_path("bytes.led").c_str());
+}
+
+void ledfile_tests() {
+	rle_roundtrip();
+	roundtrip();
+	old_versions();
+	malformed();
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "test.h"
+#include <cstring>
+
+int testFailures = 0;
+
+void bitmap_tests();
+void colorout_tests();
+void exporter_tests();
+void ledfile_tests();
+void imagefile_tests();
+void journal_tests();
+void scheduler_tests();
+void utf8_tests();
+
+static const test_case_t testCases[] = {
+	{"bitmap", bitmap_tests},
+	{"colorout", colorout_tests},
+	{"exporter", exporter_tests},
+	{"ledfile", ledfile_tests},
+	{"imagefile", imagefile_tests},
+	{"journal", journal_tests},
+	{"scheduler", scheduler_tests},
+	{"utf8", utf8_tests}
+};
+
+std::string test_path(const char* name) {
+	return std::string("leditor-test-") + name;
+}
+
+bool test_write_file(const std::string& path, const std::vector<unsigned char>& data) {
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+	bool ok = data.empty() || fwrite(data.data(), 1, data.size(), file) == data.size();
+	return fclose(file) == 0 && ok;
+}
+
+std::vector<unsigned char> test_read_file(const std::string& path) {
+	std::vector<unsigned char> data;
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+		return data;
+	unsigned char buffer[4096];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.insert(data.end(), buffer, buffer + count);
+	fclose(file);
+	return data;
+}
+
+// runs every test, or just the ones named on the command line
+int main(int argc, char** argv) {
+	int ran = 0;
+	for (const test_case_t& test : testCases) {
+		bool wanted = argc < 2;
+		for (int i = 1; i < argc; i++)
+			wanted |= !strcmp(argv[i], test.name);
+		if (!wanted)
+			continue;
+
+		int failures = testFailures;
+		test.func();
+		printf("%s: %s\n", test.name, testFailures == failures ? "ok" : "FAILED");
+		ran++;
+	}
+
+	if (!ran) {
+		fprintf(stderr, "no such test\n");
+		return 1;
+	}
+	return testFailures ? 1 : 0;
+}
\ No newline at end of file
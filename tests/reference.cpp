@@ -0,0 +1,127 @@
+#include "reference.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+
+// UIEditBitmap::recurseFill before the scanline fill, one call per pixel.
+// deep enough regions overflow the stack, which is why it was replaced
+void reference_recurse_fill(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char matchR, unsigned char matchG, unsigned char matchB, int tolerance, bool undo) {
+	int idx = (y * bitmap->w + x) * 3;
+	bool bogusTest = abs((int)r - (int)matchR) <= tolerance &&
+	abs((int)g - (int)matchG) <= tolerance &&
+	abs((int)b - (int)matchB) <= tolerance;
+	if (bogusTest)
+		return;
+
+	bitmap_pixel(bitmap, x, y, r, g, b, undo);
+	for (int ofsX = -1; ofsX < 2; ofsX++) {
+		for (int ofsY = -1; ofsY < 2; ofsY++) {
+			if (!ofsX && !ofsY)
+				continue;
+			if (ofsX && ofsY)
+				continue;
+
+			int testx = std::max(0, std::min(bitmap->w - 1, x + ofsX));
+			int testy = std::max(0, std::min(bitmap->h - 1, y + ofsY));
+			if (testx == x && testy == y)
+				continue;
+
+			idx = (testy * bitmap->w + testx) * 3;
+			bool test = abs((int)bitmap->image[idx] - (int)matchR) <= tolerance &&
+			abs((int)bitmap->image[idx + 1] - (int)matchG) <= tolerance &&
+			abs((int)bitmap->image[idx + 2] - (int)matchB) <= tolerance;
+			if (test)
+				reference_recurse_fill(bitmap, testx, testy, r, g, b, matchR, matchG, matchB, tolerance, undo);
+		}
+	}
+}
+
+// the clipboard exporters as they were before the exporter module, minus the
+// clipboard; the new writers have to match them byte for byte
+std::string reference_array1d(int width, int height, const unsigned char* data) {
+	std::string str = "int image[] = {\n";
+	bool reverse = true;
+	for (int y = 0; y < height; y++) {
+		str += "    ";
+		for (int i = 0; i < width; i++) {
+			int x = reverse ? width - 1 - i : i;
+			int idx = (y * width + x) * 3;
+			str += std::to_string(data[idx]) + ", ";
+			str += std::to_string(data[idx + 1]) + ", ";
+			str += std::to_string(data[idx + 2]) + ", ";
+		}
+		str += '\n';
+		reverse = !reverse;
+	}
+
+	str.pop_back();
+	str.pop_back();
+	str.pop_back();
+	str += "\n};";
+	return str;
+}
+
+std::string reference_array2d(int width, int height, const unsigned char* data) {
+	std::string str = "int image[][] = {\n";
+	bool reverse = true;
+	for (int y = 0; y < height; y++) {
+		str += "    { ";
+		for (int i = 0; i < width; i++) {
+			int x = reverse ? width - 1 - i : i;
+			int idx = (y * width + x) * 3;
+			str += std::to_string(data[idx]) + ", ";
+			str += std::to_string(data[idx + 1]) + ", ";
+			str += std::to_string(data[idx + 2]) + ", ";
+		}
+		str.pop_back();
+		str.pop_back();
+		str += " },\n";
+		reverse = !reverse;
+	}
+
+	str.pop_back();
+	str.pop_back();
+	str += "\n};";
+	return str;
+}
+
+// the output transform worked out per pixel with no tables, the way it would
+// be written without colorout; order is the same index as colorout_order_e
+void reference_colorout(int order, const float gamma[3], float brightness, const unsigned char* src, unsigned char* dst, size_t count) {
+	static const int sources[6][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+	for (size_t i = 0; i < count; i++, src += 3, dst += 3) {
+		unsigned char out[3];
+		for (int slot = 0; slot < 3; slot++) {
+			int source = sources[order][slot];
+			float value = powf(src[source] / 255.0f, gamma[source]) * brightness;
+			out[slot] = (unsigned char)lroundf(value * 255.0f);
+		}
+		memcpy(dst, out, 3);
+	}
+}
+
+// bitmap_line before clipping: Bresenham over the whole segment, one
+// bounds-checked pixel per step
+void reference_line(bitmap_t* bitmap, int x1, int y1, int x2, int y2, unsigned char r, unsigned char g, unsigned char b, bool undo) {
+	int dx = abs(x2 - x1);
+	int dy = -abs(y2 - y1);
+	int sx = x1 < x2 ? 1 : -1;
+	int sy = y1 < y2 ? 1 : -1;
+	int err1 = dx + dy;
+	int err2;
+
+	bitmap_pixel(bitmap, x1, y1, r, g, b, undo);
+	while (x1 != x2 || y1 != y2) {
+		err2 = 2 * err1;
+		if (err2 >= dy) {
+			err1 += dy;
+			x1 += sx;
+		}
+		if (err2 <= dx) {
+			err1 += dx;
+			y1 += sy;
+		}
+		bitmap_pixel(bitmap, x1, y1, r, g, b, undo);
+	}
+}
\ No newline at end of file
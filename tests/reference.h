@@ -0,0 +1,12 @@
+#pragma once
+#include "../source/bitmap.h"
+#include <string>
+#include <cstddef>
+
+// the code the optimized modules replaced, kept as a baseline to measure and
+// check them against
+void reference_recurse_fill(bitmap_t* bitmap, int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char matchR, unsigned char matchG, unsigned char matchB, int tolerance, bool undo = false);
+std::string reference_array1d(int width, int height, const unsigned char* data);
+std::string reference_array2d(int width, int height, const unsigned char* data);
+void reference_colorout(int order, const float gamma[3], float brightness, const unsigned char* src, unsigned char* dst, size_t count);
+void reference_line(bitmap_t* bitmap, int x1, int y1, int x2, int y2, unsigned char r, unsigned char g, unsigned char b, bool undo = false);
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include "test.h"
+#include "../source/scheduler.h"
+#include <cmath>
+
+static int wakeCount = 0;
+
+static void count_wake() {
+	wakeCount++;
+}
+
+// a clean scheduler sleeps until woken, damage inside the frame cap waits out
+// the rest of the interval, and damage past it draws at once
+static void wait_times() {
+	scheduler_t* scheduler = create_scheduler(50);
+	double interval = 1.0 / 50;
+
+	CHECK(scheduler_wait_time(scheduler, 10.0) == 0.0);
+	CHECK(scheduler_begin_frame(scheduler, 10.0));
+	CHECK(scheduler_wait_time(scheduler, 10.0) == -1.0);
+	CHECK(scheduler_wait_time(scheduler, 20.0) == -1.0);
+	CHECK(!scheduler_begin_frame(scheduler, 20.0));
+
+	scheduler_invalidate(scheduler);
+	CHECK(fabs(scheduler_wait_time(scheduler, 10.005) - (interval - 0.005)) < 1e-9);
+	CHECK(!scheduler_begin_frame(scheduler, 10.005));
+	CHECK(scheduler_wait_time(scheduler, 10.0 + interval) == 0.0);
+	CHECK(scheduler_wait_time(scheduler, 11.0) == 0.0);
+
+	// the frame takes the damage with it
+	CHECK(scheduler_begin_frame(scheduler, 11.0));
+	CHECK(scheduler_wait_time(scheduler, 12.0) == -1.0);
+	CHECK(!scheduler_begin_frame(scheduler, 12.0));
+
+	destroy_scheduler(scheduler);
+}
+
+// the platform layer is only woken for the first damage of a frame; more of
+// it before the frame runs is already covered
+static void wakes_once() {
+	scheduler_t* scheduler = create_scheduler(60);
+	scheduler_set_wake_func(scheduler, count_wake);
+	CHECK(scheduler_begin_frame(scheduler, 1.0));
+
+	wakeCount = 0;
+	scheduler_invalidate(scheduler);
+	CHECK(wakeCount == 1);
+	scheduler_invalidate(scheduler);
+	scheduler_invalidate(scheduler);
+	CHECK(wakeCount == 1);
+
+	CHECK(scheduler_begin_frame(scheduler, 2.0));
+	scheduler_invalidate(scheduler);
+	CHECK(wakeCount == 2);
+
+	destroy_scheduler(scheduler);
+}
+
+void scheduler_tests() {
+	wait_times();
+	wakes_once();
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// a failed check is reported and counted, but the test carries on so one run
+// shows everything that broke
+extern int testFailures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		testFailures++; \
+	} \
+} while (0)
+
+/* Test Case */
+typedef struct test_case_s {
+	const char* name;
+	void (*func)();
+} test_case_t;
+
+// scratch files go in the working directory, which ctest points at the build tree
+std::string test_path(const char* name);
+bool test_write_file(const std::string& path, const std::vector<unsigned char>& data);
+std::vector<unsigned char> test_read_file(const std::string& path);
\ No newline at end of file
@@ -0,0 +1,64 @@
+#include "test.h"
+#include "../source/utf8.h"
+
+static const unsigned int BAD = 0xFFFD;
+
+// decodes up to the terminator; every call has to step at least one byte
+static bool decodes_to(const char* text, const std::vector<unsigned int>& expected) {
+	std::vector<unsigned int> decoded;
+	while (*text && decoded.size() <= expected.size())
+		decoded.push_back(utf8_decode(&text));
+	return decoded == expected;
+}
+
+static void well_formed() {
+	CHECK(decodes_to("abc", {'a', 'b', 'c'}));
+	CHECK(decodes_to("\x7F", {0x7F}));
+	CHECK(decodes_to("\xC2\x80", {0x80}));
+	CHECK(decodes_to("\xC3\xA9", {0xE9}));
+	CHECK(decodes_to("\xDF\xBF", {0x7FF}));
+	CHECK(decodes_to("\xE0\xA0\x80", {0x800}));
+	CHECK(decodes_to("\xE2\x82\xAC", {0x20AC}));
+	CHECK(decodes_to("\xEF\xBF\xBF", {0xFFFF}));
+	CHECK(decodes_to("\xF0\x90\x80\x80", {0x10000}));
+	CHECK(decodes_to("\xF0\x9F\x98\x80", {0x1F600}));
+	CHECK(decodes_to("\xF4\x8F\xBF\xBF", {0x10FFFF}));
+	CHECK(decodes_to("a\xC3\xA9" "b\xE2\x82\xAC", {'a', 0xE9, 'b', 0x20AC}));
+}
+
+// a malformed sequence costs one replacement per byte and nothing after it,
+// so the text resynchronizes on the next lead byte
+static void malformed() {
+	// overlong encodings
+	CHECK(decodes_to("\xC0\xAF", {BAD, BAD}));
+	CHECK(decodes_to("\xC1\xBF", {BAD, BAD}));
+	CHECK(decodes_to("\xE0\x80\xAF", {BAD, BAD, BAD}));
+	CHECK(decodes_to("\xE0\x9F\xBF", {BAD, BAD, BAD}));
+	CHECK(decodes_to("\xF0\x80\x80\xAF", {BAD, BAD, BAD, BAD}));
+	CHECK(decodes_to("\xF0\x8F\xBF\xBF", {BAD, BAD, BAD, BAD}));
+
+	// UTF-16 surrogates, and past U+10FFFF
+	CHECK(decodes_to("\xED\xA0\x80", {BAD, BAD, BAD}));
+	CHECK(decodes_to("\xED\xBF\xBF", {BAD, BAD, BAD}));
+	CHECK(decodes_to("\xED\x9F\xBF", {0xD7FF}));
+	CHECK(decodes_to("\xF4\x90\x80\x80", {BAD, BAD, BAD, BAD}));
+	CHECK(decodes_to("\xF8\x88\x80\x80\x80", {BAD, BAD, BAD, BAD, BAD}));
+	CHECK(decodes_to("\xFF" "a", {BAD, 'a'}));
+
+	// truncated sequences, cut by the terminator or by the next character
+	CHECK(decodes_to("\xC3", {BAD}));
+	CHECK(decodes_to("\xE2\x82", {BAD, BAD}));
+	CHECK(decodes_to("\xF0\x9F\x98", {BAD, BAD, BAD}));
+	CHECK(decodes_to("\xE2\x82" "A", {BAD, BAD, 'A'}));
+	CHECK(decodes_to("\xF0\x9F" "\xC3\xA9", {BAD, BAD, 0xE9}));
+
+	// stray continuation bytes
+	CHECK(decodes_to("\x80", {BAD}));
+	CHECK(decodes_to("a\xBF" "b", {'a', BAD, 'b'}));
+	CHECK(decodes_to("\x80\x80\xE2\x82\xAC", {BAD, BAD, 0x20AC}));
+}
+
+void utf8_tests() {
+	well_formed();
+	malformed();
+}
\ No newline at end of file